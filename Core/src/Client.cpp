@@ -5,7 +5,8 @@
 #include "Client.h"
 
 #include <utility>
-#include "utils/conversion.h"
+#include <algorithm>
+#include "utils/RealtimeAllocationTracker.h"
 
 // AudioIO engine
 #ifdef USE_RT_AUDIO
@@ -22,40 +23,25 @@
 
 Client::Client(std::shared_ptr<DigitalStage::Api::Client> api_client) :
     api_client_(std::move(api_client)),
-    audio_renderer_(std::make_unique<AudioRenderer<float>>(api_client_, true)),
-    connection_service_(std::make_unique<ConnectionService>(api_client_)),
-    receiver_buffer_(RECEIVER_BUFFER) {
+    track_interner_(std::make_shared<TrackInterner>()),
+    audio_renderer_(std::make_unique<AudioRenderer<float>>(api_client_, track_interner_, true)),
+    connection_service_(std::make_unique<ConnectionService>(api_client_, track_interner_)),
+    receiver_buffer_(RECEIVER_BUFFER),
+    sample_rate_(DEFAULT_SAMPLE_RATE),
+    mix_left_(nullptr),
+    mix_right_(nullptr) {
+  // The driver thread renders as well
+  const auto cores = std::max(1U, std::thread::hardware_concurrency());
+  render_pool_ = std::make_unique<RealtimeWorkerPool>(std::min<std::size_t>(cores - 1, MAX_RENDER_WORKERS));
+  audio_renderer_->setRenderBudget(RENDER_BUDGET * static_cast<double>(render_pool_->getConcurrency()));
+  render_jobs_.reserve(256);
 #ifdef USE_RT_AUDIO
-  audio_io_ = std::make_unique<RtAudioIO>(api_client_);
+  audio_io_ = std::make_unique<RtAudioIO>(api_client_, track_interner_);
 #else
-  audio_io_ = std::make_unique<MiniAudioIO>(api_client_);
+  audio_io_ = std::make_unique<MiniAudioIO>(api_client_, track_interner_);
 #endif
 
-  connection_service_->onData.connect([this](const std::string &audio_track_id, std::vector<std::byte> data) {
-    if (channels_.count(audio_track_id) == 0) {
-      std::unique_lock lock(channels_mutex_);
-#ifdef USE_CIRCULAR_QUEUE
-      channels_[audio_track_id] = std::make_shared<CircularQueue<float>>(receiver_buffer_);
-#else
-      channels_[audio_track_id] = std::make_shared<RingBuffer<float>>(receiver_buffer_);
-      PLOGI << "Resulting buffer latency is " << (receiver_buffer_ / 48000) << " seconds";
-#endif
-      lock.unlock();
-    }
-    auto values_size = data.size() / 4;
-    auto *values = new float[values_size];
-    deserialize(data.data(), data.size(), values);
-    std::shared_lock lock(channels_mutex_);
-#ifdef USE_CIRCULAR_QUEUE
-
-#else
-    for (int value = 0; value < values_size; value++) {
-      channels_[audio_track_id]->put(values[value]);
-    }
-#endif
-    delete[] values;
-    lock.unlock();  // May be useless here
-  });
+  connection_service_->onData.connect(&Client::onData, this);
   attachHandlers();
   attachAudioHandlers();
 
@@ -70,74 +56,83 @@ Client::~Client() {
   api_client_.reset();
 }
 
-void Client::onCaptureCallback(const std::string &audio_track_id, const float *data, const std::size_t frame_count) {
-  // Write to channels
-  if (channels_.count(audio_track_id) == 0) {
-    std::unique_lock lock(channels_mutex_);
-#ifdef USE_CIRCULAR_QUEUE
-    channels_[audio_track_id] = std::make_shared<CircularQueue<float>>(receiver_buffer_);
-#else
-    channels_[audio_track_id] = std::make_shared<RingBuffer<float>>(receiver_buffer_);
-#endif
-    lock.unlock();
+void Client::onCaptureCallback(TrackHandle audio_track, const float *data, const std::size_t frame_count) {
+  RealtimeScope realtime_scope;
+  // Write to channels, the buffer has been created when the track was added
+  auto tracks = tracks_.read();
+  if (auto *buffer = tracks->find(audio_track)) {
+    buffer->push(data, frame_count);
   }
-  std::shared_lock lock(channels_mutex_);
-#ifdef USE_CIRCULAR_QUEUE
-  channels_[audio_track_id]->enqueue_many(data, 0, frame_count);
-#else
-  for (int f = 0; f < frame_count; f++) {
-    channels_[audio_track_id]->put(data[f]);
-  }
-#endif
-  lock.unlock();
 
-  // Send to webRTC
-  connection_service_->broadcastFloats(audio_track_id, data, frame_count);
+  // Queue for the network thread
+  broadcast(tracks->findActivity(audio_track), audio_track, data, frame_count);
 }
-void Client::onPlaybackCallback(float *out[], std::size_t num_output_channels, const std::size_t frame_count) {
-  auto *left = new float[frame_count];
-  auto *right = new float[frame_count];
-  memset(left, 0, frame_count * sizeof(float));
-  memset(right, 0, frame_count * sizeof(float));
-
-  if (audio_renderer_) {
-    for (const auto &item: channels_) {
-      if (item.second) {
-        auto *buf = static_cast<float *>(malloc(frame_count * sizeof(float)));
-#ifdef USE_CIRCULAR_QUEUE
-        for (int f = 0; f < frame_count; f++) {
-        buf[f] = item.second->dequeue();
-      }
-#else
-        for (int f = 0; f < frame_count; f++) {
-          buf[f] = item.second->get();
-        }
-#endif
-        audio_renderer_->render(item.first, buf, left, right, frame_count);
-        free(buf);
+bool Client::broadcast(TrackActivity *activity, TrackHandle audio_track, const float *data, std::size_t frame_count) {
+  if (activity && !activity->capture.process(data, frame_count)) {
+    connection_service_->broadcastSilence(audio_track, frame_count);
+    return false;
+  }
+  connection_service_->broadcastFloats(audio_track, data, frame_count);
+  return true;
+}
+void Client::onData(TrackHandle audio_track, const std::vector<std::byte> &data) {
+  addChannel(audio_track);
+  const std::byte *payload = data.data();
+  std::optional<AudioPacketHeader> header;
+  if (!isLegacyAudioPacket(data.data(), data.size())) {
+    header = decodeAudioPacketHeader(data.data(), data.size());
+    if (!header || header->channel_count != 1) {
+      PLOGW << "Dropping unsupported audio packet of track " << track_interner_->getId(audio_track);
+      return;
+    }
+    payload += kAudioPacketHeaderSize;
+    if (header->silent) {
+      auto tracks = tracks_.read();
+      if (auto *buffer = tracks->find(audio_track)) {
+        buffer->pushSilence(header->sequence, header->timestamp, header->frame_count);
       }
+      return;
+    }
+    if (header->codec != AudioCodecType::kPcm) {
+      decodePacket(audio_track, *header, payload, data.size() - kAudioPacketHeaderSize);
+      return;
     }
-    audio_renderer_->renderReverb(left, right, frame_count);
   }
-
-  if (num_output_channels % 2 == 0) {
-    // Use stereo for all
-    for (int output_channel = 0; output_channel < num_output_channels; output_channel++) {
-      if (output_channel % 2 == 0) {
-        out[output_channel] = &left[0];
-      } else {
-        out[output_channel] = &right[0];
-      }
+  // The payload is decoded straight into the jitter buffer
+  auto tracks = tracks_.read();
+  if (auto *buffer = tracks->find(audio_track)) {
+    if (header) {
+      buffer->push(header->sequence, header->timestamp, payload, header->sample_format, header->frame_count);
+    } else {
+      buffer->push(payload, AudioSampleFormat::kFloat32, data.size() / 4);
     }
-  } else {
-    // Use mono for all
-    for (int output_channel = 0; output_channel < num_output_channels; output_channel++) {
-      out[output_channel] = &left[0];
+  }
+}
+void Client::onPlaybackCallback(float *out[], std::size_t num_output_channels, const std::size_t frame_count) {
+  RealtimeScope realtime_scope;
+  auto buffers = mix_buffers_.read();
+  if (frame_count > buffers->max_frame_count) {
+    // The buffers are too small for this block, so output silence instead
+    for (std::size_t output_channel = 0; output_channel < num_output_channels; output_channel++) {
+      std::fill_n(out[output_channel], frame_count, 0.0f);
     }
+    return;
   }
+  prepareMix(*buffers, out, num_output_channels, frame_count);
 
-  //delete [] left;
-  //delete [] right;
+  if (audio_renderer_) {
+    beginRender(frame_count);
+    // The snapshot keeps the buffers of the jobs alive until all are rendered
+    auto tracks = tracks_.read();
+    render_jobs_.clear();
+    for (const auto &track: tracks->tracks) {
+      render_jobs_.push_back({track.handle, nullptr, track.buffer.get(), track.activity.get(), true});
+    }
+    renderTracks(*buffers, frame_count);
+    renderReverb(frame_count);
+  }
+
+  writeOutput(out, num_output_channels, frame_count);
 }
 void Client::attachHandlers() {
   api_client_->ready.connect([this](const std::weak_ptr<DigitalStage::Api::Store> &store_ptr) {
@@ -145,11 +140,37 @@ void Client::attachHandlers() {
     if (store_ptr.expired()) {
       return;
     }
-    auto local_device = store_ptr.lock()->getLocalDevice();
+    auto store = store_ptr.lock();
+    auto output_sound_card = store->getOutputSoundCard();
+    if (output_sound_card && output_sound_card->sampleRate > 0) {
+      sample_rate_ = output_sound_card->sampleRate;
+      connection_service_->setSampleRate(sample_rate_);
+    }
+    auto local_device = store->getLocalDevice();
     if (local_device) {
       changeReceiverSize(local_device->buffer);
     }
   });
+  api_client_->outputSoundCardChanged.connect([this](const std::string &, const nlohmann::json &update,
+                                                     const std::weak_ptr<DigitalStage::Api::Store> & /*store_ptr*/) {
+    if (update.contains("sampleRate")) {
+      sample_rate_ = update["sampleRate"].get<unsigned int>();
+      connection_service_->setSampleRate(sample_rate_);
+    }
+  });
+  api_client_->audioTrackAdded.connect([this](const DigitalStage::Types::AudioTrack &audio_track,
+                                              const std::weak_ptr<DigitalStage::Api::Store> &store_ptr) {
+    if (store_ptr.expired()) {
+      return;
+    }
+    // Create the buffers and the send queue of local tracks here, so the capture callback never has to
+    auto local_device_id = store_ptr.lock()->getLocalDeviceId();
+    if (local_device_id && audio_track.deviceId == *local_device_id) {
+      const auto handle = track_interner_->intern(audio_track._id);
+      addChannel(handle);
+      connection_service_->open(handle);
+    }
+  });
   api_client_->localDeviceChanged.connect([this](const std::string &, const nlohmann::json &update,
                                                  const std::weak_ptr<DigitalStage::Api::Store> & /*store_ptr*/) {
     if (update.contains("buffer")) {
@@ -157,96 +178,244 @@ void Client::attachHandlers() {
     }
   });
 }
-void Client::onDuplexCallback(const std::unordered_map<std::string, float *> &audio_tracks,
+void Client::onDuplexCallback(const InputTracks &audio_tracks,
                               float **out,
                               std::size_t num_output_channels,
                               std::size_t frame_count) {
-  if (!is_ready_)
+  RealtimeScope realtime_scope;
+  auto buffers = mix_buffers_.read();
+  if (!is_ready_ || frame_count > buffers->max_frame_count) {
+    for (std::size_t output_channel = 0; output_channel < num_output_channels; output_channel++) {
+      std::fill_n(out[output_channel], frame_count, 0.0f);
+    }
     return;
+  }
 
   // Mix to L / R
-  auto *left = new float[frame_count];
-  auto *right = new float[frame_count];
-  memset(left, 0, frame_count * sizeof(float));
-  memset(right, 0, frame_count * sizeof(float));
+  prepareMix(*buffers, out, num_output_channels, frame_count);
+
+  beginRender(frame_count);
 
   // Forward local capture stream
+  auto tracks = tracks_.read();
+  render_jobs_.clear();
   for (const auto &item: audio_tracks) {
     if (item.second) {
-      // Send to webRTC
-      connection_service_->broadcastFloats(item.first, item.second, frame_count);
+      // Queue for the network thread
+      auto *activity = tracks->findActivity(item.first);
+      const bool active = broadcast(activity, item.first, item.second, frame_count);
 
-      audio_renderer_->render(item.first, item.second, left, right, frame_count);
-    } else {
-      PLOGE << "Audio track item is null";
+      render_jobs_.push_back({item.first, item.second, nullptr, activity, active});
     }
   }
+  const auto local_jobs = render_jobs_.size();
 
-  // Forward remote streams
-  for (const auto &item: channels_) {
-    if (item.second) {
-      auto *buf = static_cast<float *>(malloc(frame_count * sizeof(float)));
-#ifdef USE_CIRCULAR_QUEUE
-      for (int f = 0; f < frame_count; f++) {
-        buf[f] = item.second->dequeue();
-      }
-#else
-      for (int f = 0; f < frame_count; f++) {
-        buf[f] = item.second->get();
-      }
-#endif
-      audio_renderer_->render(item.first, buf, left, right, frame_count);
-      free(buf);
-    } else {
-      std::cerr << "Channel item is null" << std::endl;
+  // Forward remote streams, local tracks are rendered straight from the input above
+  for (const auto &track: tracks->tracks) {
+    const auto local = std::find_if(render_jobs_.begin(), render_jobs_.begin() + local_jobs, [&track](const auto &job) {
+      return job.audio_track == track.handle;
+    });
+    if (local == render_jobs_.begin() + local_jobs) {
+      render_jobs_.push_back({track.handle, nullptr, track.buffer.get(), track.activity.get(), true});
     }
   }
+  renderTracks(*buffers, frame_count);
 
-  audio_renderer_->renderReverb(left, right, frame_count);
+  renderReverb(frame_count);
 
+  writeOutput(out, num_output_channels, frame_count);
+}
+void Client::prepareMix(const MixBuffers &buffers,
+                        float **out,
+                        std::size_t num_output_channels,
+                        std::size_t frame_count) {
+  // Mix straight into the first output channels when they take the stereo (or mono) signal anyway
+  mix_left_ = num_output_channels > 0 ? out[0] : buffers.left.data();
+  mix_right_ = num_output_channels > 1 && num_output_channels % 2 == 0 ? out[1] : buffers.right.data();
+  std::fill_n(mix_left_, frame_count, 0.0f);
+  std::fill_n(mix_right_, frame_count, 0.0f);
+}
+void Client::beginRender(std::size_t frame_count) {
+  audio_renderer_->beginBlock(frame_count);
+}
+void Client::renderTracks(const MixBuffers &buffers, std::size_t frame_count) {
+  const auto max_frame_count = buffers.max_frame_count;
+  const auto threads = render_pool_->getConcurrency();
+  std::fill_n(buffers.partials.begin(), threads * 2 * max_frame_count, 0.0f);
+  auto job = [this, &buffers, max_frame_count, frame_count](std::size_t index, std::size_t thread) {
+    auto &render_job = render_jobs_[index];
+    float *left = &buffers.partials[thread * 2 * max_frame_count];
+    float *right = left + max_frame_count;
+    float *input = render_job.input;
+    bool active = render_job.active;
+    if (!input) {
+      input = &buffers.scratch[thread * max_frame_count];
+      render_job.buffer->pop(input, frame_count);
+      if (render_job.activity) {
+        active = render_job.activity->playback.process(input, frame_count);
+      }
+    }
+    const auto saved = audio_renderer_->render(render_job.audio_track, input, left, right, frame_count, active);
+    if (render_job.activity && !active) {
+      render_job.activity->silent_blocks++;
+      render_job.activity->saved_render_ns += static_cast<std::size_t>(saved);
+    }
+  };
+  render_pool_->run(render_jobs_.size(), job);
+
+  // Always sum the partial mixes in the same order
+  for (std::size_t thread = 0; thread < threads; thread++) {
+    const float *left = &buffers.partials[thread * 2 * max_frame_count];
+    const float *right = left + max_frame_count;
+    for (std::size_t frame = 0; frame < frame_count; frame++) {
+      mix_left_[frame] += left[frame];
+      mix_right_[frame] += right[frame];
+    }
+  }
+}
+void Client::renderReverb(std::size_t frame_count) {
+  audio_renderer_->renderReverb(mix_left_, mix_right_, frame_count);
+}
+void Client::writeOutput(float **out, std::size_t num_output_channels, std::size_t frame_count) {
+  // The first channels already hold the mix, so only copy it to the remaining ones
   if (num_output_channels % 2 == 0) {
     // Use stereo for all
-    for (int output_channel = 0; output_channel < num_output_channels; output_channel++) {
-      // Just mixdown to mono for now.
-      if (output_channel % 2 == 0) {
-        out[output_channel] = &left[0];
-      } else {
-        out[output_channel] = &right[0];
-      }
+    for (std::size_t output_channel = 2; output_channel < num_output_channels; output_channel++) {
+      std::copy_n(output_channel % 2 == 0 ? mix_left_ : mix_right_, frame_count, out[output_channel]);
     }
   } else {
     // Use mono for all
-    for (int output_channel = 0; output_channel < num_output_channels; output_channel++) {
-      out[output_channel] = &left[0];
+    for (std::size_t output_channel = 1; output_channel < num_output_channels; output_channel++) {
+      std::copy_n(mix_left_, frame_count, out[output_channel]);
     }
   }
-
-  //delete [] left;
-  //delete [] right;
 }
-void Client::onClose(const std::string &audio_track_id) {
-  PLOGD << "Closing data channel of local audio track " << audio_track_id;
-  connection_service_->close(audio_track_id);
+void Client::onClose(TrackHandle audio_track) {
+  PLOGD << "Closing data channel of local audio track " << track_interner_->getId(audio_track);
+  connection_service_->close(audio_track);
 }
 void Client::attachAudioHandlers() {
   audio_io_->onPlayback.connect(&Client::onPlaybackCallback, this);
   audio_io_->onCapture.connect(&Client::onCaptureCallback, this);
   audio_io_->onDuplex.connect(&Client::onDuplexCallback, this);
   audio_io_->onClose.connect(&Client::onClose, this);
+  audio_io_->onStreamConfigured.connect(&Client::onStreamConfigured, this);
+}
+void Client::onStreamConfigured(unsigned int sample_rate, std::size_t frame_count, std::size_t num_output_channels) {
+  PLOGD << "onStreamConfigured with " << frame_count << " frames at " << sample_rate << " Hz and "
+        << num_output_channels << " output channels";
+  // Only grow, so a second stream with a smaller block size (e.g. separate capture and playback devices) is still served
+  mix_buffers_.update([this, frame_count](MixBuffers &buffers) {
+    if (frame_count > buffers.max_frame_count) {
+      buffers.max_frame_count = std::min(frame_count, JitterBuffer::kMaxBlockSize);
+      buffers.left.assign(buffers.max_frame_count, 0.0f);
+      buffers.right.assign(buffers.max_frame_count, 0.0f);
+      buffers.scratch.assign(render_pool_->getConcurrency() * buffers.max_frame_count, 0.0f);
+      buffers.partials.assign(render_pool_->getConcurrency() * 2 * buffers.max_frame_count, 0.0f);
+    }
+  });
+}
+void Client::addChannel(TrackHandle audio_track) {
+  if (tracks_.read()->find(audio_track)) {
+    return;
+  }
+  tracks_.update([this, audio_track](TrackTable &table) {
+    // Check again, another thread may have been faster
+    if (table.find(audio_track)) {
+      return;
+    }
+    table.tracks.push_back({audio_track,
+                            std::make_shared<JitterBuffer>(receiver_buffer_, sample_rate_),
+                            std::make_shared<TrackActivity>(sample_rate_)});
+    table.index();
+    PLOGI << "Maximum buffer latency is " << (receiver_buffer_ * 1000 / sample_rate_) << " ms";
+  });
 }
 void Client::changeReceiverSize(unsigned int receiver_buffer) {
   PLOGD << "changeReceiverSize to" << receiver_buffer;
   if (receiver_buffer > 0 && receiver_buffer_ != receiver_buffer) {
-    std::unique_lock lock(channels_mutex_);
     receiver_buffer_ = receiver_buffer;
-    // Recreate buffers with
-    for (auto &item: channels_) {
-#ifdef USE_CIRCULAR_QUEUE
-      item.second = std::make_shared<CircularQueue<float>>(receiver_buffer_);
-#else
-      item.second = std::make_shared<RingBuffer<float>>(receiver_buffer_);
-#endif
+    // Recreate buffers with the new size, the old ones are freed once no audio thread uses them anymore
+    tracks_.update([this](TrackTable &table) {
+      for (auto &track: table.tracks) {
+        track.buffer = std::make_shared<JitterBuffer>(receiver_buffer_, sample_rate_);
+      }
+      table.index();
+    });
+  }
+}
+std::map<std::string, JitterBuffer::Statistics> Client::getJitterStatistics() {
+  std::map<std::string, JitterBuffer::Statistics> statistics;
+  auto tracks = tracks_.read();
+  for (const auto &track: tracks->tracks) {
+    statistics[track_interner_->getId(track.handle)] = track.buffer->getStatistics();
+  }
+  return statistics;
+}
+std::map<std::string, Client::ActivityStatistics> Client::getActivityStatistics() {
+  std::map<std::string, ActivityStatistics> statistics;
+  {
+    auto tracks = tracks_.read();
+    for (const auto &track: tracks->tracks) {
+      auto &entry = statistics[track_interner_->getId(track.handle)];
+      entry.capturing = track.activity->capture.isActive();
+      entry.playing = track.activity->playback.isActive();
+      entry.silent_blocks = track.activity->silent_blocks;
+      entry.saved_render_ms = static_cast<double>(track.activity->saved_render_ns) / 1e6;
     }
-    lock.unlock();
   }
-}
\ No newline at end of file
+  for (const auto &item: connection_service_->getSilenceStatistics()) {
+    auto &entry = statistics[item.first];
+    entry.silent_frames_sent = item.second.silent_frames;
+    entry.saved_bytes = item.second.saved_bytes;
+  }
+  return statistics;
+}
+void Client::setWireFormat(AudioSampleFormat wire_format) {
+  connection_service_->setWireFormat(wire_format);
+}
+bool Client::decodePacket(TrackHandle audio_track,
+                          const AudioPacketHeader &header,
+                          const std::byte *payload,
+                          std::size_t size) {
+  std::lock_guard<std::mutex> decoders_lock(decoders_mutex_);
+  if (audio_track >= decoders_.size()) {
+    decoders_.resize(audio_track + 1);
+  }
+  auto &decoder = decoders_[audio_track];
+  if (!decoder || decoder->type != header.codec || decoder->sample_rate != header.sample_rate) {
+    decoder = std::make_unique<TrackDecoder>();
+    decoder->type = header.codec;
+    decoder->sample_rate = header.sample_rate;
+    decoder->decoder = createAudioDecoder(header.codec, header.sample_rate);
+  }
+  if (!decoder->decoder) {
+    PLOGW << "Dropping audio packet of track " << track_interner_->getId(audio_track) << " with unsupported codec "
+          << getAudioCodecName(header.codec);
+    return false;
+  }
+  decoder->buffer.resize(header.frame_count);
+  const auto start = std::chrono::steady_clock::now();
+  if (!decoder->decoder->decode(payload, size, decoder->buffer.data(), header.frame_count)) {
+    PLOGW << "Dropping corrupt audio packet of track " << track_interner_->getId(audio_track);
+    return false;
+  }
+  decoder->meter.add(header.frame_count, size, std::chrono::steady_clock::now() - start);
+  auto tracks = tracks_.read();
+  if (auto *buffer = tracks->find(audio_track)) {
+    buffer->push(header.sequence, header.timestamp, decoder->buffer.data(), header.frame_count);
+  }
+  return true;
+}
+std::vector<AudioCodecStatistics> Client::getCodecStatistics() {
+  auto statistics = connection_service_->getCodecStatistics();
+  std::lock_guard<std::mutex> lock(decoders_mutex_);
+  for (TrackHandle audio_track = 0; audio_track < decoders_.size(); audio_track++) {
+    const auto &decoder = decoders_[audio_track];
+    if (decoder && decoder->decoder) {
+      statistics.push_back(decoder->meter.getStatistics(track_interner_->getId(audio_track), decoder->type, false,
+                                                        decoder->sample_rate));
+    }
+  }
+  return statistics;
+}
@@ -4,54 +4,192 @@
 
 #pragma once
 
-//#define USE_CIRCULAR_QUEUE
-
 #include <DigitalStage/Api/Client.h>
 #include "webrtc/ConnectionService.h"
+#include "audio/ActivityDetector.h"
 #include "audio/AudioIO.h"
 #include "audio/AudioRenderer.h"
-#ifdef USE_CIRCULAR_QUEUE
-#include "utils/CircularQueue.h"
-#else
-#include "utils/RingBuffer.h"
-#endif
+#include "audio/JitterBuffer.h"
+#include "utils/Rcu.h"
+#include "utils/RealtimeWorkerPool.h"
+#include "utils/TrackInterner.h"
 #include <mutex>
-#include <shared_mutex>
 #include <memory>
 #include <atomic>
+#include <vector>
 
 #define RECEIVER_BUFFER 8192
+#define DEFAULT_SAMPLE_RATE 48000
+#define MAX_RENDER_WORKERS 7
+// Share of the block duration each render thread may spend on spatialization
+#define RENDER_BUDGET 0.5
 
 class Client {
  public:
   explicit Client(std::shared_ptr<DigitalStage::Api::Client> api_client);
   ~Client();
 
+  /**
+   * Returns the current jitter buffer statistics of all known audio tracks.
+   * Safe to call from any thread.
+   */
+  std::map<std::string, JitterBuffer::Statistics> getJitterStatistics();
+
+  /**
+   * Sample format used to send the local audio tracks, see ConnectionService::setWireFormat.
+   */
+  void setWireFormat(AudioSampleFormat wire_format);
+
+  /**
+   * Returns encoding cost and bitrate of all local tracks and decoding cost and bitrate of all remote tracks.
+   * Safe to call from any thread.
+   */
+  std::vector<AudioCodecStatistics> getCodecStatistics();
+
+  /**
+   * What idle tracks saved: local tracks send silence packets instead of full blocks,
+   * silent tracks are not spatialized once their spatializers have decayed.
+   */
+  struct ActivityStatistics {
+    bool capturing;  // local track carries signal
+    bool playing;  // received or played back track carries signal
+    std::size_t silent_blocks;  // rendered as silence or skipped
+    double saved_render_ms;  // estimated from the cost of rendering the track
+    std::size_t silent_frames_sent;
+    std::size_t saved_bytes;
+  };
+
+  /**
+   * Returns the activity of all known audio tracks and what skipping them while idle saved.
+   * Safe to call from any thread.
+   */
+  std::map<std::string, ActivityStatistics> getActivityStatistics();
+
  protected:
-  void onCaptureCallback(const std::string &audio_track_id, const float *data, std::size_t frame_count);
+  void onCaptureCallback(TrackHandle audio_track, const float *data, std::size_t frame_count);
   void onPlaybackCallback(float **data, std::size_t num_channels, std::size_t frame_count);
-  void onDuplexCallback(const std::unordered_map<std::string, float *> &,
+  void onDuplexCallback(const InputTracks &audio_tracks,
                         float **data,
                         std::size_t num_channels,
                         std::size_t frame_count);
-  void onClose(const std::string &audio_track_id);
+  void onClose(TrackHandle audio_track);
+  void onStreamConfigured(unsigned int sample_rate, std::size_t frame_count, std::size_t num_output_channels);
 
  private:
   void attachHandlers();
   void attachAudioHandlers();
 
   void changeReceiverSize(unsigned int receiver_buffer);
+  void addChannel(TrackHandle audio_track);
+  struct TrackActivity;
+  /**
+   * Queues the captured block for the network thread, as silence packet while the track is idle.
+   * @return true if the track is active
+   */
+  bool broadcast(TrackActivity *activity, TrackHandle audio_track, const float *data, std::size_t frame_count);
+  void onData(TrackHandle audio_track, const std::vector<std::byte> &data);
+  bool decodePacket(TrackHandle audio_track,
+                    const AudioPacketHeader &header,
+                    const std::byte *payload,
+                    std::size_t size);
+  struct MixBuffers;
+  void prepareMix(const MixBuffers &buffers, float **out, std::size_t num_output_channels, std::size_t frame_count);
+  void beginRender(std::size_t frame_count);
+  /**
+   * Renders all collected tracks on the render threads and sums their partial mixes in a fixed order.
+   */
+  void renderTracks(const MixBuffers &buffers, std::size_t frame_count);
+  void renderReverb(std::size_t frame_count);
+  void writeOutput(float **out, std::size_t num_output_channels, std::size_t frame_count);
 
   std::atomic<unsigned int> receiver_buffer_;
-#ifdef USE_CIRCULAR_QUEUE
-  std::map<std::string, std::shared_ptr<CircularQueue<float>>> channels_;
-#else
-  std::map<std::string, std::shared_ptr<RingBuffer<float>>> channels_;
-#endif
-  std::shared_mutex channels_mutex_;
+  std::atomic<unsigned int> sample_rate_;
+
+  /**
+   * Activity of a track, detected separately where it is captured and where it is rendered,
+   * since both may run on different audio threads.
+   */
+  struct TrackActivity {
+    explicit TrackActivity(unsigned int sample_rate) : capture(sample_rate), playback(sample_rate) {
+    }
+    ActivityDetector capture;
+    ActivityDetector playback;
+    std::atomic<std::size_t> silent_blocks{0};
+    std::atomic<std::size_t> saved_render_ns{0};
+  };
+  /**
+   * Jitter buffers of all tracks, replaced as a whole by the control and network threads (see Rcu.h),
+   * so the audio threads read them with a single atomic load and index them by track handle.
+   */
+  struct TrackTable {
+    struct Track {
+      TrackHandle handle;
+      std::shared_ptr<JitterBuffer> buffer;
+      std::shared_ptr<TrackActivity> activity;  // survives replacing the buffer
+    };
+    std::vector<Track> tracks;
+    std::vector<JitterBuffer *> buffers;  // indexed by handle, nullptr for tracks without buffer
+    std::vector<TrackActivity *> activities;  // indexed by handle
+
+    [[nodiscard]] JitterBuffer *find(TrackHandle handle) const {
+      return handle < buffers.size() ? buffers[handle] : nullptr;
+    }
+    [[nodiscard]] TrackActivity *findActivity(TrackHandle handle) const {
+      return handle < activities.size() ? activities[handle] : nullptr;
+    }
+    void index() {
+      buffers.clear();
+      activities.clear();
+      for (const auto &track: tracks) {
+        if (track.handle >= buffers.size()) {
+          buffers.resize(track.handle + 1, nullptr);
+          activities.resize(track.handle + 1, nullptr);
+        }
+        buffers[track.handle] = track.buffer.get();
+        activities[track.handle] = track.activity.get();
+      }
+    }
+  };
+  Rcu<TrackTable> tracks_;
+
+  // Decoders of remote tracks sent with a codec, only used by the network thread (besides the statistics)
+  struct TrackDecoder {
+    AudioCodecType type;
+    unsigned int sample_rate;
+    std::unique_ptr<AudioDecoder> decoder;
+    std::vector<float> buffer;
+    AudioCodecMeter meter;
+  };
+  std::vector<std::unique_ptr<TrackDecoder>> decoders_;  // indexed by track handle
+  std::mutex decoders_mutex_;
+
+  // Buffers of the audio callbacks, the audio thread writes into the vectors of its snapshot
+  struct MixBuffers {
+    std::size_t max_frame_count = 0;
+    mutable std::vector<float> left;
+    mutable std::vector<float> right;
+    mutable std::vector<float> scratch;  // one block per render thread
+    mutable std::vector<float> partials;  // left and right block per render thread
+  };
+  Rcu<MixBuffers> mix_buffers_;
+  // Tracks to render in the current block, collected by the audio thread
+  struct RenderJob {
+    TrackHandle audio_track;
+    float *input;  // nullptr = pop from buffer
+    JitterBuffer *buffer;
+    TrackActivity *activity;  // nullptr for tracks not known yet
+    bool active;  // of the input, the activity of popped blocks is detected by the render job
+  };
+  std::vector<RenderJob> render_jobs_;
+  std::unique_ptr<RealtimeWorkerPool> render_pool_;
+  // Targets of the current mix, either the first output channels or the mix buffers (audio thread only)
+  float *mix_left_;
+  float *mix_right_;
 
   std::atomic<bool> is_ready_;
   std::shared_ptr<DigitalStage::Api::Client> api_client_;
+  // Shared by all layers, so a track keeps the same handle from capture over rendering to the network
+  std::shared_ptr<TrackInterner> track_interner_;
   std::unique_ptr<AudioIO> audio_io_;
   std::unique_ptr<AudioRenderer<float>> audio_renderer_;
   std::shared_ptr<ConnectionService> connection_service_;
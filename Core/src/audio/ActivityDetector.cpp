@@ -0,0 +1,23 @@
+#include "ActivityDetector.h"
+#include "ChannelKernels.h"
+
+ActivityDetector::ActivityDetector(unsigned int sample_rate)
+    : hold_frames_(static_cast<std::size_t>(kHoldDuration * sample_rate)) {
+}
+
+bool ActivityDetector::process(const float *data, std::size_t frame_count) {
+  const auto level = measureLevel(data, frame_count);
+  if (level.peak > kOpenThreshold) {
+    quiet_frames_ = 0;
+    active_ = true;
+  } else if (level.rms > kCloseThreshold) {
+    // Keeps an active track open, but does not open a silent one
+    quiet_frames_ = 0;
+  } else if (active_) {
+    quiet_frames_ += frame_count;
+    if (quiet_frames_ >= hold_frames_) {
+      active_ = false;
+    }
+  }
+  return active_;
+}
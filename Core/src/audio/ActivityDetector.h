@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Decides block by block whether a track carries signal.
+ *
+ * A block whose peak exceeds the open threshold activates the track at once, so no onset is ever cut. It stays active
+ * until its RMS has been below the close threshold for the hold time, so pauses between notes or words keep it open
+ * and the signal has faded out when it closes.
+ */
+class ActivityDetector {
+ public:
+  explicit ActivityDetector(unsigned int sample_rate);
+
+  /**
+   * Measures the given block, call once per block and always from the same thread.
+   * @return true while the track is active
+   */
+  bool process(const float *data, std::size_t frame_count);
+
+  /**
+   * Safe to call from any thread.
+   */
+  [[nodiscard]] bool isActive() const {
+    return active_;
+  }
+
+  static constexpr float kOpenThreshold = 0.001f;  // peak, -60 dBFS
+  static constexpr float kCloseThreshold = 0.000316f;  // RMS, -70 dBFS
+  static constexpr double kHoldDuration = 0.5;  // s
+
+ private:
+  const std::size_t hold_frames_;
+  std::size_t quiet_frames_ = 0;
+  // Tracks start active, so nothing is held back before the first block has been measured
+  std::atomic<bool> active_{true};
+};
@@ -0,0 +1,89 @@
+#include "AudioCodec.h"
+#include "LosslessCodec.h"
+#ifdef DS_WITH_OPUS
+#include "OpusCodec.h"
+#endif
+#include <algorithm>
+
+const char *getAudioCodecName(AudioCodecType type) {
+  switch (type) {
+    case AudioCodecType::kPcm:return "pcm";
+    case AudioCodecType::kLossless:return "lossless";
+    case AudioCodecType::kOpus:return "opus";
+    default:return "unknown";
+  }
+}
+
+std::optional<AudioCodecType> getAudioCodecType(const std::string &name) {
+  for (auto type: {AudioCodecType::kPcm, AudioCodecType::kLossless, AudioCodecType::kOpus}) {
+    if (name == getAudioCodecName(type)) {
+      return type;
+    }
+  }
+  return std::nullopt;
+}
+
+std::vector<AudioCodecType> getAvailableAudioCodecs() {
+  return {
+#ifdef DS_WITH_OPUS
+      AudioCodecType::kOpus,
+#endif
+      AudioCodecType::kLossless,
+      AudioCodecType::kPcm
+  };
+}
+
+bool isAudioEncoderAvailable(AudioCodecType type, [[maybe_unused]] unsigned int sample_rate) {
+  switch (type) {
+    case AudioCodecType::kPcm:
+    case AudioCodecType::kLossless:return true;
+#ifdef DS_WITH_OPUS
+    case AudioCodecType::kOpus:return sample_rate == 0 || OpusAudioEncoder::isSupportedSampleRate(sample_rate);
+#endif
+    default:return false;
+  }
+}
+
+AudioCodecSettings negotiateAudioCodec(const AudioCodecCapabilities &local, const AudioCodecCapabilities &remote) {
+  AudioCodecSettings settings;
+  for (const auto &type: local.codecs) {
+    // Opus for example knows 48 kHz but neither 44.1 nor 96 kHz, so fall back to the next codec we share
+    if (!isAudioEncoderAvailable(type, local.sample_rate)) {
+      continue;
+    }
+    if (std::find(remote.codecs.begin(), remote.codecs.end(), type) != remote.codecs.end()) {
+      settings.type = type;
+      break;
+    }
+  }
+  if (settings.type == AudioCodecType::kOpus) {
+    settings.bitrate = local.max_bitrate;
+    if (remote.max_bitrate > 0 && (settings.bitrate == 0 || remote.max_bitrate < settings.bitrate)) {
+      settings.bitrate = remote.max_bitrate;
+    }
+    settings.frame_duration_ms = local.frame_duration_ms;
+  }
+  return settings;
+}
+
+std::unique_ptr<AudioEncoder> createAudioEncoder(const AudioCodecSettings &settings, unsigned int sample_rate) {
+  switch (settings.type) {
+    case AudioCodecType::kLossless:return std::make_unique<LosslessEncoder>();
+#ifdef DS_WITH_OPUS
+    case AudioCodecType::kOpus:return OpusAudioEncoder::create(sample_rate, settings.bitrate, settings.frame_duration_ms);
+#endif
+    default:(void) sample_rate;
+      return nullptr;
+  }
+}
+
+std::unique_ptr<AudioDecoder> createAudioDecoder(AudioCodecType type, unsigned int sample_rate) {
+  switch (type) {
+    case AudioCodecType::kLossless:return std::make_unique<LosslessDecoder>();
+#ifdef DS_WITH_OPUS
+    case AudioCodecType::kOpus:return OpusAudioDecoder::create(sample_rate);
+#endif
+    default:(void) sample_rate;
+      return nullptr;
+  }
+}
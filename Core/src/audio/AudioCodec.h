@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * Codecs used to compress audio tracks before sending them to a peer.
+ *
+ * kPcm sends plain samples in the configured wire format (see WireCodec.h) and is always available,
+ * kLossless is an in-tree predictive coder (lossless at 24 bit resolution) and
+ * kOpus is the low delay lossy codec, only available when built with Opus (DS_WITH_OPUS).
+ */
+enum class AudioCodecType : std::uint8_t {
+  kPcm = 0,
+  kLossless = 1,
+  kOpus = 2
+};
+
+const char *getAudioCodecName(AudioCodecType type);
+std::optional<AudioCodecType> getAudioCodecType(const std::string &name);
+
+/**
+ * Settings of a single encoded stream. PCM ignores the bitrate and frame duration, lossless the bitrate.
+ */
+struct AudioCodecSettings {
+  AudioCodecType type = AudioCodecType::kPcm;
+  int bitrate = 0;  // bits per second
+  double frame_duration_ms = 0;
+
+  bool operator==(const AudioCodecSettings &other) const {
+    return type == other.type && bitrate == other.bitrate && frame_duration_ms == other.frame_duration_ms;
+  }
+  bool operator!=(const AudioCodecSettings &other) const {
+    return !(*this == other);
+  }
+};
+
+/**
+ * What a peer is able (and willing) to receive, exchanged when a peer connection opens.
+ */
+struct AudioCodecCapabilities {
+  std::vector<AudioCodecType> codecs;  // in order of preference
+  int max_bitrate = 0;  // 0 = unlimited
+  double frame_duration_ms = 5;  // frame duration of the lossy codecs we send with
+  unsigned int sample_rate = 0;  // sample rate we send with, 0 = unknown
+};
+
+/**
+ * Picks the first codec of our own preference list the remote peer is able to decode and we are able to
+ * encode at our sample rate, limited to the bitrate the remote peer asked for.
+ * Falls back to PCM, which every peer understands.
+ */
+AudioCodecSettings negotiateAudioCodec(const AudioCodecCapabilities &local, const AudioCodecCapabilities &remote);
+
+/**
+ * @return all codecs this build is able to decode, in our order of preference
+ */
+std::vector<AudioCodecType> getAvailableAudioCodecs();
+
+/**
+ * @return true if this build is able to encode the codec at the given sample rate (0 = unknown, accepts any)
+ */
+bool isAudioEncoderAvailable(AudioCodecType type, unsigned int sample_rate);
+
+class AudioEncoder {
+ public:
+  virtual ~AudioEncoder() = default;
+
+  /**
+   * @return number of frames each call of encode must get, or 0 if the encoder takes blocks of any size
+   */
+  [[nodiscard]] virtual std::size_t getFrameSize() const = 0;
+
+  /**
+   * Encodes a mono block.
+   * @return number of bytes written into out, 0 on failure
+   */
+  virtual std::size_t encode(const float *input, std::size_t frame_count, std::byte *out, std::size_t capacity) = 0;
+};
+
+class AudioDecoder {
+ public:
+  virtual ~AudioDecoder() = default;
+
+  /**
+   * Decodes a single packet into exactly frame_count frames.
+   * @return true on success
+   */
+  virtual bool decode(const std::byte *input, std::size_t size, float *out, std::size_t frame_count) = 0;
+};
+
+/**
+ * @return the encoder for the given settings, or nullptr if the codec is not available for this sample rate
+ */
+std::unique_ptr<AudioEncoder> createAudioEncoder(const AudioCodecSettings &settings, unsigned int sample_rate);
+std::unique_ptr<AudioDecoder> createAudioDecoder(AudioCodecType type, unsigned int sample_rate);
+
+struct AudioCodecStatistics {
+  std::string audio_track_id;
+  std::string codec;
+  bool encoding;
+  std::size_t packets;
+  double average_time_us;  // per packet
+  double bitrate_kbps;
+};
+
+/**
+ * Collects cost and size of encoded or decoded packets, safe to read from any thread.
+ */
+class AudioCodecMeter {
+ public:
+  void add(std::size_t frames, std::size_t bytes, std::chrono::steady_clock::duration time) {
+    packets_++;
+    frames_ += frames;
+    bytes_ += bytes;
+    nanoseconds_ += static_cast<std::size_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+  }
+
+  /**
+   * @return average payload size per frame, 0 until something has been measured
+   */
+  [[nodiscard]] double getBytesPerFrame() const {
+    const std::size_t frames = frames_;
+    return frames > 0 ? static_cast<double>(bytes_) / static_cast<double>(frames) : 0.0;
+  }
+
+  [[nodiscard]] AudioCodecStatistics getStatistics(const std::string &audio_track_id,
+                                                   AudioCodecType type,
+                                                   bool encoding,
+                                                   unsigned int sample_rate) const {
+    const std::size_t packets = packets_;
+    const std::size_t frames = frames_;
+    const auto seconds = sample_rate > 0 ? static_cast<double>(frames) / sample_rate : 0.0;
+    return {
+        audio_track_id,
+        getAudioCodecName(type),
+        encoding,
+        packets,
+        packets > 0 ? static_cast<double>(nanoseconds_) / 1000.0 / static_cast<double>(packets) : 0.0,
+        seconds > 0 ? static_cast<double>(bytes_) * 8.0 / 1000.0 / seconds : 0.0
+    };
+  }
+
+ private:
+  std::atomic<std::size_t> packets_{0};
+  std::atomic<std::size_t> frames_{0};
+  std::atomic<std::size_t> bytes_{0};
+  std::atomic<std::size_t> nanoseconds_{0};
+};
@@ -5,12 +5,14 @@
 #include "AudioIO.h"
 #include <plog/Log.h>
 #include <DigitalStage/Api/Events.h>
+#include <functional>
 
-AudioIO::AudioIO(std::shared_ptr<DigitalStage::Api::Client> client)
+AudioIO::AudioIO(std::shared_ptr<DigitalStage::Api::Client> client, std::shared_ptr<TrackInterner> track_interner)
     : client_(std::move(client)),
-      num_devices_(0),
-      watching_device_updates_(false),
+      track_interner_(std::move(track_interner)),
       published_channels_(),
+      output_bus_size_(0),
+      created_(std::chrono::steady_clock::now()),
       token_(std::make_shared<DigitalStage::Api::Client::Token>()) {
   attachHandlers();
 }
@@ -26,17 +28,18 @@ void AudioIO::attachHandlers() {
     auto local_device = store->getLocalDevice();
     if (local_device) {
       // Read all available sound cards (and update with existing ones from store if available)
-      auto sound_cards = enumerateDevices(store);
-      num_devices_ = sound_cards.size();
-
-      // Emit all sound cards using the set request (will overwrite existing ones)
-      // For a reference of all events and payloads, see:
-      // https://github.com/digital-stage/api-types/blob/main/src/ClientDeviceEvents.ts
-      // https://github.com/digital-stage/api-types/blob/main/src/ClientDevicePayloads.ts
-      for (auto &sound_card: sound_cards) {
-        sound_card["online"] = true;
-        client_->send(DigitalStage::Api::SendEvents::SET_SOUND_CARD, sound_card);
+      // and emit them using the set request (will overwrite existing ones).
+      // Cards known from the last run are published at once and refreshed by the device watcher.
+      auto sound_cards = enumerateCachedDevices(store);
+      const bool cached = !sound_cards.empty();
+      if (!cached) {
+        sound_cards = enumerateDevices(store);
       }
+      const auto num_sound_cards = sound_cards.size();
+      publishSoundCards(std::move(sound_cards), true);
+      PLOGI << "Published " << num_sound_cards << (cached ? " cached" : " probed") << " sound cards "
+            << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - created_).count()
+            << "ms after start";
 
       // Now we can set the audio driver, input and output sound cards IF they are set already
       if (local_device->audioDriver && !local_device->audioDriver->empty()) {
@@ -59,7 +62,7 @@ void AudioIO::attachHandlers() {
         }
       }
       // Also start live device update watcher
-      watchDeviceUpdates();
+      watchDeviceUpdates(cached);
     }
   }, token_);
   client_->disconnected.connect([this](bool /*normal_exit*/) {
@@ -201,7 +204,7 @@ void AudioIO::attachHandlers() {
         // This is a local track, so map the channels to this track
         mutex_.lock();
         if (input_channel_mapping_.count(*audio_track.sourceChannel) == 0U) {
-          input_channel_mapping_[*audio_track.sourceChannel] = audio_track._id;
+          input_channel_mapping_[*audio_track.sourceChannel] = track_interner_->intern(audio_track._id);
           PLOGD << "Added local track for channel " << *audio_track.sourceChannel;
         }
         mutex_.unlock();
@@ -219,8 +222,7 @@ void AudioIO::attachHandlers() {
       if (local_device_id && audio_track.deviceId == *local_device_id && audio_track.sourceChannel) {
         mutex_.lock();
         if (input_channel_mapping_.count(*audio_track.sourceChannel) != 0U) {
-          auto audio_track_id = input_channel_mapping_[*audio_track.sourceChannel];
-          onClose(audio_track_id);
+          onClose(input_channel_mapping_[*audio_track.sourceChannel]);
           input_channel_mapping_.erase(*audio_track.sourceChannel);
           PLOGD << "Removed local track for channel " << *audio_track.sourceChannel;
         }
@@ -266,7 +268,8 @@ void AudioIO::unPublishChannel(int channel) {
   PLOGD << "unPublishChannel " << channel;
   if (input_channel_mapping_.count(channel) != 0U) {
     published_channels_[channel] = false;
-    client_->send(DigitalStage::Api::SendEvents::REMOVE_AUDIO_TRACK, input_channel_mapping_[channel]);
+    client_->send(DigitalStage::Api::SendEvents::REMOVE_AUDIO_TRACK,
+                  track_interner_->getId(input_channel_mapping_[channel]));
   } else {
     PLOGD << "unPublishChannel " << channel << " NOT ";
   }
@@ -276,7 +279,7 @@ void AudioIO::unPublishAll() {
   for (const auto &item: input_channel_mapping_) {
     PLOGD << "unPublishAll";
     published_channels_[item.first] = false;
-    client_->send(DigitalStage::Api::SendEvents::REMOVE_AUDIO_TRACK, item.second);
+    client_->send(DigitalStage::Api::SendEvents::REMOVE_AUDIO_TRACK, track_interner_->getId(item.second));
   }
 }
 AudioIO::~AudioIO() {
@@ -287,46 +290,82 @@ AudioIO::~AudioIO() {
   stopWatchingDeviceUpdates();
   PLOGD << "Destructor finished";
 }
-void AudioIO::watchDeviceUpdates() {
-  if (!watching_device_updates_) {
-    watching_device_updates_ = true;
-    device_watcher_ = std::thread([this]() {
-      while (watching_device_updates_) {
-        auto sound_cards = enumerateDevices(client_->getStore().lock());
-        if (num_devices_ != sound_cards.size()) {
-          for (auto &sound_card: sound_cards) {
-            sound_card["online"] = true;
-            client_->send(DigitalStage::Api::SendEvents::SET_SOUND_CARD, sound_card);
-          }
-        }
-        num_devices_ = sound_cards.size();
-        if (watching_device_updates_)
-          std::this_thread::sleep_for(std::chrono::seconds(1));
-        if (watching_device_updates_)
-          std::this_thread::sleep_for(std::chrono::seconds(1));
-        if (watching_device_updates_)
-          std::this_thread::sleep_for(std::chrono::seconds(1));
-        if (watching_device_updates_)
-          std::this_thread::sleep_for(std::chrono::seconds(1));
-        if (watching_device_updates_)
-          std::this_thread::sleep_for(std::chrono::seconds(1));
-        if (watching_device_updates_)
-          std::this_thread::sleep_for(std::chrono::seconds(1));
-        if (watching_device_updates_)
-          std::this_thread::sleep_for(std::chrono::seconds(1));
-        if (watching_device_updates_)
-          std::this_thread::sleep_for(std::chrono::seconds(1));
-        if (watching_device_updates_)
-          std::this_thread::sleep_for(std::chrono::seconds(1));
-        if (watching_device_updates_)
-          std::this_thread::sleep_for(std::chrono::seconds(1));
+void AudioIO::watchDeviceUpdates(bool refresh) {
+  if (!device_watcher_) {
+    device_watcher_ = std::make_unique<DeviceWatcher>([this]() {
+      auto store = client_->getStore().lock();
+      if (store) {
+        publishSoundCards(enumerateDevices(store));
       }
-      PLOGD << "Stopping AudioIO watcher thread";
     });
   }
+  device_watcher_->start(refresh);
 }
 void AudioIO::stopWatchingDeviceUpdates() {
-  watching_device_updates_ = false;
-  if (device_watcher_.joinable())
-    device_watcher_.join();
+  if (device_watcher_) {
+    device_watcher_->stop();
+  }
+}
+void AudioIO::publishSoundCards(std::vector<nlohmann::json> sound_cards, bool full) {
+  // For a reference of all events and payloads, see:
+  // https://github.com/digital-stage/api-types/blob/main/src/ClientDeviceEvents.ts
+  // https://github.com/digital-stage/api-types/blob/main/src/ClientDevicePayloads.ts
+  std::lock_guard<std::mutex> lock(published_sound_cards_mutex_);
+  std::unordered_map<std::string, PublishedSoundCard> current;
+  for (auto &sound_card: sound_cards) {
+    sound_card["online"] = true;
+    auto key = getSoundCardKey(sound_card);
+    if (current.count(key) != 0U) {
+      // Several cards of the same model
+      key += "/" + sound_card.value("uuid", "");
+    }
+    current[key] = {getSoundCardFingerprint(sound_card), std::move(sound_card)};
+  }
+  // Vanished first, a card moving to another uuid keeps its key and is sent as changed below
+  for (auto &item: published_sound_cards_) {
+    if (current.count(item.first) == 0U) {
+      PLOGD << "Sound card " << item.first << " is gone";
+      item.second.sound_card["online"] = false;
+      client_->send(DigitalStage::Api::SendEvents::SET_SOUND_CARD, item.second.sound_card);
+    }
+  }
+  for (const auto &item: current) {
+    auto published = published_sound_cards_.find(item.first);
+    if (full || published == published_sound_cards_.end()
+        || published->second.fingerprint != item.second.fingerprint) {
+      PLOGD << "Sound card " << item.first
+            << (published == published_sound_cards_.end() ? " is new" : full ? " is sent again" : " changed");
+      client_->send(DigitalStage::Api::SendEvents::SET_SOUND_CARD, item.second.sound_card);
+    }
+  }
+  published_sound_cards_ = std::move(current);
+}
+std::string AudioIO::getSoundCardKey(const nlohmann::json &sound_card) {
+  // The store looks sound cards up by driver, type and label as well
+  return sound_card.value("audioEngine", "") + "/" + sound_card.value("audioDriver", "") + "/"
+      + sound_card.value("type", "") + "/" + sound_card.value("label", "");
+}
+std::size_t AudioIO::getSoundCardFingerprint(const nlohmann::json &sound_card) {
+  const auto channels = sound_card.contains("channels") ? sound_card["channels"].size() : 0;
+  const auto sample_rates = sound_card.contains("sampleRates") ? sound_card["sampleRates"].dump() : "";
+  return std::hash<std::string>()(sound_card.value("uuid", "") + "/" + sample_rates + "/" + std::to_string(channels)
+                                      + "/" + (sound_card.value("isDefault", false) ? "default" : ""));
+}
+void AudioIO::configureStream(unsigned int sample_rate, std::size_t frame_count, std::size_t num_output_channels) {
+  output_bus_.assign(frame_count * num_output_channels, 0.0f);
+  output_bus_channels_.resize(num_output_channels);
+  for (std::size_t channel = 0; channel < num_output_channels; channel++) {
+    output_bus_channels_[channel] = &output_bus_[channel * frame_count];
+  }
+  output_bus_size_ = frame_count;
+  onStreamConfigured(sample_rate, frame_count, num_output_channels);
+}
+float **AudioIO::getOutputBus(std::size_t frame_count) {
+  if (frame_count > output_bus_size_) {
+    return nullptr;
+  }
+  return output_bus_channels_.data();
+}
+std::size_t AudioIO::getOutputBusSize() const {
+  return output_bus_size_;
 }
@@ -8,34 +8,56 @@
 #include <unordered_map>
 #include <string>
 #include <mutex>
+#include <vector>
+#include "../utils/DeviceWatcher.h"
+#include "../utils/TrackInterner.h"
 
-using ChannelMap = std::unordered_map<std::size_t, std::string>;
+using ChannelMap = std::unordered_map<std::size_t, TrackHandle>;
+/**
+ * Captured blocks of the local tracks handed to onDuplex, one planar buffer per track.
+ */
+using InputTracks = std::vector<std::pair<TrackHandle, float *>>;
 
 class AudioIO {
  public:
-  explicit AudioIO(std::shared_ptr<DigitalStage::Api::Client> client);
+  AudioIO(std::shared_ptr<DigitalStage::Api::Client> client, std::shared_ptr<TrackInterner> track_interner);
   virtual ~AudioIO();
 
   sigslot::signal<
-      /* audio_track_id */ std::string,
+      /* audio_track */ TrackHandle,
       /* input */ const float *,
       /* frame_count */ std::size_t>
       onCapture;
+  /**
+   * Output contract of onPlayback and onDuplex:
+   * output holds num_output_channels planar buffers of frame_count samples each, which the listener fills in place.
+   * The buffers are owned by the audio engine (either the driver's own buffers or the preallocated output bus),
+   * so listeners must neither replace the pointers nor keep them beyond the callback.
+   */
   sigslot::signal<
       /* output */ float **,
                    std::size_t /* num_output_channels */,
       /* frame_count */ std::size_t>
       onPlayback;
   sigslot::signal<
-      /* audio_tracks */ const std::unordered_map<std::string /* audio_track_id */, float *> &,
+      /* audio_tracks */ const InputTracks &,
       /* output */ float **,
       /* num_output_channels */ std::size_t,
       /* frame_count */ std::size_t>
       onDuplex;
   sigslot::signal<
-      /* audio_track_Id */ std::string
+      /* audio_track */ TrackHandle
   >
       onClose;
+  /**
+   * Emitted outside of the audio thread before a stream is started,
+   * so listeners can preallocate everything their audio callbacks need.
+   */
+  sigslot::signal<
+      /* sample_rate */ unsigned int,
+      /* frame_count */ std::size_t,
+      /* num_output_channels */ std::size_t>
+      onStreamConfigured;
  protected:
   /*
   virtual void onCaptureCallback(const std::string &audio_track_id,
@@ -49,6 +71,14 @@ class AudioIO {
   ) = 0;*/
   // TODO: Check if a shared_ptr can be used here instead of an weak ptr
   virtual std::vector<nlohmann::json> enumerateDevices(std::shared_ptr<DigitalStage::Api::Store> store) = 0;
+  /**
+   * Returns the sound cards found by a previous run without probing any hardware, so they can be published right away
+   * while enumerateDevices refreshes them in the background. Empty if the engine keeps no cache.
+   */
+  virtual std::vector<nlohmann::json> enumerateCachedDevices(
+      const std::shared_ptr<DigitalStage::Api::Store> & /*store*/) {
+    return {};
+  }
   virtual void setAudioDriver(const std::string &audio_driver) = 0;
   virtual void setInputSoundCard(const DigitalStage::Types::SoundCard &sound_card,
                                  bool start) = 0;
@@ -58,6 +88,17 @@ class AudioIO {
   virtual void startReceiving() = 0;
   virtual void stopReceiving() = 0;
   virtual void restart() = 0;
+  /**
+   * Prepares the output bus for the given stream and announces the configuration via onStreamConfigured.
+   * Call this outside of the audio thread, after the stream has been opened and before it is started.
+   */
+  void configureStream(unsigned int sample_rate, std::size_t frame_count, std::size_t num_output_channels);
+  /**
+   * Returns the planar output bus with one buffer per output channel,
+   * or nullptr if it cannot hold frame_count frames. Realtime safe.
+   */
+  float **getOutputBus(std::size_t frame_count);
+  [[nodiscard]] std::size_t getOutputBusSize() const;
   void publishChannel(int channel);
   void unPublishChannel(int channel);
   void unPublishAll();
@@ -69,18 +110,45 @@ class AudioIO {
   std::array<bool, 64> published_channels_;
   /**
    * Mapping of successful published input channels.
-   * Source channel <-> audio_track_id (online)
+   * Source channel <-> audio track (online)
    */
   ChannelMap input_channel_mapping_;
   std::shared_ptr<DigitalStage::Api::Client> client_;
+  std::shared_ptr<TrackInterner> track_interner_;
 
  private:
+  // Reused by every callback of engines that cannot hand out the driver's buffers directly
+  std::vector<float> output_bus_;
+  std::vector<float *> output_bus_channels_;
+  std::size_t output_bus_size_;
+
   void attachHandlers();
-  void watchDeviceUpdates();
+  /**
+   * @param refresh enumerate the devices right away on the watcher thread
+   */
+  void watchDeviceUpdates(bool refresh);
   void stopWatchingDeviceUpdates();
+  /**
+   * Sends the sound cards which are new or changed since they were sent last, and the vanished ones as offline.
+   * @param full send all sound cards, e.g. after (re)connecting to a server that may have lost them
+   */
+  void publishSoundCards(std::vector<nlohmann::json> sound_cards, bool full = false);
+  /**
+   * @return identity of the sound card as the server resolves it
+   */
+  static std::string getSoundCardKey(const nlohmann::json &sound_card);
+  /**
+   * @return hash of what the hardware reports about the sound card, leaving out the settings taken from the store
+   */
+  static std::size_t getSoundCardFingerprint(const nlohmann::json &sound_card);
 
-  std::atomic<bool> watching_device_updates_;
-  std::thread device_watcher_;
-  std::atomic<std::size_t> num_devices_;
+  struct PublishedSoundCard {
+    std::size_t fingerprint;
+    nlohmann::json sound_card;
+  };
+  std::unordered_map<std::string, PublishedSoundCard> published_sound_cards_;
+  std::mutex published_sound_cards_mutex_;
+  std::unique_ptr<DeviceWatcher> device_watcher_;
+  const std::chrono::steady_clock::time_point created_;
   std::shared_ptr<DigitalStage::Api::Client::Token> token_;
 };
\ No newline at end of file
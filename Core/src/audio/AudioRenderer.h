@@ -14,15 +14,29 @@
 #include <cstring>
 #include <memory>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <vector>
+#include <array>
+#include <atomic>
 #include <HRTF/HRTFCereal.h>
 #include <BRIR/BRIRCereal.h>
 #include <BinauralSpatializer/3DTI_BinauralSpatializer.h>
 #include <plog/Log.h>
 #include <DigitalStage/Audio/AudioMixer.h>
+#include "PartitionedConvolver.h"
+#include "../utils/DropOldestQueue.h"
+#include "../utils/Rcu.h"
+#include "../utils/ResourceBundle.h"
+#include "../utils/TrackInterner.h"
 
 #include <cmrc/cmrc.hpp>
 CMRC_DECLARE(clientres);
 
+#ifndef DS_HRTF_SUBJECT
+#define DS_HRTF_SUBJECT "IRC1008"
+#endif
+
 template<class T>
 class AudioRenderer {
  public:
@@ -32,13 +46,17 @@ class AudioRenderer {
     kLarge
   };
 
-  explicit AudioRenderer(std::shared_ptr<DigitalStage::Api::Client> client, bool autostart = false);
+  AudioRenderer(std::shared_ptr<DigitalStage::Api::Client> client,
+                std::shared_ptr<TrackInterner> track_interner,
+                bool autostart = false);
   ~AudioRenderer();
 
   /**
    * Init this audio renderer manually with the given sample rate, buffer size and room size;
    * Sample Rate has to be 41000, 48000 or 96000 and buffer size 128, 256, 512, or 1024.
    * Otherwise an exception will be thrown.
+   * The renderer is built on the calling thread and swapped in as a whole, the previous one keeps rendering meanwhile.
+   * When only the room size changes, the running renderer keeps its HRTF and just swaps the reverb.
    * @param sample_rate 41000, 48000 or 96000
    * @param buffer_size 128, 256, 512, or 1024
    * @param HRTF resampling step, in degrees, default is 5
@@ -46,11 +64,38 @@ class AudioRenderer {
   void start(unsigned int sample_rate,
              unsigned int buffer_size,
              AudioRenderer::RoomSize room_size = AudioRenderer::RoomSize::MEDIUM,
-             int hrtf_resampling_steps = 5);
+             int hrtf_resampling_steps = kDefaultHrtfResamplingSteps);
 
   void stop();
 
-  void render(const std::string &audio_track_id, T *input, T *outLeft, T *outRight, std::size_t frame_size);
+  /**
+   * Duration over which gain, position and orientation changes are interpolated, 0 applies them at once.
+   * Safe to call from any thread.
+   */
+  void setRampDuration(double ramp_ms);
+
+  /**
+   * CPU time all tracks together may spend on spatialization, as share of the block duration summed over all render
+   * threads. When they need more, the least important tracks (quiet, distant) are degraded to cheaper spatialization.
+   * Safe to call from any thread.
+   */
+  void setRenderBudget(double share);
+
+  /**
+   * Applies the position changes queued since the last block and advances the ramps,
+   * call once per block before rendering the tracks.
+   */
+  void beginBlock(std::size_t frame_size);
+
+  /**
+   * Renders the given track into the stereo outputs. An inactive track (see ActivityDetector) is rendered as silence
+   * until its spatializers have decayed and skipped afterwards.
+   * Different tracks may be rendered on different threads at once. Their spatializers share the core, listener and
+   * HRTF of 3D Tune-In, but only read them, the listener is moved by beginBlock (checked by ConcurrentSpatializerTest).
+   * @return estimated CPU time in ns saved by skipping the track, 0 if it has been rendered
+   */
+  float render(TrackHandle audio_track, T *input, T *outLeft, T *outRight, std::size_t frame_size,
+               bool active = true);
 
   void renderReverb(T *outLeft, T *outRight, std::size_t frame_size);
 
@@ -67,26 +112,324 @@ class AudioRenderer {
   static DigitalStage::Types::ThreeDimensionalProperties calculatePosition(const DigitalStage::Types::AudioTrack &audio_track,
                                                                            std::shared_ptr<DigitalStage::Api::Store>& store);
 
+  /**
+   * Position and orientation in stage coordinates, interpolated component-wise.
+   */
+  struct Pose {
+    float x = 0;
+    float y = 0;
+    float z = 0;
+    float rX = 0;
+    float rY = 0;
+    float rZ = 0;
+
+    bool operator==(const Pose &other) const {
+      return x == other.x && y == other.y && z == other.z && rX == other.rX && rY == other.rY && rZ == other.rZ;
+    }
+  };
+  /**
+   * Pose ramping towards the latest target, only the last target set within a block is ever applied.
+   */
+  struct Ramp {
+    Pose current;
+    Pose target;
+    std::size_t remaining = 0;  // frames until current reaches target
+  };
+  /**
+   * Spatialization of a track, in order of decreasing cost.
+   */
+  enum Quality {
+    kHighQuality,  // HRTF convolution
+    kHighPerformance,  // ILD filters and ITD of 3D Tune-In
+    kPanning,  // constant power panning with distance attenuation
+    kQualityCount
+  };
+  // The horizontal first order reverb of 3D Tune-In spans three directions
+  static constexpr std::size_t kReverbProbes = 3;
+  static constexpr double kMaxReverbDuration = 10.0;  // s
+  static constexpr float kReverbSilence = 1e-6f;  // relative to the peak, ends the measured impulse response
+  /**
+   * A track rendered by two spatializers, so a large jump of its direction or a change of its quality is rendered
+   * both ways and crossfaded instead of switching within one block. Only the active one takes part in the 3D Tune-In
+   * reverb.
+   */
+  struct Source {
+    std::array<std::shared_ptr<Binaural::CSingleSourceDSP>, 2> dsps;
+    std::size_t active = 0;
+    bool crossfade = false;  // render the next block with both and switch to the other one
+    Ramp ramp;
+    // Allocated with the source and reused for every block
+    CMonoBuffer<float> input;
+    Common::CEarPair<CMonoBuffer<float>> output;
+    Common::CEarPair<CMonoBuffer<float>> crossfade_output;
+    std::array<float, kReverbProbes> direction{};  // as heard by the listener, also the reverb encoding
+    float distance = 1;
+    bool has_reverb_input = false;  // input holds this block, set by the render job and consumed by the reverb
+    // Spatialization of the active and, while crossfading, of the other spatializer
+    Quality quality = kHighQuality;
+    Quality next_quality = kHighQuality;
+    Quality target_quality = kHighQuality;  // chosen by the scheduler
+    // Measured by the render job, consumed by the scheduler at the start of the next block
+    float render_time = -1;  // ns, negative if not rendered or crossfaded
+    float block_level = 0;  // RMS
+    float level = 0;  // smoothed RMS
+    // Frames rendered as silence since the track turned inactive, it is skipped once they cover the tail
+    std::size_t silent_frames = 0;
+    bool idle = false;  // skipped, so it takes no part in scheduling
+  };
+  using Sources = std::vector<std::shared_ptr<Source>>;  // indexed by track handle
+  /**
+   * Sources as published by the control threads, along with the scratch the scheduler sorts them in.
+   * Whoever adds a source reserves the scratch for it, so the audio thread never allocates for a new track.
+   */
+  struct SourceTable {
+    Sources sources;
+    mutable std::vector<std::pair<float, TrackHandle>> schedule_order;  // by importance
+
+    SourceTable() = default;
+    // The scratch is in use by the audio thread, so a copy starts without it
+    SourceTable(const SourceTable &other) : sources(other.sources) {}
+  };
+  /**
+   * Everything the audio thread renders with, built off the audio thread and published as a whole.
+   * Once published, only the audio thread touches the 3D Tune-In objects and the mutable state. Sources are the
+   * exception: the control threads create them, publish them in the source table and take them out again, the audio
+   * thread merely reads the table.
+   */
+  struct Engine {
+    unsigned int sample_rate = 0;
+    std::size_t frame_size = 0;
+    int hrtf_resampling_steps = 0;
+    std::size_t silence_tail = 0;  // frames until a spatializer fed with silence holds nothing but silence
+    std::shared_ptr<Binaural::CCore> core;
+    std::shared_ptr<Binaural::CListener> listener;
+    std::shared_ptr<Binaural::CEnvironment> environment;  // only if the reverb could not be measured
+    mutable Ramp listener_ramp;
+    mutable Rcu<SourceTable> sources;
+    // Handshake between the control threads creating or removing a source on the core and the reverb of 3D Tune-In
+    // iterating them, see beginSourceChange
+    mutable std::atomic<bool> changing_sources{false};
+    mutable std::atomic<bool> rendering_reverb{false};
+    mutable Common::CEarPair<CMonoBuffer<float>> reverb;
+  };
+  /**
+   * Impulse responses of a room for a source in front, to the side and behind the listener.
+   * They end where they fall below kReverbSilence, so their convolution is close to, but not exactly, the reverb of
+   * 3D Tune-In (ReverbTest checks the difference).
+   */
+  struct MeasuredReverb {
+    std::array<Common::CEarPair<std::vector<float>>, kReverbProbes> responses;
+    std::array<std::array<float, kReverbProbes>, kReverbProbes> decoder{};  // direction to probe weights
+  };
+  /**
+   * Convolution of the measured reverb, published independently of the engine, so the room changes on the fly.
+   */
+  struct Reverb {
+    std::size_t frame_size = 0;
+    std::unique_ptr<PartitionedConvolver> convolver;  // used by the audio thread only
+    std::array<std::array<float, kReverbProbes>, kReverbProbes> decoder{};
+    mutable std::array<std::vector<float>, kReverbProbes> buses;
+  };
+  /**
+   * Change of the scene, queued by the control threads and applied by the audio thread at block start.
+   */
+  struct Command {
+    enum Type {
+      kSetListener,
+      kSetSource  // moves an existing source, they are created and removed through the source table
+    };
+    Type type = kSetListener;
+    TrackHandle audio_track = kInvalidTrackHandle;
+    Pose pose;
+  };
+  static constexpr std::size_t kCommandQueueDepth = 256;
+  static constexpr double kDefaultRampDuration = 20.0;  // ms
+  static constexpr int kDefaultHrtfResamplingSteps = 5;  // degrees
+  // Change of the direction of a source as heard by the listener within one block, above which it is crossfaded
+  static constexpr float kCrossfadeAngle = 0.17f;  // rad, about 10 degrees
+  static constexpr float kTwoPi = 6.2831853f;
+  static constexpr double kDefaultRenderBudget = 0.5;
+  static constexpr double kScheduleInterval = 200.0;  // ms
+  static constexpr float kMeasurementSmoothing = 0.05f;
+  struct StartRequest {
+    unsigned int sample_rate;
+    unsigned int buffer_size;
+    RoomSize room_size;
+
+    bool operator==(const StartRequest &other) const {
+      return sample_rate == other.sample_rate && buffer_size == other.buffer_size && room_size == other.room_size;
+    }
+  };
+
+  /**
+   * Starts the renderer on the builder thread, so loading HRTF and BRIR never blocks the caller.
+   */
+  void requestStart(const StartRequest &request);
+  /**
+   * Same as start(), but discards the renderer if stop() was called since the given start generation.
+   * @return false if the renderer was discarded or the store is gone
+   */
+  bool startEngine(unsigned int sample_rate,
+                   unsigned int buffer_size,
+                   RoomSize room_size,
+                   int hrtf_resampling_steps,
+                   std::size_t generation);
+  /**
+   * Called with mutex_ held, so stop() cannot run between the check and the publish.
+   */
+  bool isStopped(std::size_t generation);
+  /**
+   * Reads the listener and all tracks from the store into the scene, called with mutex_ held.
+   * @return false if the store is gone
+   */
+  bool readScene();
+  void build();
+
+  static Pose toPose(const DigitalStage::Types::ThreeDimensionalProperties &position);
+  static Common::CTransform toTransform(const Pose &pose);
+  static std::shared_ptr<Binaural::CSingleSourceDSP> createSource(Binaural::CCore &core, bool reverb);
+  static void allocate(Common::CEarPair<CMonoBuffer<float>> &buffer, std::size_t frame_size);
+  std::unique_ptr<Engine> createEngine(unsigned int sample_rate, unsigned int buffer_size, int hrtf_resampling_steps);
+  std::shared_ptr<Binaural::CEnvironment> createEnvironment(Binaural::CCore &core,
+                                                            unsigned int sample_rate,
+                                                            RoomSize room_size);
+  /**
+   * Removes all sources and resets the listener, so a stopped engine can be started again without reloading the HRTF.
+   */
+  static void clearScene(Engine &engine);
+  /**
+   * @return reverb of the given room, measured once per process and sample rate and cached afterwards
+   */
+  std::shared_ptr<const MeasuredReverb> getMeasuredReverb(unsigned int sample_rate,
+                                                          unsigned int buffer_size,
+                                                          RoomSize room_size);
+  /**
+   * Measures the impulse responses of the environment on a core of its own,
+   * any other direction than the probed ones is a mix of them.
+   */
+  std::unique_ptr<MeasuredReverb> measureReverb(unsigned int sample_rate,
+                                                unsigned int buffer_size,
+                                                RoomSize room_size);
+  static std::unique_ptr<Reverb> createReverb(const MeasuredReverb &measured, std::size_t frame_size);
+  /**
+   * @return first order horizontal encoding of the direction of the source as heard by the listener
+   */
+  static std::array<float, kReverbProbes> getReverbDirection(const Common::CTransform &listener,
+                                                             const Common::CTransform &source);
+  static void updateDirection(const Pose &listener, Source &source);
+  /**
+   * Creates the spatializers and buffers of a track on the calling control thread and publishes it in the source
+   * table, replacing any previous source of the track. Called with mutex_ held.
+   */
+  static void addSource(const Engine &engine, TrackHandle audio_track, const Pose &pose, const Pose &listener);
+  /**
+   * Takes the source of a track out of the table and frees it, as soon as the audio thread no longer sees it.
+   * Called with mutex_ held.
+   */
+  static void removeSource(const Engine &engine, TrackHandle audio_track);
+  static void releaseSource(const Engine &engine, const Source &source);
+  /**
+   * Keeps the reverb of 3D Tune-In, which iterates all sources of the core, from running while a source is created
+   * or removed. The audio thread skips that reverb block rather than waiting, so this only costs anything with the
+   * 3D Tune-In reverb, which is the fallback if the room could not be measured.
+   */
+  static void beginSourceChange(const Engine &engine);
+  static void endSourceChange(const Engine &engine);
+  static Binaural::TSpatializationMode toSpatializationMode(Quality quality);
+  /**
+   * Lets the other spatializer render the next block with the given quality, starting from silence.
+   */
+  static void startCrossfade(Source &source, Quality quality);
+  /**
+   * Folds the measurements of the last block into the costs and levels and, every schedule interval,
+   * assigns each track the best quality the budget allows, most important tracks first.
+   */
+  void schedule(const Engine &engine, const SourceTable &table, std::size_t frame_size);
+  /**
+   * Applies a command to the targets of the engine, snapping them when there is no ramp.
+   */
+  static void apply(const Engine &engine, const Sources &sources, const Command &command, std::size_t ramp_frames);
+  /**
+   * Moves the ramp towards its target by one block.
+   * @return true if the pose changed
+   */
+  static bool advance(Ramp &ramp, std::size_t frame_size);
+  static float getDirectionChange(const Pose &listener_from, const Pose &listener_to, const Pose &from, const Pose &to);
+  void push(const Command &command);
+
   void setListenerPosition(const DigitalStage::Types::ThreeDimensionalProperties &position);
-  void setAudioTrackPosition(const std::string &audio_track_id,
+  void addAudioTrack(TrackHandle audio_track, const DigitalStage::Types::ThreeDimensionalProperties &position);
+  void setAudioTrackPosition(TrackHandle audio_track,
                              const DigitalStage::Types::ThreeDimensionalProperties &position);
+  void removeAudioTrack(TrackHandle audio_track);
+
+  /**
+   * Polls the mixer for the gain of all known tracks and publishes them when they changed,
+   * so the audio thread reads them by handle instead of resolving the mixer state per block.
+   */
+  void refreshGains();
+  /**
+   * Allocates the state of all tracks up to the given count which have none yet, on the calling control thread.
+   */
+  void addTrackStates(std::size_t track_count);
 
-  void renderFallback(T *in, T *outLeft, T *outRight, std::size_t frame_size, std::optional<std::pair<T, bool>> volume_info);
+  /**
+   * Ramps the gain of the given track towards its target by one block.
+   * @return gain at the start and at the end of the block
+   */
+  std::pair<T, T> advanceGain(TrackHandle audio_track, T target, std::size_t frame_size);
+  /**
+   * State of a track which only the audio thread (or the render worker of the track) touches.
+   */
+  struct TrackState {
+    T applied_gain = 0;  // new tracks fade in
+  };
+  using TrackStates = std::vector<std::shared_ptr<TrackState>>;  // indexed by track handle
+  /**
+   * @param input nullptr renders silence
+   */
+  void renderSource(Source &source, T *input, T *outLeft, T *outRight, std::size_t frame_size,
+                    std::pair<T, T> gain);
+  void renderFallback(T *in, T *outLeft, T *outRight, std::size_t frame_size, std::pair<T, T> gain);
+  static void spatialize(Source &source, std::size_t dsp, Quality quality,
+                         Common::CEarPair<CMonoBuffer<float>> &output, std::size_t frame_size);
 
-  std::atomic<std::size_t> current_frame_size_;
   std::shared_ptr<DigitalStage::Api::Client> client_;
+  std::shared_ptr<TrackInterner> track_interner_;
   std::atomic<bool> initialized_;
-  cmrc::embedded_filesystem fs_;
-  std::shared_ptr<Binaural::CCore> core_;
-  std::shared_ptr<Binaural::CListener> listener_;
-  std::shared_ptr<Binaural::CEnvironment> environment_;
-  std::unordered_map<std::string, std::shared_ptr<Binaural::CSingleSourceDSP>> audio_tracks_;
+  ResourceBundle resources_;
+
+  Rcu<Engine> engine_;
+  Rcu<Reverb> reverb_;
+  DropOldestQueue<Command> commands_;
+  // Scene as the control threads want it, a new engine starts from here. Never taken by the audio thread.
+  std::optional<Pose> listener_pose_;
+  std::vector<std::optional<Pose>> source_poses_;  // indexed by track handle
+  std::unique_ptr<Engine> idle_engine_;  // last stopped engine, kept for its HRTF
   std::mutex mutex_;
 
+  std::optional<StartRequest> pending_start_;
+  std::optional<StartRequest> last_start_;
+  std::size_t start_generation_ = 0;  // bumped by stop()
+  std::mutex start_mutex_;
+  std::condition_variable start_signal_;
+  std::atomic<bool> is_building_;
+  std::thread builder_thread_;
+
   std::unique_ptr<DigitalStage::Audio::AudioMixer<float>> audio_mixer_;
+  using Gains = std::vector<std::optional<DigitalStage::Audio::VolumeInfo<T>>>;  // indexed by track handle
+  Rcu<Gains> gains_;
+  std::atomic<bool> is_refreshing_gains_;
+  std::thread gain_thread_;
+  Rcu<TrackStates> track_states_;
+  sigslot::scoped_connection interned_connection_;
+  std::atomic<double> ramp_duration_;
+  std::atomic<double> render_budget_;
+  // Owned by the audio thread
+  std::size_t ramp_frames_ = 0;
+  std::array<float, kQualityCount> quality_costs_{};  // smoothed ns per track and block, 0 until measured
+  std::size_t frames_since_schedule_ = 0;
   std::shared_ptr<DigitalStage::Api::Client::Token> token_;
-
-  std::atomic<bool> falling_back_ = false;
 };
 
 #include "AudioRenderer.tpp"
\ No newline at end of file
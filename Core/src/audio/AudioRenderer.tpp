@@ -3,28 +3,58 @@
 //
 
 #include "../utils/CMRCFileBuffer.h"
+#include "../utils/RealtimeAllocationTracker.h"
 #include <DigitalStage/Audio/AudioMixer.h>
+#include <algorithm>
 #include <cmath>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <tuple>
 
 template<class T>
-AudioRenderer<T>::AudioRenderer(std::shared_ptr<DigitalStage::Api::Client> client, bool autostart)
-    : fs_(cmrc::clientres::get_filesystem()),
+AudioRenderer<T>::AudioRenderer(std::shared_ptr<DigitalStage::Api::Client> client,
+                                std::shared_ptr<TrackInterner> track_interner,
+                                bool autostart)
+    : resources_(cmrc::clientres::get_filesystem()),
       client_(std::move(client)),
+      track_interner_(std::move(track_interner)),
+      commands_(kCommandQueueDepth),
+      is_building_(true),
       audio_mixer_(std::make_unique<DigitalStage::Audio::AudioMixer<float>>(client_)),
+      is_refreshing_gains_(true),
+      ramp_duration_(kDefaultRampDuration),
+      render_budget_(kDefaultRenderBudget),
       initialized_(false),
-      current_frame_size_(0),
       token_(std::make_shared<DigitalStage::Api::Client::Token>()) {
   PLOGD << "AudioRenderer";
   ERRORHANDLER3DTI.SetVerbosityMode(VERBOSITY_MODE_ONLYERRORS);
   ERRORHANDLER3DTI.SetErrorLogStream(&std::cerr, true);
   ERRORHANDLER3DTI.SetAssertMode(ASSERT_MODE_CONTINUE);
 
+  // Tracks interned before this renderer existed get their state right away, all others when they are interned
+  interned_connection_ = track_interner_->interned.connect([this](TrackHandle audio_track) {
+    addTrackStates(audio_track + 1);
+  });
+  addTrackStates(track_interner_->size());
   attachHandlers(autostart);
+  builder_thread_ = std::thread(&AudioRenderer<T>::build, this);
+  gain_thread_ = std::thread(&AudioRenderer<T>::refreshGains, this);
 }
 
 template<class T>
 AudioRenderer<T>::~AudioRenderer() {
   initialized_ = false;
+  {
+    std::lock_guard<std::mutex> lock(start_mutex_);
+    is_building_ = false;
+  }
+  start_signal_.notify_one();
+  if (builder_thread_.joinable())
+    builder_thread_.join();
+  is_refreshing_gains_ = false;
+  if (gain_thread_.joinable())
+    gain_thread_.join();
   PLOGD << "Destructed";
 }
 
@@ -41,8 +71,8 @@ template<class T>
 bool AudioRenderer<T>::isValid(unsigned int sample_rate, unsigned int buffer_size) {
   std::string brir_path("3DTI_BRIR_small_" + std::to_string(sample_rate) + "Hz.3dti-brir");
   std::string hrtf_path
-      ("3DTI_HRTF_IRC1008_" + std::to_string(buffer_size) + "s_" + std::to_string(sample_rate) + "Hz.3dti-hrtf");
-  return fs_.is_file(brir_path) && fs_.is_file(hrtf_path);
+      ("3DTI_HRTF_" DS_HRTF_SUBJECT "_" + std::to_string(buffer_size) + "s_" + std::to_string(sample_rate) + "Hz.3dti-hrtf");
+  return resources_.contains(brir_path) && resources_.contains(hrtf_path);
 }
 
 template<class T>
@@ -50,6 +80,20 @@ void AudioRenderer<T>::start(unsigned int sample_rate,
                              unsigned int buffer_size,
                              AudioRenderer::RoomSize room_size,
                              int hrtf_resampling_steps) {
+  std::size_t generation;
+  {
+    std::lock_guard<std::mutex> lock(start_mutex_);
+    generation = start_generation_;
+  }
+  startEngine(sample_rate, buffer_size, room_size, hrtf_resampling_steps, generation);
+}
+
+template<class T>
+bool AudioRenderer<T>::startEngine(unsigned int sample_rate,
+                                   unsigned int buffer_size,
+                                   AudioRenderer::RoomSize room_size,
+                                   int hrtf_resampling_steps,
+                                   std::size_t generation) {
   PLOGD << "start(sample_rate=" << sample_rate << ", buffer_size=" << buffer_size << ",...)";
   // Load HRTF and BRIR from compiled resources
   if (!isValid(sample_rate, buffer_size)) {
@@ -57,58 +101,95 @@ void AudioRenderer<T>::start(unsigned int sample_rate,
         "Invalid sample rate and/or buffer size. Hint: use sample rates of 41000, 48000 or 96000 and buffer sizes of 128, 256, 512 or 1024");
   }
 
-  std::lock_guard<std::mutex> guard{mutex_};
-  initialized_ = false;
-  std::string brir_path("3DTI_BRIR_" + to_string(room_size) + "_" + std::to_string(sample_rate) + "Hz.3dti-brir");
-  if (!fs_.is_file(brir_path)) {
-    throw std::runtime_error(
-        "BRIR for room size " + to_string(room_size) + " not available. Check your build settings. Was looking for "
-            + brir_path);
+  std::shared_ptr<const MeasuredReverb> measured_reverb;
+  try {
+    measured_reverb = getMeasuredReverb(sample_rate, buffer_size, room_size);
+  } catch (std::exception &e) {
+    PLOGW << "Could not measure the reverb, rendering it with 3D Tune-In: " << e.what();
   }
-  auto brir_file = fs_.open(brir_path);
-  CMRCFileBuffer brir_file_buffer(brir_file);
-  std::istream brir_stream(&brir_file_buffer);
-  std::string hrtf_path
-      ("3DTI_HRTF_IRC1008_" + std::to_string(buffer_size) + "s_" + std::to_string(sample_rate) + "Hz.3dti-hrtf");
-  auto hrtf_file = fs_.open(hrtf_path);
-  CMRCFileBuffer hrtf_file_buffer(hrtf_file);
-  std::istream hrtf_stream(&hrtf_file_buffer);
-  audio_tracks_.clear();
-  // Init core
-  core_ = std::make_shared<Binaural::CCore>(Common::TAudioStateStruct{static_cast<int>(sample_rate),
-                                                                      static_cast<int>(buffer_size)},
-                                            hrtf_resampling_steps);
-  current_frame_size_ = buffer_size;
-  // Init environment (used for reverb)
-  environment_ = core_->CreateEnvironment();
-  environment_->SetReverberationOrder(TReverberationOrder::BIDIMENSIONAL);
-  if (!BRIR::CreateFrom3dtiStream(brir_stream, environment_)) {
-    throw std::runtime_error("Could not create BRIR");
+  const auto matches = [=](const Engine &engine) {
+    return engine.core && !engine.environment && engine.sample_rate == sample_rate && engine.frame_size == buffer_size
+        && engine.hrtf_resampling_steps == hrtf_resampling_steps;
+  };
+  std::unique_ptr<Engine> engine;
+  if (measured_reverb) {
+    bool is_running;
+    {
+      auto current = engine_.read();
+      is_running = matches(*current);
+    }
+    if (is_running) {
+      // Only the room changed, so keep the listener and its HRTF
+      auto reverb = createReverb(*measured_reverb, buffer_size);
+      std::lock_guard<std::mutex> guard{mutex_};
+      if (isStopped(generation)) {
+        return false;
+      }
+      reverb_.publish(std::move(reverb));
+      PLOGI << "Changed room of audio renderer";
+      return true;
+    }
+    std::lock_guard<std::mutex> guard{mutex_};
+    if (idle_engine_ && matches(*idle_engine_)) {
+      PLOGI << "Reusing loaded HRTF";
+      engine = std::move(idle_engine_);
+    }
+    idle_engine_.reset();
   }
-  if (!environment_->GetBRIR()->IsBRIRready()) {
-    throw std::runtime_error("Created BRIR but it is not ready");
+  if (!engine) {
+    engine = createEngine(sample_rate, buffer_size, hrtf_resampling_steps);
+    if (!measured_reverb) {
+      engine->environment = createEnvironment(*engine->core, sample_rate, room_size);
+    }
   }
-  PLOGI << "Loaded BRIR " << brir_path;
 
-  listener_ = core_->CreateListener();
-  listener_->DisableCustomizedITD();
-
-  if (!HRTF::CreateFrom3dtiStream(hrtf_stream, listener_)) {
-    throw std::runtime_error("Could not create HRTF");
+  // Publish while holding the lock, so no change queued meanwhile gets lost on the new engine
+  std::lock_guard<std::mutex> guard{mutex_};
+  if (isStopped(generation)) {
+    if (engine->core && !engine->environment) {
+      // Still worth keeping for its HRTF, like a stopped engine
+      idle_engine_ = std::move(engine);
+    }
+    return false;
   }
-  auto *hrtf = listener_->GetHRTF();
-  if (!hrtf) {
-    throw std::runtime_error("HRTF has not been created");
+  if (!initialized_ || !listener_pose_) {
+    // Not running, so the handlers did not keep the scene up to date
+    if (!readScene()) {
+      return false;
+    }
   }
-  if (!hrtf->IsHRTFLoaded()) {
-    throw std::runtime_error("Created HRTF but it is not loaded");
+  // A new engine starts right at the scene, without ramping from the origin
+  engine->listener_ramp.current = engine->listener_ramp.target = *listener_pose_;
+  engine->listener->SetListenerTransform(toTransform(*listener_pose_));
+  for (TrackHandle audio_track = 0; audio_track < source_poses_.size(); audio_track++) {
+    if (source_poses_[audio_track]) {
+      addSource(*engine, audio_track, *source_poses_[audio_track], *listener_pose_);
+    }
   }
-  PLOGI << "Loaded HRTF " << hrtf_path;
+  // Blocks until the audio thread is done with the previous engine, which is then freed here
+  engine_.publish(std::move(engine));
+  reverb_.publish(measured_reverb ? createReverb(*measured_reverb, buffer_size) : std::make_unique<Reverb>());
+  initialized_ = true;
+  PLOGI << "Started audio renderer";
+  return true;
+}
+
+template<class T>
+bool AudioRenderer<T>::isStopped(std::size_t generation) {
+  std::lock_guard<std::mutex> lock(start_mutex_);
+  if (start_generation_ == generation) {
+    return false;
+  }
+  PLOGI << "Audio renderer was stopped while it was built, discarding it";
+  return true;
+}
 
+template<class T>
+bool AudioRenderer<T>::readScene() {
   // Listener
   auto store_ptr = client_->getStore();
   if (store_ptr.expired()) {
-    return;
+    return false;
   }
   auto store = store_ptr.lock();
 
@@ -117,37 +198,165 @@ void AudioRenderer<T>::start(unsigned int sample_rate,
     throw std::runtime_error("Local stage member not available");
   }
   auto stage_member = store->stageMembers.get(*stage_member_id);
-  setListenerPosition(calculatePosition(*stage_member, store));
 
+  listener_pose_ = toPose(calculatePosition(*stage_member, store));
+  source_poses_.clear();
   // Other remote audio tracks
   for (const auto &audio_track: store->audioTracks.getAll()) {
 #ifdef USE_ONLY_NATIVE_DEVICES
     if (audio_track.type == "native") {
       PLOGI << "Found an existing native audio_track";
 #endif
-    audio_tracks_[audio_track._id] = core_->CreateSingleSourceDSP();
-    audio_tracks_[audio_track._id]->SetSpatializationMode(Binaural::TSpatializationMode::HighQuality);
-    audio_tracks_[audio_track._id]->DisableNearFieldEffect();
-    audio_tracks_[audio_track._id]->EnableAnechoicProcess();
-    audio_tracks_[audio_track._id]->EnableDistanceAttenuationAnechoic();
-    setAudioTrackPosition(audio_track._id, calculatePosition(audio_track, store));
+    const auto handle = track_interner_->intern(audio_track._id);
+    if (handle >= source_poses_.size()) {
+      source_poses_.resize(handle + 1);
+    }
+    source_poses_[handle] = toPose(calculatePosition(audio_track, store));
 #ifdef USE_ONLY_NATIVE_DEVICES
     } else {
       PLOGW << "Ignoring existing but non-native audio track";
     }
 #endif
   }
-  initialized_ = true;
-  PLOGI << "Started audio renderer";
+  return true;
 }
 
 template<class T>
 void AudioRenderer<T>::stop() {
+  {
+    std::lock_guard<std::mutex> lock(start_mutex_);
+    pending_start_.reset();
+    // A start still being built must not publish after this
+    start_generation_++;
+  }
   const std::lock_guard<std::mutex> lock(mutex_);
   initialized_ = false;
+  auto previous = engine_.exchange(std::make_unique<Engine>());
+  if (previous->core && !previous->environment) {
+    // No longer rendered, so keep it for the next start with the same sound card
+    clearScene(*previous);
+    idle_engine_ = std::move(previous);
+  }
   PLOGI << "Stopped audio renderer";
 }
 
+template<class T>
+std::unique_ptr<typename AudioRenderer<T>::Engine> AudioRenderer<T>::createEngine(unsigned int sample_rate,
+                                                                                 unsigned int buffer_size,
+                                                                                 int hrtf_resampling_steps) {
+  auto engine = std::make_unique<Engine>();
+  std::string hrtf_path
+      ("3DTI_HRTF_" DS_HRTF_SUBJECT "_" + std::to_string(buffer_size) + "s_" + std::to_string(sample_rate) + "Hz.3dti-hrtf");
+  const auto hrtf_file = resources_.open(hrtf_path);
+  CMRCFileBuffer hrtf_file_buffer(hrtf_file.begin(), hrtf_file.end());
+  std::istream hrtf_stream(&hrtf_file_buffer);
+  // Init core
+  engine->core = std::make_shared<Binaural::CCore>(Common::TAudioStateStruct{static_cast<int>(sample_rate),
+                                                                             static_cast<int>(buffer_size)},
+                                                   hrtf_resampling_steps);
+  engine->sample_rate = sample_rate;
+  engine->frame_size = buffer_size;
+  engine->hrtf_resampling_steps = hrtf_resampling_steps;
+  allocate(engine->reverb, buffer_size);
+
+  engine->listener = engine->core->CreateListener();
+  engine->listener->DisableCustomizedITD();
+
+  if (!HRTF::CreateFrom3dtiStream(hrtf_stream, engine->listener)) {
+    throw std::runtime_error("Could not create HRTF");
+  }
+  auto *hrtf = engine->listener->GetHRTF();
+  if (!hrtf) {
+    throw std::runtime_error("HRTF has not been created");
+  }
+  if (!hrtf->IsHRTFLoaded()) {
+    throw std::runtime_error("Created HRTF but it is not loaded");
+  }
+  // The HRIRs are convolved in partitions of one block, the ITD and near field filters add less than another one
+  const auto hrir_length = static_cast<std::size_t>(std::max(hrtf->GetHRIRLength(), 0));
+  engine->silence_tail = (hrir_length + buffer_size - 1) / buffer_size * buffer_size + buffer_size;
+  PLOGI << "Loaded HRTF " << hrtf_path;
+  return engine;
+}
+
+template<class T>
+std::shared_ptr<Binaural::CEnvironment> AudioRenderer<T>::createEnvironment(Binaural::CCore &core,
+                                                                            unsigned int sample_rate,
+                                                                            RoomSize room_size) {
+  std::string brir_path("3DTI_BRIR_" + to_string(room_size) + "_" + std::to_string(sample_rate) + "Hz.3dti-brir");
+  if (!resources_.contains(brir_path)) {
+    throw std::runtime_error(
+        "BRIR for room size " + to_string(room_size) + " not available. Check your build settings. Was looking for "
+            + brir_path);
+  }
+  const auto brir_file = resources_.open(brir_path);
+  CMRCFileBuffer brir_file_buffer(brir_file.begin(), brir_file.end());
+  std::istream brir_stream(&brir_file_buffer);
+  // Init environment (used for reverb)
+  auto environment = core.CreateEnvironment();
+  environment->SetReverberationOrder(TReverberationOrder::BIDIMENSIONAL);
+  if (!BRIR::CreateFrom3dtiStream(brir_stream, environment)) {
+    throw std::runtime_error("Could not create BRIR");
+  }
+  if (!environment->GetBRIR()->IsBRIRready()) {
+    throw std::runtime_error("Created BRIR but it is not ready");
+  }
+  PLOGI << "Loaded BRIR " << brir_path;
+  return environment;
+}
+
+template<class T>
+void AudioRenderer<T>::clearScene(Engine &engine) {
+  auto table = engine.sources.exchange(std::make_unique<SourceTable>());
+  for (const auto &source: table->sources) {
+    if (source) {
+      releaseSource(engine, *source);
+    }
+  }
+  engine.listener_ramp = Ramp();
+}
+
+template<class T>
+void AudioRenderer<T>::requestStart(const StartRequest &request) {
+  {
+    std::lock_guard<std::mutex> lock(start_mutex_);
+    if (initialized_ && !pending_start_ && last_start_ == request) {
+      PLOGD << "Configuration unchanged, keeping the audio renderer";
+      return;
+    }
+    pending_start_ = request;
+  }
+  start_signal_.notify_one();
+}
+
+template<class T>
+void AudioRenderer<T>::build() {
+  while (true) {
+    std::unique_lock<std::mutex> lock(start_mutex_);
+    start_signal_.wait(lock, [this]() {
+      return pending_start_ || !is_building_;
+    });
+    if (!is_building_) {
+      return;
+    }
+    // Only the latest request matters, the ones queued meanwhile are skipped
+    const auto request = *pending_start_;
+    const auto generation = start_generation_;
+    pending_start_.reset();
+    lock.unlock();
+    try {
+      if (startEngine(request.sample_rate, request.buffer_size, request.room_size, kDefaultHrtfResamplingSteps,
+                      generation)) {
+        // Only a configuration which is actually running may be skipped or rebuilt later
+        lock.lock();
+        last_start_ = request;
+      }
+    } catch (std::exception &e) {
+      PLOGE << "Could not auto start: " << e.what();
+    }
+  }
+}
+
 template<class T>
 void AudioRenderer<T>::autoInit(const DigitalStage::Types::Stage &stage,
                                 const DigitalStage::Types::SoundCard &sound_card) {
@@ -160,11 +369,7 @@ void AudioRenderer<T>::autoInit(const DigitalStage::Types::Stage &stage,
     } else if (room_volume > 1000) {
       room_size = AudioRenderer::RoomSize::kMedium;
     }
-    try {
-      start(sound_card.sampleRate, sound_card.bufferSize, room_size);
-    } catch (std::exception &e) {
-      PLOGE << "Could not auto start: " << e.what();
-    }
+    requestStart({sound_card.sampleRate, sound_card.bufferSize, room_size});
   } else {
     PLOGW << "Current values of output sound card are not supported by 3D audio engine";
   }
@@ -278,16 +483,7 @@ void AudioRenderer<T>::attachHandlers(bool autostart) {
       }
       PLOGI << "A native audio track has been added";
 #endif
-      mutex_.lock();
-      if (!audio_tracks_.count(audio_track._id)) {
-        audio_tracks_[audio_track._id] = core_->CreateSingleSourceDSP();
-        audio_tracks_[audio_track._id]->SetSpatializationMode(Binaural::TSpatializationMode::HighQuality);
-        audio_tracks_[audio_track._id]->DisableNearFieldEffect();
-        audio_tracks_[audio_track._id]->EnableAnechoicProcess();
-        audio_tracks_[audio_track._id]->EnableDistanceAttenuationAnechoic();
-      }
-      setAudioTrackPosition(audio_track._id, calculatePosition(audio_track, store));
-      mutex_.unlock();
+      addAudioTrack(track_interner_->intern(audio_track._id), calculatePosition(audio_track, store));
     }
   }, token_);
   client_->audioTrackChanged.connect([this](const std::string &_id, const nlohmann::json &update,
@@ -301,19 +497,15 @@ void AudioRenderer<T>::attachHandlers(bool autostart) {
       if (update.contains("x") || update.contains("y") || update.contains("z") || update.contains("rX")
           || update.contains("rY") || update.contains("rZ")) {
         auto audio_track = store->audioTracks.get(_id);
-        mutex_.lock();
-        setAudioTrackPosition(audio_track->_id, calculatePosition(*audio_track, store));
-        mutex_.unlock();
+        setAudioTrackPosition(track_interner_->find(audio_track->_id), calculatePosition(*audio_track, store));
       }
     }
   }, token_);
   client_->audioTrackRemoved.connect([this](const DigitalStage::Types::AudioTrack &audio_track,
                                             const std::weak_ptr<DigitalStage::Api::Store> &store_ptr) {
     if (!store_ptr.expired() && store_ptr.lock()->isReady() && initialized_) {
-      mutex_.lock();
       PLOGD << "audioTrackRemoved";
-      audio_tracks_.erase(audio_track._id);
-      mutex_.unlock();
+      removeAudioTrack(track_interner_->find(audio_track._id));
     }
   }, token_);
   client_->stageMemberChanged.connect([this](const std::string &_id, const nlohmann::json &update,
@@ -328,9 +520,7 @@ void AudioRenderer<T>::attachHandlers(bool autostart) {
         // Update all related audio tracks
         auto audio_tracks = store->getAudioTracksByStageMember(_id);
         for (const auto &audio_track: audio_tracks) {
-          mutex_.lock();
-          setAudioTrackPosition(audio_track._id, calculatePosition(audio_track, store));
-          mutex_.unlock();
+          setAudioTrackPosition(track_interner_->find(audio_track._id), calculatePosition(audio_track, store));
         }
         // Is this listener assigned to the stage member?
         auto stage_member_id = store->getStageMemberId();
@@ -338,9 +528,7 @@ void AudioRenderer<T>::attachHandlers(bool autostart) {
           auto stage_member = store->stageMembers.get(_id);
           // Also update this listener
           if (stage_member) {
-            mutex_.lock();
             setListenerPosition(calculatePosition(*stage_member, store));
-            mutex_.unlock();
           } else {
             PLOGE << "Stage member not found";
           }
@@ -350,31 +538,469 @@ void AudioRenderer<T>::attachHandlers(bool autostart) {
   }, token_);
 }
 
+template<class T>
+typename AudioRenderer<T>::Pose AudioRenderer<T>::toPose(const DigitalStage::Types::ThreeDimensionalProperties &position) {
+  return {static_cast<float>(position.x), static_cast<float>(position.y), static_cast<float>(position.z),
+          static_cast<float>(position.rX), static_cast<float>(position.rY), static_cast<float>(position.rZ)};
+}
+template<class T>
+Common::CTransform AudioRenderer<T>::toTransform(const Pose &pose) {
+  Common::CTransform transform = Common::CTransform();
+  transform.SetPosition(Common::CVector3(pose.x, pose.y, pose.z));
+  transform.SetOrientation(Common::CQuaternion::FromYawPitchRoll(pose.rZ, pose.rY, pose.rX));
+  return transform;
+}
+template<class T>
+std::shared_ptr<Binaural::CSingleSourceDSP> AudioRenderer<T>::createSource(Binaural::CCore &core, bool reverb) {
+  auto source = core.CreateSingleSourceDSP();
+  source->SetSpatializationMode(Binaural::TSpatializationMode::HighQuality);
+  source->DisableNearFieldEffect();
+  source->EnableAnechoicProcess();
+  source->EnableDistanceAttenuationAnechoic();
+  if (!reverb) {
+    source->DisableReverbProcess();
+  }
+  return source;
+}
+template<class T>
+void AudioRenderer<T>::allocate(Common::CEarPair<CMonoBuffer<float>> &buffer, std::size_t frame_size) {
+  buffer.left.assign(frame_size, 0.0f);
+  buffer.right.assign(frame_size, 0.0f);
+}
+template<class T>
+std::shared_ptr<const typename AudioRenderer<T>::MeasuredReverb> AudioRenderer<T>::getMeasuredReverb(unsigned int sample_rate,
+                                                                                                    unsigned int buffer_size,
+                                                                                                    RoomSize room_size) {
+  // The impulse responses do not depend on the block size they were measured with
+  using Key = std::tuple<unsigned int, RoomSize>;
+  static std::map<Key, std::shared_ptr<const MeasuredReverb>> cache;
+  static std::mutex cache_mutex;
+  // Held while measuring, so renderers starting at once measure each room only once
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  auto &measured = cache[Key{sample_rate, room_size}];
+  if (!measured) {
+    measured = measureReverb(sample_rate, buffer_size, room_size);
+  }
+  return measured;
+}
+template<class T>
+std::unique_ptr<typename AudioRenderer<T>::MeasuredReverb> AudioRenderer<T>::measureReverb(unsigned int sample_rate,
+                                                                                          unsigned int buffer_size,
+                                                                                          RoomSize room_size) {
+  // The reverb of 3D Tune-In only needs the listener pose, so the probes skip loading an HRTF
+  Binaural::CCore core(Common::TAudioStateStruct{static_cast<int>(sample_rate), static_cast<int>(buffer_size)});
+  auto listener = core.CreateListener();
+  auto environment = createEnvironment(core, sample_rate, room_size);
+  auto measured = std::make_unique<MeasuredReverb>();
+  const std::size_t frame_size = buffer_size;
+  const auto max_blocks = static_cast<std::size_t>(kMaxReverbDuration * sample_rate / frame_size);
+  const std::array<Common::CVector3, kReverbProbes>
+      positions{Common::CVector3(1, 0, 0), Common::CVector3(0, 1, 0), Common::CVector3(-1, 0, 0)};
+  std::array<std::array<float, kReverbProbes>, kReverbProbes> directions{};
+  auto &responses = measured->responses;
+  CMonoBuffer<float> impulse(frame_size, 0.0f);
+  Common::CEarPair<CMonoBuffer<float>> output;
+  allocate(output, frame_size);
+  for (std::size_t probe = 0; probe < kReverbProbes; probe++) {
+    Common::CTransform transform;
+    transform.SetPosition(positions[probe]);
+    directions[probe] = getReverbDirection(listener->GetListenerTransform(), transform);
+    auto source = createSource(core, true);
+    // The convolved reverb does not depend on the distance, so it is measured without attenuation. Only the 3D Tune-In
+    // reverb of the fallback attenuates it.
+    source->DisableDistanceAttenuationReverb();
+    source->SetSourceTransform(transform);
+    auto &response = responses[probe];
+    float peak = 0;
+    for (std::size_t block = 0; block < max_blocks; block++) {
+      impulse[0] = block == 0 ? 1.0f : 0.0f;
+      source->SetBuffer(impulse);
+      environment->ProcessVirtualAmbisonicReverb(output.left, output.right);
+      if (output.left.size() < frame_size || output.right.size() < frame_size) {
+        break;
+      }
+      float block_peak = 0;
+      for (std::size_t frame = 0; frame < frame_size; frame++) {
+        block_peak = std::max({block_peak, std::abs(output.left[frame]), std::abs(output.right[frame])});
+      }
+      response.left.insert(response.left.end(), output.left.begin(), output.left.begin() + frame_size);
+      response.right.insert(response.right.end(), output.right.begin(), output.right.begin() + frame_size);
+      peak = std::max(peak, block_peak);
+      if (peak > 0 && block_peak < peak * kReverbSilence) {
+        break;
+      }
+    }
+    core.RemoveSingleSourceDSP(source);
+    if (peak == 0) {
+      throw std::runtime_error("Environment renders no reverb");
+    }
+  }
+
+  // The weights w of a direction d solve sum(w[i] * directions[i]) = d, so invert the transposed directions
+  const auto &m = directions;
+  const float determinant = m[0][0] * (m[1][1] * m[2][2] - m[2][1] * m[1][2])
+      - m[1][0] * (m[0][1] * m[2][2] - m[2][1] * m[0][2])
+      + m[2][0] * (m[0][1] * m[1][2] - m[1][1] * m[0][2]);
+  if (std::abs(determinant) < 1e-3f) {
+    throw std::runtime_error("Reverb probes do not span all directions");
+  }
+  for (std::size_t row = 0; row < kReverbProbes; row++) {
+    for (std::size_t column = 0; column < kReverbProbes; column++) {
+      const auto r1 = (row + 1) % kReverbProbes, r2 = (row + 2) % kReverbProbes;
+      const auto c1 = (column + 1) % kReverbProbes, c2 = (column + 2) % kReverbProbes;
+      measured->decoder[row][column] = (m[r1][c1] * m[r2][c2] - m[r2][c1] * m[r1][c2]) / determinant;
+    }
+  }
+  PLOGI << "Measured " << to_string(room_size) << " reverb of "
+        << static_cast<double>(responses[0].left.size()) / sample_rate << "s";
+  return measured;
+}
+template<class T>
+std::unique_ptr<typename AudioRenderer<T>::Reverb> AudioRenderer<T>::createReverb(const MeasuredReverb &measured,
+                                                                                  std::size_t frame_size) {
+  auto reverb = std::make_unique<Reverb>();
+  reverb->frame_size = frame_size;
+  reverb->decoder = measured.decoder;
+  reverb->convolver = std::make_unique<PartitionedConvolver>(frame_size, kReverbProbes, 2);
+  for (std::size_t probe = 0; probe < kReverbProbes; probe++) {
+    const auto &response = measured.responses[probe];
+    reverb->convolver->setImpulseResponse(probe, 0, response.left.data(), response.left.size());
+    reverb->convolver->setImpulseResponse(probe, 1, response.right.data(), response.right.size());
+    reverb->buses[probe].assign(frame_size, 0.0f);
+  }
+  return reverb;
+}
+template<class T>
+std::array<float, AudioRenderer<T>::kReverbProbes> AudioRenderer<T>::getReverbDirection(const Common::CTransform &listener,
+                                                                                         const Common::CTransform &source) {
+  const auto vector = listener.GetVectorTo(source);
+  const float azimuth = vector.GetAzimuthRadians();
+  const float elevation = vector.GetElevationRadians();
+  return {1.0f, std::cos(elevation) * std::cos(azimuth), std::cos(elevation) * std::sin(azimuth)};
+}
+template<class T>
+void AudioRenderer<T>::updateDirection(const Pose &listener, Source &source) {
+  const auto listener_transform = toTransform(listener);
+  const auto transform = toTransform(source.ramp.current);
+  source.direction = getReverbDirection(listener_transform, transform);
+  source.distance = listener_transform.GetVectorTo(transform).GetDistance();
+}
+template<class T>
+void AudioRenderer<T>::addSource(const Engine &engine, TrackHandle audio_track, const Pose &pose, const Pose &listener) {
+  auto source = std::make_shared<Source>();
+  beginSourceChange(engine);
+  source->dsps = {createSource(*engine.core, true), createSource(*engine.core, false)};
+  endSourceChange(engine);
+  source->ramp = {pose, pose, 0};
+  source->dsps[0]->SetSourceTransform(toTransform(pose));
+  source->input.assign(engine.frame_size, 0.0f);
+  allocate(source->output, engine.frame_size);
+  allocate(source->crossfade_output, engine.frame_size);
+  // From the listener pose of the scene, the audio thread corrects it with the next move
+  updateDirection(listener, *source);
+  std::shared_ptr<Source> previous;
+  engine.sources.update([audio_track, &source, &previous](SourceTable &table) {
+    auto &sources = table.sources;
+    if (audio_track >= sources.size()) {
+      sources.resize(audio_track + 1);
+    }
+    previous = std::move(sources[audio_track]);
+    sources[audio_track] = std::move(source);
+    table.schedule_order.reserve(sources.size());
+  });
+  if (previous) {
+    releaseSource(engine, *previous);
+  }
+}
+template<class T>
+void AudioRenderer<T>::removeSource(const Engine &engine, TrackHandle audio_track) {
+  std::shared_ptr<Source> removed;
+  engine.sources.update([audio_track, &removed](SourceTable &table) {
+    if (audio_track < table.sources.size()) {
+      removed = std::move(table.sources[audio_track]);
+    }
+  });
+  // The audio thread is done with it, so it is freed right here
+  if (removed) {
+    releaseSource(engine, *removed);
+  }
+}
+template<class T>
+void AudioRenderer<T>::releaseSource(const Engine &engine, const Source &source) {
+  beginSourceChange(engine);
+  for (const auto &dsp: source.dsps) {
+    engine.core->RemoveSingleSourceDSP(dsp);
+  }
+  endSourceChange(engine);
+}
+template<class T>
+void AudioRenderer<T>::beginSourceChange(const Engine &engine) {
+  // Together with renderReverb a Dekker handshake: at least one side sees the flag of the other one
+  engine.changing_sources = true;
+  while (engine.rendering_reverb) {
+    std::this_thread::yield();
+  }
+}
+template<class T>
+void AudioRenderer<T>::endSourceChange(const Engine &engine) {
+  engine.changing_sources = false;
+}
+template<class T>
+Binaural::TSpatializationMode AudioRenderer<T>::toSpatializationMode(Quality quality) {
+  return quality == kHighQuality ? Binaural::TSpatializationMode::HighQuality
+                                 : Binaural::TSpatializationMode::HighPerformance;
+}
+template<class T>
+void AudioRenderer<T>::apply(const Engine &engine,
+                             const Sources &sources,
+                             const Command &command,
+                             std::size_t ramp_frames) {
+  if (!engine.core) {
+    // Not started, the next engine picks the change up from the scene
+    return;
+  }
+  switch (command.type) {
+    case Command::kSetListener:engine.listener_ramp.target = command.pose;
+      engine.listener_ramp.remaining = ramp_frames;
+      break;
+    case Command::kSetSource:
+      if (command.audio_track < sources.size() && sources[command.audio_track]) {
+        // Only the last target within a block counts, so a flood of updates costs a single one
+        auto &source = *sources[command.audio_track];
+        source.ramp.target = command.pose;
+        source.ramp.remaining = ramp_frames;
+      }
+      break;
+  }
+}
+template<class T>
+bool AudioRenderer<T>::advance(Ramp &ramp, std::size_t frame_size) {
+  if (ramp.current == ramp.target) {
+    return false;
+  }
+  if (ramp.remaining <= frame_size) {
+    ramp.current = ramp.target;
+    ramp.remaining = 0;
+    return true;
+  }
+  // Linear towards the target, angles along the shorter way round
+  const auto t = static_cast<float>(frame_size) / static_cast<float>(ramp.remaining);
+  auto &current = ramp.current;
+  const auto &target = ramp.target;
+  current.x += (target.x - current.x) * t;
+  current.y += (target.y - current.y) * t;
+  current.z += (target.z - current.z) * t;
+  current.rX += std::remainder(target.rX - current.rX, kTwoPi) * t;
+  current.rY += std::remainder(target.rY - current.rY, kTwoPi) * t;
+  current.rZ += std::remainder(target.rZ - current.rZ, kTwoPi) * t;
+  ramp.remaining -= frame_size;
+  return true;
+}
+template<class T>
+float AudioRenderer<T>::getDirectionChange(const Pose &listener_from,
+                                           const Pose &listener_to,
+                                           const Pose &from,
+                                           const Pose &to) {
+  const float ax = from.x - listener_from.x, ay = from.y - listener_from.y, az = from.z - listener_from.z;
+  const float bx = to.x - listener_to.x, by = to.y - listener_to.y, bz = to.z - listener_to.z;
+  const float lengths = std::sqrt((ax * ax + ay * ay + az * az) * (bx * bx + by * by + bz * bz));
+  float angle = 0;
+  if (lengths > 1e-6f) {
+    angle = std::acos(std::clamp((ax * bx + ay * by + az * bz) / lengths, -1.0f, 1.0f));
+  }
+  // Turning the head changes the direction as well
+  return angle + std::abs(std::remainder(listener_to.rZ - listener_from.rZ, kTwoPi));
+}
+template<class T>
+void AudioRenderer<T>::push(const Command &command) {
+  // Called with mutex_ held, so the scene and the queue stay in the same order
+  if (commands_.push([&command](Command &slot) { slot = command; }) > 0) {
+    // The audio thread has not applied any changes for a long time (e.g. no stream running), so start over from the scene
+    PLOGW << "Too many pending scene changes, rebuilding the audio renderer";
+    std::lock_guard<std::mutex> lock(start_mutex_);
+    if (last_start_) {
+      pending_start_ = last_start_;
+      start_signal_.notify_one();
+    }
+  }
+}
+template<class T>
+void AudioRenderer<T>::setRampDuration(double ramp_ms) {
+  ramp_duration_ = std::max(0.0, ramp_ms);
+}
+template<class T>
+void AudioRenderer<T>::setRenderBudget(double share) {
+  render_budget_ = std::max(0.0, share);
+}
+template<class T>
+void AudioRenderer<T>::beginBlock(std::size_t frame_size) {
+  auto engine = engine_.read();
+  auto table = engine->sources.read();
+  const auto &sources = table->sources;
+  const auto sample_rate = engine->sample_rate > 0 ? engine->sample_rate : 48000;
+  ramp_frames_ = static_cast<std::size_t>(ramp_duration_ * sample_rate / 1000.0);
+  while (commands_.pop([this, &engine, &sources](Command &command) {
+    apply(*engine, sources, command, ramp_frames_);
+  })) {
+  }
+  if (!engine->core) {
+    return;
+  }
+
+  const auto listener_from = engine->listener_ramp.current;
+  const bool listener_moved = advance(engine->listener_ramp, frame_size);
+  if (listener_moved) {
+    engine->listener->SetListenerTransform(toTransform(engine->listener_ramp.current));
+  }
+  for (const auto &source: sources) {
+    if (!source) {
+      continue;
+    }
+    const auto from = source->ramp.current;
+    const bool moved = advance(source->ramp, frame_size);
+    if (moved || listener_moved) {
+      updateDirection(engine->listener_ramp.current, *source);
+    }
+    if (!moved) {
+      continue;
+    }
+    const auto transform = toTransform(source->ramp.current);
+    if (getDirectionChange(listener_from, engine->listener_ramp.current, from, source->ramp.current)
+        > kCrossfadeAngle) {
+      // Render the next block with the old pose on the active and the new pose on the other spatializer
+      source->dsps[1 - source->active]->SetSourceTransform(transform);
+      if (!source->crossfade) {
+        startCrossfade(*source, source->quality);
+      }
+    } else if (source->crossfade) {
+      source->dsps[1 - source->active]->SetSourceTransform(transform);
+    } else {
+      source->dsps[source->active]->SetSourceTransform(transform);
+    }
+  }
+
+  schedule(*engine, *table, frame_size);
+  for (const auto &source: sources) {
+    if (!source || source->crossfade || source->target_quality == source->quality) {
+      continue;
+    }
+    // Switch the quality by crossfading to the other spatializer, so it never clicks
+    source->dsps[1 - source->active]->SetSourceTransform(toTransform(source->ramp.current));
+    startCrossfade(*source, source->target_quality);
+  }
+}
+template<class T>
+void AudioRenderer<T>::startCrossfade(Source &source, Quality quality) {
+  auto &next = source.dsps[1 - source.active];
+  {
+    // Still holds the delay lines and convolution tails of when it was active last, maybe seconds ago.
+    // 3D Tune-In reallocates them, nothing of the renderer does.
+    AllowAllocationScope allow_allocation_scope;
+    next->ResetSourceBuffers();
+  }
+  if (quality != kPanning) {
+    next->SetSpatializationMode(toSpatializationMode(quality));
+  }
+  source.next_quality = quality;
+  source.crossfade = true;
+}
+template<class T>
+void AudioRenderer<T>::schedule(const Engine &engine, const SourceTable &table, std::size_t frame_size) {
+  const auto &sources = table.sources;
+  for (const auto &source: sources) {
+    if (!source) {
+      continue;
+    }
+    if (source->render_time >= 0) {
+      auto &cost = quality_costs_[source->quality];
+      cost = cost == 0 ? source->render_time : cost + kMeasurementSmoothing * (source->render_time - cost);
+    }
+    source->level += kMeasurementSmoothing * (source->block_level - source->level);
+    source->render_time = -1;
+    source->block_level = 0;
+  }
+
+  frames_since_schedule_ += frame_size;
+  if (static_cast<double>(frames_since_schedule_) < kScheduleInterval * engine.sample_rate / 1000.0) {
+    return;
+  }
+  frames_since_schedule_ = 0;
+  const auto high_quality = quality_costs_[kHighQuality];
+  if (high_quality == 0) {
+    // Nothing measured yet
+    return;
+  }
+  // Until a cheaper quality has been used, guess its cost from the full one
+  const auto high_performance = quality_costs_[kHighPerformance] > 0 ? quality_costs_[kHighPerformance]
+                                                                     : high_quality / 4;
+  const auto panning = quality_costs_[kPanning] > 0 ? quality_costs_[kPanning] : high_quality / 50;
+  const auto budget = static_cast<float>(render_budget_ * 1e9 * static_cast<double>(frame_size) / engine.sample_rate);
+
+  // Loud and near tracks first, the order has room for all sources of the table
+  auto &schedule_order = table.schedule_order;
+  schedule_order.clear();
+  for (TrackHandle audio_track = 0; audio_track < sources.size(); audio_track++) {
+    // Skipped tracks cost nothing and keep their quality
+    if (const auto &source = sources[audio_track]; source && !source->idle) {
+      schedule_order.emplace_back(source->level / std::max(source->distance, 1.0f), audio_track);
+    }
+  }
+  std::sort(schedule_order.begin(), schedule_order.end(), std::greater<>());
+  auto total = panning * static_cast<float>(schedule_order.size());
+  for (const auto &entry: schedule_order) {
+    auto &source = *sources[entry.second];
+    if (total + high_quality - panning <= budget) {
+      source.target_quality = kHighQuality;
+      total += high_quality - panning;
+    } else if (total + high_performance - panning <= budget) {
+      source.target_quality = kHighPerformance;
+      total += high_performance - panning;
+    } else {
+      source.target_quality = kPanning;
+    }
+  }
+}
 template<class T>
 void AudioRenderer<T>::setListenerPosition(const DigitalStage::Types::ThreeDimensionalProperties &position) {
   PLOGD << "setListenerPosition";
-  Common::CTransform transform = Common::CTransform();
-  transform.SetPosition(Common::CVector3(static_cast<float>(position.x),
-                                         static_cast<float>(position.y),
-                                         static_cast<float>(position.z)));
-  transform.SetOrientation(Common::CQuaternion::FromYawPitchRoll(static_cast<float>(position.rZ),
-                                                                 static_cast<float>(position.rY),
-                                                                 static_cast<float>(position.rX)));
-  listener_->SetListenerTransform(transform);
+  std::lock_guard<std::mutex> lock(mutex_);
+  listener_pose_ = toPose(position);
+  push({Command::kSetListener, kInvalidTrackHandle, *listener_pose_});
 }
 template<class T>
-void AudioRenderer<T>::setAudioTrackPosition(const string &audio_track_id,
+void AudioRenderer<T>::addAudioTrack(TrackHandle audio_track,
+                                     const DigitalStage::Types::ThreeDimensionalProperties &position) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (audio_track >= source_poses_.size()) {
+    source_poses_.resize(audio_track + 1);
+  }
+  source_poses_[audio_track] = toPose(position);
+  auto engine = engine_.read();
+  if (engine->core && listener_pose_) {
+    addSource(*engine, audio_track, *source_poses_[audio_track], *listener_pose_);
+  }
+  // Supersedes the moves of a previous source of this track which may still be queued
+  push({Command::kSetSource, audio_track, *source_poses_[audio_track]});
+}
+template<class T>
+void AudioRenderer<T>::setAudioTrackPosition(TrackHandle audio_track,
                                              const DigitalStage::Types::ThreeDimensionalProperties &position) {
   PLOGD << "setAudioTrackPosition";
-  if (audio_tracks_.count(audio_track_id)) {
-    Common::CTransform transform = Common::CTransform();
-    transform.SetPosition(Common::CVector3(static_cast<float>(position.x),
-                                           static_cast<float>(position.y),
-                                           static_cast<float>(position.z)));
-    transform.SetOrientation(Common::CQuaternion::FromYawPitchRoll(static_cast<float>(position.rZ),
-                                                                   static_cast<float>(position.rY),
-                                                                   static_cast<float>(position.rX)));
-    audio_tracks_[audio_track_id]->SetSourceTransform(transform);
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (audio_track < source_poses_.size() && source_poses_[audio_track]) {
+    source_poses_[audio_track] = toPose(position);
+    push({Command::kSetSource, audio_track, *source_poses_[audio_track]});
+  }
+}
+template<class T>
+void AudioRenderer<T>::removeAudioTrack(TrackHandle audio_track) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (audio_track < source_poses_.size() && source_poses_[audio_track]) {
+    source_poses_[audio_track].reset();
+    auto engine = engine_.read();
+    if (engine->core) {
+      removeSource(*engine, audio_track);
+    }
   }
 }
 template<class T>
@@ -416,90 +1042,211 @@ DigitalStage::Types::ThreeDimensionalProperties AudioRenderer<T>::calculatePosit
   return {"cardoid", pos_x, pos_y, pos_z, r_x, r_y, r_z};
 }
 template<class T>
-void AudioRenderer<T>::render(const std::string &audio_track_id,
-                              T *input,
-                              T *outLeft,
-                              T *outRight,
-                              std::size_t frame_size) {
-  // Get volume and mute state (if available)
-  auto volume_info = audio_mixer_ ? audio_mixer_->getGain(audio_track_id) : std::nullopt;
-  if (volume_info && volume_info->second) {
+std::pair<T, T> AudioRenderer<T>::advanceGain(TrackHandle audio_track, T target, std::size_t frame_size) {
+  auto track_states = track_states_.read();
+  if (audio_track >= track_states->size()) {
+    // Still being interned
+    return {target, target};
+  }
+  // Each track is rendered by one thread at a time, so its state needs no synchronization
+  auto &applied = (*track_states)[audio_track]->applied_gain;
+  const auto from = applied;
+  if (ramp_frames_ <= frame_size || std::abs(target - applied) < static_cast<T>(1e-4)) {
+    applied = target;
+  } else {
+    applied += (target - applied) * static_cast<T>(frame_size) / static_cast<T>(ramp_frames_);
+  }
+  return {from, applied};
+}
+template<class T>
+float AudioRenderer<T>::render(TrackHandle audio_track,
+                               T *input,
+                               T *outLeft,
+                               T *outRight,
+                               std::size_t frame_size,
+                               bool active) {
+  // Get volume and mute state (if available) and ramp towards it
+  T target = 1;
+  {
+    auto gains = gains_.read();
+    if (audio_track < gains->size() && (*gains)[audio_track]) {
+      target = (*gains)[audio_track]->second ? 0 : (*gains)[audio_track]->first;
+    }
+  }
+  const auto gain = advanceGain(audio_track, target, frame_size);
+  if (gain.first == 0 && gain.second == 0) {
     // Muted, do nothing
-    memset(outLeft, 0, sizeof(float) * frame_size);
-    return;
+    return 0;
   }
   // Not muted so far ... now render:
-  if (initialized_ && frame_size == current_frame_size_) {
-    if (mutex_.try_lock()) {
-      if (audio_tracks_.count(audio_track_id) != 0) {
-        if (falling_back_) {
-          falling_back_ = false;
-          //PLOGD << "Disabling fallback since all requirements are fulfilled";
-        }
-        try {
-          CMonoBuffer<float> input_buffer(frame_size);
-          input_buffer.Feed(input, frame_size, 1);
-
-          Common::CEarPair<CMonoBuffer<float>> buffer_processed;
-
-          input_buffer.ApplyGain(volume_info->first);
-
-          audio_tracks_[audio_track_id]->SetBuffer(input_buffer);
-          audio_tracks_[audio_track_id]->ProcessAnechoic(buffer_processed.left, buffer_processed.right);
-
-          if (!buffer_processed.left.empty()) {
-            for (int frame = 0; frame < frame_size; frame++) {
-              outLeft[frame] += buffer_processed.left[frame];
-              outRight[frame] += buffer_processed.right[frame];
-            }
-          }
-        } catch (std::exception &err) {
-          PLOGE << err.what();
-          mutex_.unlock();
-        }
+  auto engine = engine_.read();
+  auto table = engine->sources.read();
+  const auto &sources = table->sources;
+  if (engine->core && frame_size == engine->frame_size) {
+    if (audio_track < sources.size() && sources[audio_track]) {
+      auto &source = *sources[audio_track];
+      if (active) {
+        source.silent_frames = 0;
+      } else if (source.silent_frames >= engine->silence_tail && !source.crossfade) {
+        // Nothing left to hear, and the spatializers start from silence again when the track resumes
+        source.idle = true;
+        return quality_costs_[source.quality];
       } else {
-        if (!falling_back_) {
-          falling_back_ = true;
-          PLOGD << "No render information for audio track - falling back to simple mixing";
-        }
-        renderFallback(input, outLeft, outRight, frame_size, volume_info);
+        source.silent_frames += frame_size;
       }
-      mutex_.unlock();
+      source.idle = false;
+      renderSource(source, active ? input : nullptr, outLeft, outRight, frame_size, gain);
     } else {
-      if (!falling_back_) {
-        falling_back_ = true;
-        PLOGD << "Falling back to simple mixing to avoid blocking";
-      }
-      renderFallback(input, outLeft, outRight, frame_size, volume_info);
+      // No render information for the track (yet), so just mix it
+      renderFallback(input, outLeft, outRight, frame_size, gain);
     }
   } else {
-    if (!falling_back_) {
-      falling_back_ = true;
-      PLOGD << "Falling back to simple mixing since 3D audio is not supported";
+    // 3D audio is not supported with this stream
+    renderFallback(input, outLeft, outRight, frame_size, gain);
+  }
+  return 0;
+}
+template<class T>
+void AudioRenderer<T>::renderSource(Source &source,
+                                    T *input,
+                                    T *outLeft,
+                                    T *outRight,
+                                    std::size_t frame_size,
+                                    std::pair<T, T> gain) {
+  try {
+    const auto start = std::chrono::steady_clock::now();
+    // Feed and apply the gain ramp in one pass
+    auto &input_buffer = source.input;
+    const T gain_step = (gain.second - gain.first) / static_cast<T>(frame_size);
+    float energy = 0;
+    if (input) {
+      for (std::size_t frame = 0; frame < frame_size; frame++) {
+        input_buffer[frame] = input[frame] * (gain.first + gain_step * static_cast<T>(frame + 1));
+        energy += input_buffer[frame] * input_buffer[frame];
+      }
+    } else {
+      // Flush the spatializers with true silence, the input is below the threshold anyway
+      std::fill_n(input_buffer.begin(), frame_size, 0.0f);
+    }
+    source.block_level = std::sqrt(energy / static_cast<float>(frame_size));
+    source.has_reverb_input = true;
+
+    auto &buffer_processed = source.output;
+    spatialize(source, source.active, source.quality, buffer_processed, frame_size);
+    if (buffer_processed.left.size() < frame_size) {
+      return;
+    }
+
+    if (source.crossfade) {
+      // Fade from the active spatializer to the other one with the new pose or quality, which takes over
+      auto &buffer_next = source.crossfade_output;
+      spatialize(source, 1 - source.active, source.next_quality, buffer_next, frame_size);
+      if (buffer_next.left.size() >= frame_size) {
+        for (std::size_t frame = 0; frame < frame_size; frame++) {
+          const auto fade = static_cast<T>(frame + 1) / static_cast<T>(frame_size);
+          outLeft[frame] += buffer_processed.left[frame] * (1 - fade) + buffer_next.left[frame] * fade;
+          outRight[frame] += buffer_processed.right[frame] * (1 - fade) + buffer_next.right[frame] * fade;
+        }
+        source.dsps[source.active]->DisableReverbProcess();
+        source.dsps[1 - source.active]->EnableReverbProcess();
+        source.active = 1 - source.active;
+        source.quality = source.next_quality;
+        source.crossfade = false;
+        return;
+      }
     }
-    renderFallback(input, outLeft, outRight, frame_size, volume_info);
+
+    for (std::size_t frame = 0; frame < frame_size; frame++) {
+      outLeft[frame] += buffer_processed.left[frame];
+      outRight[frame] += buffer_processed.right[frame];
+    }
+    source.render_time = std::chrono::duration<float, std::nano>(std::chrono::steady_clock::now() - start).count();
+  } catch (std::exception &err) {
+    PLOGE << err.what();
+  }
+}
+template<class T>
+void AudioRenderer<T>::spatialize(Source &source,
+                                  std::size_t dsp,
+                                  Quality quality,
+                                  Common::CEarPair<CMonoBuffer<float>> &output,
+                                  std::size_t frame_size) {
+  // The reverb of 3D Tune-In reads the input of the spatializer, so feed it even when panning
+  source.dsps[dsp]->SetBuffer(source.input);
+  if (quality != kPanning) {
+    // The output buffers are reused, but 3D Tune-In still allocates temporaries internally
+    AllowAllocationScope allow_allocation_scope;
+    source.dsps[dsp]->ProcessAnechoic(output.left, output.right);
+    return;
+  }
+  // Lateral component of the direction, positive to the left, attenuated by 6 dB per doubling beyond 1 m
+  const float lateral = std::clamp(source.direction[2], -1.0f, 1.0f);
+  const float attenuation = 1.0f / std::max(source.distance, 1.0f);
+  const float left = std::sqrt(0.5f * (1 + lateral)) * attenuation;
+  const float right = std::sqrt(0.5f * (1 - lateral)) * attenuation;
+  for (std::size_t frame = 0; frame < frame_size; frame++) {
+    output.left[frame] = source.input[frame] * left;
+    output.right[frame] = source.input[frame] * right;
   }
 }
 template<class T>
 void AudioRenderer<T>::renderReverb(T *outLeft,
                                     T *outRight,
                                     std::size_t frame_size) { // NOLINT(bugprone-easily-swappable-parameters)
-  if (initialized_ && frame_size == current_frame_size_) {
-    if (mutex_.try_lock()) {
-      //TODO: Pull initialized fully to here
-      if (!initialized_)
-        return;
-      Common::CEarPair<CMonoBuffer<float>> buffer_reverb;
-
-      environment_->ProcessVirtualAmbisonicReverb(buffer_reverb.left, buffer_reverb.right);
+  auto engine = engine_.read();
+  auto reverb = reverb_.read();
+  if (engine->core && frame_size == engine->frame_size) {
+    auto &buffer_reverb = engine->reverb;
 
-      if (!buffer_reverb.left.empty()) {
-        for (int frame = 0; frame < frame_size; frame++) {
-          outLeft[frame] += buffer_reverb.left[frame];
-          outRight[frame] += buffer_reverb.right[frame];
+    if (reverb->convolver && frame_size == reverb->frame_size) {
+      // Mix the sources rendered in this block onto the buses of the measured directions and convolve them
+      auto &buses = reverb->buses;
+      for (auto &bus: buses) {
+        std::fill(bus.begin(), bus.end(), 0.0f);
+      }
+      auto table = engine->sources.read();
+      for (const auto &source: table->sources) {
+        if (!source || !source->has_reverb_input) {
+          continue;
         }
+        source->has_reverb_input = false;
+        for (std::size_t bus = 0; bus < kReverbProbes; bus++) {
+          float weight = 0;
+          for (std::size_t component = 0; component < kReverbProbes; component++) {
+            weight += reverb->decoder[bus][component] * source->direction[component];
+          }
+          for (std::size_t frame = 0; frame < frame_size; frame++) {
+            buses[bus][frame] += weight * source->input[frame];
+          }
+        }
+      }
+      std::fill(buffer_reverb.left.begin(), buffer_reverb.left.end(), 0.0f);
+      std::fill(buffer_reverb.right.begin(), buffer_reverb.right.end(), 0.0f);
+      const std::array<const float *, kReverbProbes> inputs{buses[0].data(), buses[1].data(), buses[2].data()};
+      const std::array<float *, 2> outputs{buffer_reverb.left.data(), buffer_reverb.right.data()};
+      reverb->convolver->process(inputs.data(), outputs.data());
+    } else if (engine->environment) {
+      // Iterates all sources of the core, so skip the block while a control thread creates or removes one
+      engine->rendering_reverb = true;
+      const bool changing_sources = engine->changing_sources;
+      if (!changing_sources) {
+        // Allocates internally, which the measured reverb avoids
+        AllowAllocationScope allow_allocation_scope;
+        engine->environment->ProcessVirtualAmbisonicReverb(buffer_reverb.left, buffer_reverb.right);
+      }
+      engine->rendering_reverb = false;
+      if (changing_sources) {
+        return;
+      }
+    } else {
+      return;
+    }
+
+    if (buffer_reverb.left.size() >= frame_size) {
+      for (int frame = 0; frame < frame_size; frame++) {
+        outLeft[frame] += buffer_reverb.left[frame];
+        outRight[frame] += buffer_reverb.right[frame];
       }
-      mutex_.unlock();
     }
   }
 }
@@ -510,23 +1257,45 @@ void AudioRenderer<T>::renderFallback(
     T *outLeft, // NOLINT(bugprone-easily-swappable-parameters)
     T *outRight,
     std::size_t frame_size,
-    std::optional<DigitalStage::Audio::VolumeInfo<T>> volume_info) {
-  if (volume_info) {
-    for (
-        int frame = 0;
-        frame < frame_size;
-        frame++) {
-      outLeft[frame] += (input[frame] * volume_info->first);
-      outRight[frame] += (input[frame] * volume_info->first);
+    std::pair<T, T> gain) {
+  // Just mixing
+  const T gain_step = (gain.second - gain.first) / static_cast<T>(frame_size);
+  for (std::size_t frame = 0; frame < frame_size; frame++) {
+    const auto sample = input[frame] * (gain.first + gain_step * static_cast<T>(frame + 1));
+    outLeft[frame] += sample;
+    outRight[frame] += sample;
+  }
+}
+
+template<class T>
+void AudioRenderer<T>::addTrackStates(std::size_t track_count) {
+  if (track_states_.read()->size() >= track_count) {
+    return;
+  }
+  track_states_.update([track_count](TrackStates &track_states) {
+    while (track_states.size() < track_count) {
+      track_states.push_back(std::make_shared<TrackState>());
     }
-  } else {
-    for (
-        int frame = 0;
-        frame < frame_size;
-        frame++) {
-// Just mixing
-      outLeft[frame] += input[frame];
-      outRight[frame] += input[frame];
+  });
+}
+
+template<class T>
+void AudioRenderer<T>::refreshGains() {
+  while (is_refreshing_gains_) {
+    // Handles are dense and never reused, so the gains of all tracks ever seen fit into one array
+    const auto track_count = track_interner_->size();
+    Gains gains(track_count);
+    for (TrackHandle audio_track = 0; audio_track < track_count; audio_track++) {
+      gains[audio_track] = audio_mixer_->getGain(track_interner_->getId(audio_track));
+    }
+    bool changed;
+    {
+      auto current = gains_.read();
+      changed = *current != gains;
     }
+    if (changed) {
+      gains_.publish(std::make_unique<Gains>(std::move(gains)));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
   }
-}
\ No newline at end of file
+}
@@ -0,0 +1,322 @@
+#include "ChannelKernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define DS_KERNELS_SSE2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define DS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define DS_TARGET_AVX2
+#endif
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define DS_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+using DeinterleaveKernel = void (*)(const float *, std::size_t, float *const *, std::size_t);
+using InterleaveKernel = void (*)(const float *const *, std::size_t, float *, std::size_t);
+using LevelKernel = SignalLevel (*)(const float *, std::size_t);
+
+struct Kernels {
+  DeinterleaveKernel deinterleave;
+  InterleaveKernel interleave;
+  LevelKernel level;
+  const char *name;
+};
+
+SignalLevel toLevel(float peak, float energy, std::size_t frame_count) {
+  return {peak, frame_count > 0 ? std::sqrt(energy / static_cast<float>(frame_count)) : 0.0f};
+}
+
+[[maybe_unused]] SignalLevel measureLevelScalar(const float *input, std::size_t frame_count) {
+  float peak = 0;
+  float energy = 0;
+  for (std::size_t frame = 0; frame < frame_count; frame++) {
+    peak = std::max(peak, std::abs(input[frame]));
+    energy += input[frame] * input[frame];
+  }
+  return toLevel(peak, energy, frame_count);
+}
+
+[[maybe_unused]] void deinterleaveScalar(const float *input, std::size_t channel_count, float *const *outputs,
+                                         std::size_t frame_count) {
+  for (std::size_t channel = 0; channel < channel_count; channel++) {
+    if (float *output = outputs[channel]) {
+      const float *sample = &input[channel];
+      for (std::size_t frame = 0; frame < frame_count; frame++) {
+        output[frame] = *sample;
+        sample += channel_count;
+      }
+    }
+  }
+}
+
+[[maybe_unused]] void interleaveScalar(const float *const *inputs, std::size_t channel_count, float *output,
+                                       std::size_t frame_count) {
+  for (std::size_t frame = 0; frame < frame_count; frame++) {
+    for (std::size_t channel = 0; channel < channel_count; channel++) {
+      *output++ = inputs[channel] ? inputs[channel][frame] : 0.0f;
+    }
+  }
+}
+
+/**
+ * Shared loops of the 128 bit implementations: blocks of 4 channels x 4 frames are converted with a 4x4 transpose,
+ * the remaining frames and channels (odd channel counts) fall back to scalar code.
+ */
+template<class Ops>
+void deinterleaveTransposed(const float *input, std::size_t channel_count, float *const *outputs,
+                            std::size_t frame_count) {
+  std::size_t channel = 0;
+  for (; channel + 4 <= channel_count; channel += 4) {
+    float *const *out = &outputs[channel];
+    if (!out[0] && !out[1] && !out[2] && !out[3]) {
+      continue;
+    }
+    std::size_t frame = 0;
+    for (; frame + 4 <= frame_count; frame += 4) {
+      const float *row = &input[frame * channel_count + channel];
+      auto r0 = Ops::load(row);
+      auto r1 = Ops::load(row + channel_count);
+      auto r2 = Ops::load(row + 2 * channel_count);
+      auto r3 = Ops::load(row + 3 * channel_count);
+      Ops::transpose(r0, r1, r2, r3);
+      if (out[0]) Ops::store(&out[0][frame], r0);
+      if (out[1]) Ops::store(&out[1][frame], r1);
+      if (out[2]) Ops::store(&out[2][frame], r2);
+      if (out[3]) Ops::store(&out[3][frame], r3);
+    }
+    for (; frame < frame_count; frame++) {
+      for (std::size_t i = 0; i < 4; i++) {
+        if (out[i]) {
+          out[i][frame] = input[frame * channel_count + channel + i];
+        }
+      }
+    }
+  }
+  // Strided scalar copy of the last (up to 3) channels
+  for (; channel < channel_count; channel++) {
+    if (float *output = outputs[channel]) {
+      for (std::size_t frame = 0; frame < frame_count; frame++) {
+        output[frame] = input[frame * channel_count + channel];
+      }
+    }
+  }
+}
+
+template<class Ops>
+void interleaveTransposed(const float *const *inputs, std::size_t channel_count, float *output,
+                          std::size_t frame_count) {
+  std::size_t channel = 0;
+  for (; channel + 4 <= channel_count; channel += 4) {
+    const float *const *in = &inputs[channel];
+    std::size_t frame = 0;
+    for (; frame + 4 <= frame_count; frame += 4) {
+      auto r0 = in[0] ? Ops::load(&in[0][frame]) : Ops::zero();
+      auto r1 = in[1] ? Ops::load(&in[1][frame]) : Ops::zero();
+      auto r2 = in[2] ? Ops::load(&in[2][frame]) : Ops::zero();
+      auto r3 = in[3] ? Ops::load(&in[3][frame]) : Ops::zero();
+      Ops::transpose(r0, r1, r2, r3);
+      float *row = &output[frame * channel_count + channel];
+      Ops::store(row, r0);
+      Ops::store(row + channel_count, r1);
+      Ops::store(row + 2 * channel_count, r2);
+      Ops::store(row + 3 * channel_count, r3);
+    }
+    for (; frame < frame_count; frame++) {
+      for (std::size_t i = 0; i < 4; i++) {
+        output[frame * channel_count + channel + i] = in[i] ? in[i][frame] : 0.0f;
+      }
+    }
+  }
+  for (; channel < channel_count; channel++) {
+    const float *input = inputs[channel];
+    for (std::size_t frame = 0; frame < frame_count; frame++) {
+      output[frame * channel_count + channel] = input ? input[frame] : 0.0f;
+    }
+  }
+}
+
+#ifdef DS_KERNELS_SSE2
+struct Sse2Ops {
+  static inline __m128 load(const float *data) { return _mm_loadu_ps(data); }
+  static inline void store(float *data, __m128 value) { _mm_storeu_ps(data, value); }
+  static inline __m128 zero() { return _mm_setzero_ps(); }
+  static inline void transpose(__m128 &r0, __m128 &r1, __m128 &r2, __m128 &r3) {
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+  }
+};
+
+void deinterleaveSse2(const float *input, std::size_t channel_count, float *const *outputs, std::size_t frame_count) {
+  deinterleaveTransposed<Sse2Ops>(input, channel_count, outputs, frame_count);
+}
+
+void interleaveSse2(const float *const *inputs, std::size_t channel_count, float *output, std::size_t frame_count) {
+  interleaveTransposed<Sse2Ops>(inputs, channel_count, output, frame_count);
+}
+
+/**
+ * Picks single channels out of wide interfaces with gathers, which beats transposing whole blocks
+ * when only a few of many channels are selected. Dense selections use the transposing loop.
+ */
+DS_TARGET_AVX2 void deinterleaveAvx2(const float *input, std::size_t channel_count, float *const *outputs,
+                                     std::size_t frame_count) {
+  std::size_t num_selected = 0;
+  for (std::size_t channel = 0; channel < channel_count; channel++) {
+    num_selected += outputs[channel] ? 1 : 0;
+  }
+  if (channel_count < 8 || num_selected * 4 > channel_count) {
+    deinterleaveTransposed<Sse2Ops>(input, channel_count, outputs, frame_count);
+    return;
+  }
+  const auto stride = static_cast<int>(channel_count);
+  const __m256i index = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(stride));
+  for (std::size_t channel = 0; channel < channel_count; channel++) {
+    float *output = outputs[channel];
+    if (!output) {
+      continue;
+    }
+    std::size_t frame = 0;
+    for (; frame + 8 <= frame_count; frame += 8) {
+      _mm256_storeu_ps(&output[frame], _mm256_i32gather_ps(&input[frame * channel_count + channel], index, 4));
+    }
+    for (; frame < frame_count; frame++) {
+      output[frame] = input[frame * channel_count + channel];
+    }
+  }
+}
+
+SignalLevel measureLevelSse2(const float *input, std::size_t frame_count) {
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 peak = _mm_setzero_ps();
+  __m128 energy = _mm_setzero_ps();
+  std::size_t frame = 0;
+  for (; frame + 4 <= frame_count; frame += 4) {
+    const __m128 samples = _mm_loadu_ps(&input[frame]);
+    peak = _mm_max_ps(peak, _mm_andnot_ps(sign, samples));
+    energy = _mm_add_ps(energy, _mm_mul_ps(samples, samples));
+  }
+  alignas(16) float peaks[4];
+  alignas(16) float energies[4];
+  _mm_store_ps(peaks, peak);
+  _mm_store_ps(energies, energy);
+  float max = std::max(std::max(peaks[0], peaks[1]), std::max(peaks[2], peaks[3]));
+  float sum = (energies[0] + energies[1]) + (energies[2] + energies[3]);
+  for (; frame < frame_count; frame++) {
+    max = std::max(max, std::abs(input[frame]));
+    sum += input[frame] * input[frame];
+  }
+  return toLevel(max, sum, frame_count);
+}
+
+bool hasAvx2() {
+#if defined(__GNUC__) || defined(__clang__)
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  if (info[0] < 7) {
+    return false;
+  }
+  __cpuid(info, 1);
+  const bool os_saves_ymm = (info[2] & (1 << 27)) != 0 && (info[2] & (1 << 28)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+  __cpuidex(info, 7, 0);
+  return os_saves_ymm && (info[1] & (1 << 5)) != 0;
+#else
+  return false;
+#endif
+}
+#endif
+
+#ifdef DS_KERNELS_NEON
+struct NeonOps {
+  static inline float32x4_t load(const float *data) { return vld1q_f32(data); }
+  static inline void store(float *data, float32x4_t value) { vst1q_f32(data, value); }
+  static inline float32x4_t zero() { return vdupq_n_f32(0.0f); }
+  static inline void transpose(float32x4_t &r0, float32x4_t &r1, float32x4_t &r2, float32x4_t &r3) {
+    const float32x4x2_t r02 = vzipq_f32(r0, r2);
+    const float32x4x2_t r13 = vzipq_f32(r1, r3);
+    const float32x4x2_t low = vzipq_f32(r02.val[0], r13.val[0]);
+    const float32x4x2_t high = vzipq_f32(r02.val[1], r13.val[1]);
+    r0 = low.val[0];
+    r1 = low.val[1];
+    r2 = high.val[0];
+    r3 = high.val[1];
+  }
+};
+
+void deinterleaveNeon(const float *input, std::size_t channel_count, float *const *outputs, std::size_t frame_count) {
+  deinterleaveTransposed<NeonOps>(input, channel_count, outputs, frame_count);
+}
+
+void interleaveNeon(const float *const *inputs, std::size_t channel_count, float *output, std::size_t frame_count) {
+  interleaveTransposed<NeonOps>(inputs, channel_count, output, frame_count);
+}
+
+SignalLevel measureLevelNeon(const float *input, std::size_t frame_count) {
+  float32x4_t peak = vdupq_n_f32(0.0f);
+  float32x4_t energy = vdupq_n_f32(0.0f);
+  std::size_t frame = 0;
+  for (; frame + 4 <= frame_count; frame += 4) {
+    const float32x4_t samples = vld1q_f32(&input[frame]);
+    peak = vmaxq_f32(peak, vabsq_f32(samples));
+    energy = vmlaq_f32(energy, samples, samples);
+  }
+  float peaks[4];
+  float energies[4];
+  vst1q_f32(peaks, peak);
+  vst1q_f32(energies, energy);
+  float max = std::max(std::max(peaks[0], peaks[1]), std::max(peaks[2], peaks[3]));
+  float sum = (energies[0] + energies[1]) + (energies[2] + energies[3]);
+  for (; frame < frame_count; frame++) {
+    max = std::max(max, std::abs(input[frame]));
+    sum += input[frame] * input[frame];
+  }
+  return toLevel(max, sum, frame_count);
+}
+#endif
+
+Kernels selectKernels() {
+#if defined(DS_KERNELS_SSE2)
+  if (hasAvx2()) {
+    return {&deinterleaveAvx2, &interleaveSse2, &measureLevelSse2, "AVX2"};
+  }
+  return {&deinterleaveSse2, &interleaveSse2, &measureLevelSse2, "SSE2"};
+#elif defined(DS_KERNELS_NEON)
+  return {&deinterleaveNeon, &interleaveNeon, &measureLevelNeon, "NEON"};
+#else
+  return {&deinterleaveScalar, &interleaveScalar, &measureLevelScalar, "scalar"};
+#endif
+}
+
+const Kernels &getKernels() {
+  static const Kernels kernels = selectKernels();
+  return kernels;
+}
+}
+
+void deinterleave(const float *input, std::size_t channel_count, float *const *outputs, std::size_t frame_count) {
+  getKernels().deinterleave(input, channel_count, outputs, frame_count);
+}
+
+void interleave(const float *const *inputs, std::size_t channel_count, float *output, std::size_t frame_count) {
+  getKernels().interleave(inputs, channel_count, output, frame_count);
+}
+
+SignalLevel measureLevel(const float *input, std::size_t frame_count) {
+  return getKernels().level(input, frame_count);
+}
+
+const char *getChannelKernelsName() {
+  return getKernels().name;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+
+/**
+ * Conversion between interleaved device buffers and planar channel buffers, and level measurement of planar buffers.
+ *
+ * Both directions take one pointer per device channel, so any selection of channels can be converted in one pass:
+ * a nullptr output skips that channel when deinterleaving, a nullptr input writes silence when interleaving.
+ * The implementation (AVX2, SSE2, NEON or plain C++) is picked once at runtime, all of them are realtime safe.
+ */
+
+/**
+ * Copies the channels of an interleaved buffer into planar buffers.
+ * @param input frame_count frames of channel_count interleaved samples
+ * @param outputs channel_count planar buffers of frame_count samples, nullptr to skip a channel
+ */
+void deinterleave(const float *input, std::size_t channel_count, float *const *outputs, std::size_t frame_count);
+
+/**
+ * Writes planar buffers into an interleaved buffer.
+ * @param inputs channel_count planar buffers of frame_count samples, nullptr to write silence
+ * @param output frame_count frames of channel_count interleaved samples
+ */
+void interleave(const float *const *inputs, std::size_t channel_count, float *output, std::size_t frame_count);
+
+struct SignalLevel {
+  float peak;  // absolute
+  float rms;
+};
+
+/**
+ * Measures peak and RMS of a planar buffer in one pass.
+ */
+SignalLevel measureLevel(const float *input, std::size_t frame_count);
+
+/**
+ * @return name of the selected implementation, e.g. for logging
+ */
+const char *getChannelKernelsName();
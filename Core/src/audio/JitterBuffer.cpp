@@ -0,0 +1,374 @@
+#include "JitterBuffer.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+// Length of the crossfade used when dropping, inserting or concealing
+constexpr std::size_t kCrossfade = 64;
+// Maximum number of frames dropped or inserted per block
+constexpr std::size_t kMaxAdjustment = 32;
+// Length of the period repeated while concealing
+constexpr std::size_t kConcealPeriod = 256;
+// Time until a concealed signal has decayed by 60 dB
+constexpr double kConcealDecaySeconds = 0.05;
+// Weight of the newest value in the smoothed fill level
+constexpr double kFillSmoothing = 0.05;
+// Jumps of more buffer lengths than this are a new stream of the sender, not loss or reordering
+constexpr std::size_t kRestartBuffers = 4;
+}
+
+JitterBuffer::JitterBuffer(std::size_t capacity, unsigned int sample_rate)
+    : buffer_(capacity),
+      sample_rate_(sample_rate),
+      producer_history_(kConcealPeriod),
+      gap_(kMaxBlockSize),
+      scratch_(kMaxBlockSize + kMaxAdjustment),
+      history_(kConcealPeriod),
+      target_fill_(0) {
+  for (auto &pending: pending_) {
+    pending.data.resize(kMaxBlockSize);
+  }
+}
+
+void JitterBuffer::push(const float *data, std::size_t frame_count) {
+  measureArrival(frame_count);
+  enqueue(data, frame_count);
+  updateTarget(frame_count);
+}
+
+void JitterBuffer::push(const std::byte *payload, AudioSampleFormat format, std::size_t frame_count) {
+  measureArrival(frame_count);
+  enqueue(Samples{nullptr, payload, format}, frame_count);
+  updateTarget(frame_count);
+}
+
+void JitterBuffer::push(std::uint32_t sequence,
+                        std::uint32_t timestamp,
+                        const float *data,
+                        std::size_t frame_count) {
+  pushFramed(sequence, timestamp, Samples{data, nullptr, AudioSampleFormat::kFloat32}, frame_count);
+}
+
+void JitterBuffer::push(std::uint32_t sequence,
+                        std::uint32_t timestamp,
+                        const std::byte *payload,
+                        AudioSampleFormat format,
+                        std::size_t frame_count) {
+  pushFramed(sequence, timestamp, Samples{nullptr, payload, format}, frame_count);
+}
+
+void JitterBuffer::pushSilence(std::uint32_t sequence, std::uint32_t timestamp, std::size_t frame_count) {
+  pushFramed(sequence, timestamp, Samples{nullptr, nullptr, AudioSampleFormat::kFloat32}, frame_count);
+}
+
+void JitterBuffer::pushFramed(std::uint32_t sequence,
+                              std::uint32_t timestamp,
+                              const Samples &samples,
+                              std::size_t frame_count) {
+  frame_count = std::min(frame_count, kMaxBlockSize);
+  measureArrival(frame_count);
+  if (has_timeline_ && isRestart(sequence, timestamp, frame_count)) {
+    // The sender started its track over (e.g. with another sample rate or after a reboot), so follow the new
+    // timeline instead of dropping everything as late or concealing the whole jump
+    has_timeline_ = false;
+    for (auto &pending: pending_) {
+      pending.used = false;
+    }
+  }
+  if (!has_timeline_) {
+    has_timeline_ = true;
+    next_timestamp_ = timestamp;
+    next_sequence_ = sequence;
+  }
+  // Loss detection is based on the sequence numbers, placement on the timestamps
+  const auto sequence_distance = static_cast<std::int32_t>(sequence - next_sequence_);
+  if (sequence_distance >= 0) {
+    lost_packets_ += static_cast<std::size_t>(sequence_distance);
+    next_sequence_ = sequence + 1;
+  } else if (lost_packets_ > 0) {
+    // Arrived out of order, so it was not lost after all
+    lost_packets_--;
+    reordered_packets_++;
+  }
+  // Wrap-aware distance between the expected and the received timestamp
+  const auto distance = static_cast<std::int32_t>(timestamp - next_timestamp_);
+  if (distance < 0) {
+    // Duplicate or arrived after its frames have already been written
+    late_packets_++;
+    return;
+  }
+  if (distance == 0) {
+    enqueue(samples, frame_count);
+    next_timestamp_ += static_cast<std::uint32_t>(frame_count);
+    flushPending(false);
+  } else {
+    // Arrived early, keep it until the gap is filled or we have to give up waiting
+    auto slot = std::find_if(pending_.begin(), pending_.end(), [](const PendingPacket &p) { return !p.used; });
+    auto duplicate = std::find_if(pending_.begin(), pending_.end(), [timestamp](const PendingPacket &p) {
+      return p.used && p.timestamp == timestamp;
+    });
+    if (duplicate != pending_.end()) {
+      late_packets_++;
+    } else {
+      if (slot == pending_.end()) {
+        // All slots are in use, so declare the oldest gap as lost
+        flushPending(true);
+        slot = std::find_if(pending_.begin(), pending_.end(), [](const PendingPacket &p) { return !p.used; });
+      }
+      if (slot != pending_.end()) {
+        slot->used = true;
+        slot->timestamp = timestamp;
+        slot->frame_count = frame_count;
+        samples.copy(0, frame_count, slot->data.data());
+      }
+      // Do not wait longer than the reorder window worth of audio
+      if (distance > static_cast<std::int32_t>(kReorderSlots * frame_count)) {
+        flushPending(true);
+      }
+    }
+  }
+  updateTarget(frame_count);
+}
+
+bool JitterBuffer::isRestart(std::uint32_t sequence, std::uint32_t timestamp, std::size_t frame_count) const {
+  const auto max_frames = kRestartBuffers * buffer_.capacity();
+  const auto max_packets = max_frames / std::max<std::size_t>(frame_count, 1);
+  const auto timestamp_distance = static_cast<std::int32_t>(timestamp - next_timestamp_);
+  const auto sequence_distance = static_cast<std::int32_t>(sequence - next_sequence_);
+  return static_cast<std::size_t>(std::abs(static_cast<std::int64_t>(timestamp_distance))) > max_frames
+      || static_cast<std::size_t>(std::abs(static_cast<std::int64_t>(sequence_distance))) > max_packets;
+}
+
+bool JitterBuffer::flushPending(bool force) {
+  bool flushed = false;
+  while (true) {
+    PendingPacket *next = nullptr;
+    for (auto &pending: pending_) {
+      if (pending.used && (!next || static_cast<std::int32_t>(pending.timestamp - next->timestamp) < 0)) {
+        next = &pending;
+      }
+    }
+    if (!next) {
+      return flushed;
+    }
+    const auto distance = static_cast<std::int32_t>(next->timestamp - next_timestamp_);
+    if (distance < 0) {
+      // Has been overtaken by the timeline
+      next->used = false;
+      late_packets_++;
+      continue;
+    }
+    if (distance > 0) {
+      if (!force) {
+        return flushed;
+      }
+      // The frames in front of this packet are lost
+      concealGap(static_cast<std::size_t>(distance));
+      next_timestamp_ += static_cast<std::uint32_t>(distance);
+      force = false;
+    }
+    enqueue(next->data.data(), next->frame_count);
+    next_timestamp_ += static_cast<std::uint32_t>(next->frame_count);
+    next->used = false;
+    flushed = true;
+  }
+}
+
+void JitterBuffer::concealGap(std::size_t frame_count) {
+  // Repeat the last received period with a decaying gain, the consumer crossfades on its own
+  const auto decay = static_cast<float>(std::pow(0.001, 1.0 / (kConcealDecaySeconds * sample_rate_)));
+  frame_count = std::min(frame_count, buffer_.capacity());
+  float gain = 1.0f;
+  std::size_t position = 0;
+  while (frame_count > 0) {
+    const auto chunk = std::min(frame_count, gap_.size());
+    for (std::size_t frame = 0; frame < chunk; frame++) {
+      gap_[frame] = producer_history_[position] * gain;
+      position = (position + 1) % kConcealPeriod;
+      gain *= decay;
+    }
+    enqueue(gap_.data(), chunk);
+    frame_count -= chunk;
+  }
+}
+
+void JitterBuffer::Samples::copy(std::size_t offset, std::size_t count, float *out) const {
+  if (floats) {
+    std::memcpy(out, &floats[offset], count * sizeof(float));
+  } else if (!bytes) {
+    std::fill_n(out, count, 0.0f);
+  } else {
+    decodeSamples(format, &bytes[offset * getBytesPerSample(format)], count, out);
+  }
+}
+
+void JitterBuffer::enqueue(const float *data, std::size_t frame_count) {
+  enqueue(Samples{data, nullptr, AudioSampleFormat::kFloat32}, frame_count);
+}
+
+void JitterBuffer::enqueue(const Samples &samples, std::size_t frame_count) {
+  // Decode straight into the ring, there is no intermediate buffer
+  const auto written = buffer_.write(frame_count, [&samples](float *destination, std::size_t offset,
+                                                             std::size_t count) {
+    samples.copy(offset, count, destination);
+  });
+  if (written < frame_count) {
+    overruns_++;
+  }
+  if (frame_count >= kConcealPeriod) {
+    samples.copy(frame_count - kConcealPeriod, kConcealPeriod, producer_history_.data());
+  } else {
+    std::move(producer_history_.begin() + static_cast<std::ptrdiff_t>(frame_count), producer_history_.end(),
+              producer_history_.begin());
+    samples.copy(0, frame_count, &producer_history_[kConcealPeriod - frame_count]);
+  }
+}
+
+void JitterBuffer::measureArrival(std::size_t frame_count) {
+  const auto now = std::chrono::steady_clock::now();
+  if (last_packet_size_ > 0) {
+    const auto elapsed = std::chrono::duration<double>(now - last_arrival_).count() * sample_rate_;
+    const auto deviation = std::min(std::abs(elapsed - static_cast<double>(last_packet_size_)),
+                                    static_cast<double>(buffer_.capacity()));
+    // Interarrival jitter as described in RFC 3550, section 6.4.1
+    jitter_ += (deviation - jitter_) / 16.0;
+    jitter_ms_ = jitter_ * 1000.0 / sample_rate_;
+  }
+  last_arrival_ = now;
+  last_packet_size_ = frame_count;
+  packet_size_ = frame_count;
+}
+
+void JitterBuffer::updateTarget(std::size_t frame_count) {
+  // We need to survive one packet interval plus the consumer block, widened by the measured jitter
+  auto target = static_cast<std::size_t>(std::ceil(frame_count + block_size_ + 3.0 * jitter_));
+  auto upper_bound = buffer_.capacity() > frame_count ? buffer_.capacity() - frame_count : buffer_.capacity() / 2;
+  target_fill_ = std::min(target, upper_bound);
+}
+
+void JitterBuffer::pop(float *out, std::size_t frame_count) {
+  frame_count = std::min(frame_count, kMaxBlockSize);
+  block_size_ = frame_count;
+  const auto available = buffer_.size();
+  average_fill_ += (static_cast<double>(available) - average_fill_) * kFillSmoothing;
+
+  if (!primed_) {
+    // Prebuffer until we reached the target fill level again
+    if (available >= frame_count && available >= target_fill_) {
+      primed_ = true;
+    } else {
+      conceal(out, frame_count);
+      return;
+    }
+  }
+
+  if (available < frame_count) {
+    underruns_++;
+    auto num_read = buffer_.read(out, available);
+    remember(out, num_read);
+    conceal(&out[num_read], frame_count - num_read);
+    primed_ = false;
+    return;
+  }
+
+  if (concealing_) {
+    // Fade from the concealed signal back into the received one
+    float fade[kCrossfade];
+    const auto length = std::min(kCrossfade, frame_count);
+    conceal(fade, length);
+    readAdjusted(out, frame_count, available);
+    for (std::size_t frame = 0; frame < length; frame++) {
+      const auto weight = static_cast<float>(frame + 1) / static_cast<float>(length + 1);
+      out[frame] = fade[frame] * (1.0f - weight) + out[frame] * weight;
+    }
+    concealing_ = false;
+  } else {
+    readAdjusted(out, frame_count, available);
+  }
+  remember(out, frame_count);
+}
+
+std::size_t JitterBuffer::readAdjusted(float *out, std::size_t frame_count, std::size_t available) {
+  const auto target = static_cast<double>(target_fill_);
+  const auto hysteresis = std::max(static_cast<double>(frame_count), target / 4.0);
+  const auto adjustment = std::clamp<std::size_t>(frame_count / 8, 1, kMaxAdjustment);
+  const auto length = std::min(kCrossfade, frame_count / 2);
+
+  if (average_fill_ > target + hysteresis && available >= frame_count + adjustment && length > 0) {
+    // Too much latency: consume some more frames and crossfade over the gap
+    buffer_.read(scratch_.data(), frame_count + adjustment);
+    const auto start = frame_count - length;
+    std::memcpy(out, scratch_.data(), start * sizeof(float));
+    for (std::size_t i = 0; i < length; i++) {
+      const auto weight = static_cast<float>(i + 1) / static_cast<float>(length + 1);
+      out[start + i] = scratch_[start + i] * (1.0f - weight) + scratch_[start + i + adjustment] * weight;
+    }
+    dropped_frames_ += adjustment;
+    average_fill_ -= static_cast<double>(adjustment);
+    return frame_count + adjustment;
+  }
+  if (average_fill_ + hysteresis < target && frame_count >= 2 * adjustment + length && length > 0) {
+    // Not enough headroom: consume some less frames and crossfade over the repetition
+    buffer_.read(scratch_.data(), frame_count - adjustment);
+    const auto start = frame_count - adjustment - length;
+    std::memcpy(out, scratch_.data(), start * sizeof(float));
+    for (std::size_t i = 0; i < length; i++) {
+      const auto weight = static_cast<float>(i + 1) / static_cast<float>(length + 1);
+      out[start + i] = scratch_[start + i] * (1.0f - weight) + scratch_[start + i - adjustment] * weight;
+    }
+    for (std::size_t frame = start + length; frame < frame_count; frame++) {
+      out[frame] = scratch_[frame - adjustment];
+    }
+    inserted_frames_ += adjustment;
+    average_fill_ += static_cast<double>(adjustment);
+    return frame_count - adjustment;
+  }
+  return buffer_.read(out, frame_count);
+}
+
+void JitterBuffer::conceal(float *out, std::size_t frame_count) {
+  if (frame_count == 0) {
+    return;
+  }
+  if (!concealing_) {
+    concealing_ = true;
+    conceal_gain_ = 1.0f;
+  }
+  const auto decay = static_cast<float>(std::pow(0.001, 1.0 / (kConcealDecaySeconds * sample_rate_)));
+  for (std::size_t frame = 0; frame < frame_count; frame++) {
+    out[frame] = history_[history_position_] * conceal_gain_;
+    history_position_ = (history_position_ + 1) % kConcealPeriod;
+    conceal_gain_ *= decay;
+  }
+  concealed_frames_ += frame_count;
+}
+
+void JitterBuffer::remember(const float *out, std::size_t frame_count) {
+  // Keep the last period in playing order, so concealment continues where the output stopped
+  if (frame_count >= kConcealPeriod) {
+    std::memcpy(history_.data(), &out[frame_count - kConcealPeriod], kConcealPeriod * sizeof(float));
+    history_position_ = 0;
+    return;
+  }
+  std::memmove(history_.data(), &history_[frame_count], (kConcealPeriod - frame_count) * sizeof(float));
+  std::memcpy(&history_[kConcealPeriod - frame_count], out, frame_count * sizeof(float));
+  history_position_ = 0;
+}
+
+JitterBuffer::Statistics JitterBuffer::getStatistics() const {
+  return {
+      buffer_.size(),
+      target_fill_,
+      jitter_ms_,
+      underruns_,
+      overruns_,
+      concealed_frames_,
+      dropped_frames_,
+      inserted_frames_,
+      lost_packets_,
+      late_packets_,
+      reordered_packets_
+  };
+}
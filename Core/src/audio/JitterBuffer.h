@@ -0,0 +1,157 @@
+#pragma once
+
+#include "../utils/LockFreeRingBuffer.h"
+#include "../utils/WireCodec.h"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Adaptive jitter buffer for a single received audio track.
+ *
+ * The network thread pushes blocks as they arrive, the audio thread pops blocks of its own size.
+ * The producer measures the inter-arrival jitter of the packets and derives a target fill level from it,
+ * the consumer steers the actual fill level towards that target by dropping or inserting small crossfaded
+ * segments and conceals underruns by repeating the last played period with a decaying gain.
+ * Framed packets are placed by their capture timestamp: a few packets arriving early are held back until the
+ * gap in front of them is filled, lost packets are concealed and late or duplicated ones are dropped.
+ * A jump by more than a few buffer lengths starts a new timeline, as the sender restarted the track.
+ */
+class JitterBuffer {
+ public:
+  struct Statistics {
+    std::size_t fill;
+    std::size_t target_fill;
+    double jitter_ms;
+    std::size_t underruns;
+    std::size_t overruns;
+    std::size_t concealed_frames;
+    std::size_t dropped_frames;
+    std::size_t inserted_frames;
+    std::size_t lost_packets;
+    std::size_t late_packets;  // arrived after their frames had already been concealed, or duplicated
+    std::size_t reordered_packets;
+  };
+
+  /**
+   * @param capacity maximum number of buffered frames, this is the upper bound of the added latency
+   * @param sample_rate sample rate of the track, used to convert arrival times into frames
+   */
+  JitterBuffer(std::size_t capacity, unsigned int sample_rate);
+
+  /**
+   * Producer side, call this for each received packet without sequence information (legacy peers).
+   */
+  void push(const float *data, std::size_t frame_count);
+
+  /**
+   * Same as above, but decodes the wire data straight into the buffer.
+   */
+  void push(const std::byte *payload, AudioSampleFormat format, std::size_t frame_count);
+
+  /**
+   * Producer side, call this for each received framed packet.
+   * @param sequence sequence number of the packet
+   * @param timestamp capture timestamp of the first frame in samples
+   */
+  void push(std::uint32_t sequence, std::uint32_t timestamp, const float *data, std::size_t frame_count);
+
+  /**
+   * Same as above, but decodes the wire data straight into the buffer.
+   */
+  void push(std::uint32_t sequence,
+            std::uint32_t timestamp,
+            const std::byte *payload,
+            AudioSampleFormat format,
+            std::size_t frame_count);
+
+  /**
+   * Producer side, call this for each received silence packet, the frames are placed like those of any other packet.
+   */
+  void pushSilence(std::uint32_t sequence, std::uint32_t timestamp, std::size_t frame_count);
+
+  /**
+   * Consumer side, always fills exactly frame_count frames.
+   * Must not be called with more than kMaxBlockSize frames.
+   */
+  void pop(float *out, std::size_t frame_count);
+
+  [[nodiscard]] Statistics getStatistics() const;
+
+  static constexpr std::size_t kMaxBlockSize = 4096;
+  static constexpr std::size_t kReorderSlots = 4;
+
+ private:
+  struct PendingPacket {
+    bool used = false;
+    std::uint32_t timestamp = 0;
+    std::size_t frame_count = 0;
+    std::vector<float> data;
+  };
+
+  /**
+   * Samples of a received block, either host floats or still encoded wire data. Neither stands for silence.
+   */
+  struct Samples {
+    const float *floats;
+    const std::byte *bytes;
+    AudioSampleFormat format;
+
+    void copy(std::size_t offset, std::size_t count, float *out) const;
+  };
+
+  void pushFramed(std::uint32_t sequence, std::uint32_t timestamp, const Samples &samples, std::size_t frame_count);
+  /**
+   * Whether the packet jumps by more than a few buffer lengths, in time or in packets.
+   */
+  [[nodiscard]] bool isRestart(std::uint32_t sequence, std::uint32_t timestamp, std::size_t frame_count) const;
+  void measureArrival(std::size_t frame_count);
+  void enqueue(const Samples &samples, std::size_t frame_count);
+  void enqueue(const float *data, std::size_t frame_count);
+  void concealGap(std::size_t frame_count);
+  bool flushPending(bool force);
+  void updateTarget(std::size_t frame_count);
+  void conceal(float *out, std::size_t frame_count);
+  void remember(const float *out, std::size_t frame_count);
+  std::size_t readAdjusted(float *out, std::size_t frame_count, std::size_t available);
+
+  LockFreeRingBuffer<float> buffer_;
+  const unsigned int sample_rate_;
+
+  // Producer state
+  std::chrono::steady_clock::time_point last_arrival_;
+  std::size_t last_packet_size_ = 0;
+  double jitter_ = 0;  // in frames
+  bool has_timeline_ = false;
+  std::uint32_t next_timestamp_ = 0;
+  std::uint32_t next_sequence_ = 0;
+  std::array<PendingPacket, kReorderSlots> pending_;
+  std::vector<float> producer_history_;
+  std::vector<float> gap_;
+
+  // Consumer state
+  std::vector<float> scratch_;
+  std::vector<float> history_;
+  std::size_t history_position_ = 0;
+  float conceal_gain_ = 0;
+  bool concealing_ = false;
+  bool primed_ = false;
+  double average_fill_ = 0;
+
+  // Shared state and statistics
+  std::atomic<std::size_t> target_fill_;
+  std::atomic<std::size_t> block_size_{0};
+  std::atomic<std::size_t> packet_size_{0};
+  std::atomic<double> jitter_ms_{0};
+  std::atomic<std::size_t> underruns_{0};
+  std::atomic<std::size_t> overruns_{0};
+  std::atomic<std::size_t> concealed_frames_{0};
+  std::atomic<std::size_t> dropped_frames_{0};
+  std::atomic<std::size_t> inserted_frames_{0};
+  std::atomic<std::size_t> lost_packets_{0};
+  std::atomic<std::size_t> late_packets_{0};
+  std::atomic<std::size_t> reordered_packets_{0};
+};
@@ -0,0 +1,245 @@
+#include "LosslessCodec.h"
+#include "../utils/WireCodec.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+constexpr std::uint8_t kPlainOrder = 0xFF;
+constexpr std::size_t kMaxOrder = 3;
+// Unary quotients of this length are followed by the plain value instead
+constexpr int kEscapeLength = 32;
+constexpr int kEscapeBits = 28;
+constexpr float kScale = 8388607.0f;
+constexpr std::int64_t kMinSample = -8388608;
+constexpr std::int64_t kMaxSample = 8388607;
+
+class BitWriter {
+ public:
+  BitWriter(std::byte *out, std::size_t capacity) : out_(out), capacity_(capacity) {}
+
+  void write(std::uint32_t value, int count) {
+    if (overflow_) {
+      // The block is stored plain anyway
+      return;
+    }
+    accumulator_ = (accumulator_ << count) | (count < 32 ? value & ((1u << count) - 1) : value);
+    pending_ += count;
+    while (pending_ >= 8) {
+      pending_ -= 8;
+      if (position_ >= capacity_) {
+        overflow_ = true;
+        return;
+      }
+      out_[position_++] = static_cast<std::byte>((accumulator_ >> pending_) & 0xFF);
+    }
+  }
+
+  void writeRice(std::uint32_t value, int k) {
+    const auto quotient = value >> k;
+    if (quotient >= kEscapeLength) {
+      write(0xFFFFFFFF, kEscapeLength);
+      write(value, kEscapeBits);
+      return;
+    }
+    if (quotient > 0) {
+      write(0xFFFFFFFF, static_cast<int>(quotient));
+    }
+    write(0, 1);
+    if (k > 0) {
+      write(value, k);
+    }
+  }
+
+  std::size_t finish() {
+    if (!overflow_ && pending_ > 0) {
+      write(0, 8 - pending_);
+    }
+    return overflow_ ? 0 : position_;
+  }
+
+ private:
+  std::byte *out_;
+  const std::size_t capacity_;
+  std::size_t position_ = 0;
+  std::uint64_t accumulator_ = 0;
+  int pending_ = 0;
+  bool overflow_ = false;
+};
+
+class BitReader {
+ public:
+  BitReader(const std::byte *input, std::size_t size) : input_(input), size_(size) {}
+
+  bool read(int count, std::uint32_t &value) {
+    while (pending_ < count) {
+      if (position_ >= size_) {
+        return false;
+      }
+      accumulator_ = (accumulator_ << 8) | std::to_integer<std::uint8_t>(input_[position_++]);
+      pending_ += 8;
+    }
+    pending_ -= count;
+    value = static_cast<std::uint32_t>((accumulator_ >> pending_) & ((std::uint64_t{1} << count) - 1));
+    return true;
+  }
+
+  bool readRice(int k, std::uint32_t &value) {
+    std::uint32_t quotient = 0;
+    std::uint32_t bit;
+    while (true) {
+      if (!read(1, bit)) {
+        return false;
+      }
+      if (bit == 0) {
+        break;
+      }
+      if (++quotient == kEscapeLength) {
+        return read(kEscapeBits, value);
+      }
+    }
+    std::uint32_t remainder = 0;
+    if (k > 0 && !read(k, remainder)) {
+      return false;
+    }
+    value = (quotient << k) | remainder;
+    return true;
+  }
+
+ private:
+  const std::byte *input_;
+  const std::size_t size_;
+  std::size_t position_ = 0;
+  std::uint64_t accumulator_ = 0;
+  int pending_ = 0;
+};
+
+inline std::int32_t predict(const std::int32_t *samples, std::size_t index, std::size_t order) {
+  switch (order) {
+    case 1:return samples[index - 1];
+    case 2:return 2 * samples[index - 1] - samples[index - 2];
+    case 3:return 3 * samples[index - 1] - 3 * samples[index - 2] + samples[index - 3];
+    default:return 0;
+  }
+}
+
+inline std::uint32_t zigzag(std::int32_t value) {
+  return (static_cast<std::uint32_t>(value) << 1) ^ static_cast<std::uint32_t>(value >> 31);
+}
+
+inline std::int32_t unzigzag(std::uint32_t value) {
+  return static_cast<std::int32_t>(value >> 1) ^ -static_cast<std::int32_t>(value & 1);
+}
+
+void writeInt24(std::byte *out, std::int32_t value) {
+  const auto bits = static_cast<std::uint32_t>(value);
+  out[0] = static_cast<std::byte>(bits & 0xFF);
+  out[1] = static_cast<std::byte>((bits >> 8) & 0xFF);
+  out[2] = static_cast<std::byte>((bits >> 16) & 0xFF);
+}
+
+std::int32_t readInt24(const std::byte *in) {
+  return static_cast<std::int32_t>(std::to_integer<std::uint32_t>(in[0]) << 8
+                                       | std::to_integer<std::uint32_t>(in[1]) << 16
+                                       | std::to_integer<std::uint32_t>(in[2]) << 24) >> 8;
+}
+}
+
+std::size_t LosslessEncoder::getFrameSize() const {
+  return 0;
+}
+
+std::size_t LosslessEncoder::encode(const float *input, std::size_t frame_count, std::byte *out,
+                                    std::size_t capacity) {
+  const auto plain_size = 2 + frame_count * 3;
+  if (capacity < plain_size) {
+    return 0;
+  }
+  samples_.resize(frame_count);
+  for (std::size_t i = 0; i < frame_count; i++) {
+    samples_[i] = wire_codec_detail::toFixedPoint(input[i], kScale);
+  }
+
+  // Choose the predictor with the smallest residuals
+  const auto max_order = std::min(kMaxOrder, frame_count);
+  std::uint64_t sums[kMaxOrder + 1] = {0, 0, 0, 0};
+  for (std::size_t i = kMaxOrder; i < frame_count; i++) {
+    for (std::size_t order = 0; order <= max_order; order++) {
+      sums[order] += static_cast<std::uint64_t>(std::abs(samples_[i] - predict(samples_.data(), i, order)));
+    }
+  }
+  std::size_t order = 0;
+  for (std::size_t candidate = 1; candidate <= max_order; candidate++) {
+    if (sums[candidate] < sums[order]) {
+      order = candidate;
+    }
+  }
+
+  // Rice parameter from the mean of the mapped residuals
+  const auto residual_count = frame_count > kMaxOrder ? frame_count - kMaxOrder : 1;
+  const auto mean = 2 * sums[order] / residual_count;
+  int k = 0;
+  while (k < kEscapeBits - 1 && (std::uint64_t{1} << (k + 1)) <= mean) {
+    k++;
+  }
+
+  // Try to stay below the plain size, otherwise store plain samples
+  out[0] = static_cast<std::byte>(order);
+  out[1] = static_cast<std::byte>(k);
+  for (std::size_t i = 0; i < order; i++) {
+    writeInt24(&out[2 + i * 3], samples_[i]);
+  }
+  const auto header_size = 2 + order * 3;
+  BitWriter writer(&out[header_size], plain_size - header_size);
+  for (std::size_t i = order; i < frame_count; i++) {
+    writer.writeRice(zigzag(samples_[i] - predict(samples_.data(), i, order)), k);
+  }
+  const auto size = writer.finish();
+  if (size > 0 && header_size + size < plain_size) {
+    return header_size + size;
+  }
+  out[0] = static_cast<std::byte>(kPlainOrder);
+  out[1] = std::byte{0};
+  for (std::size_t i = 0; i < frame_count; i++) {
+    writeInt24(&out[2 + i * 3], samples_[i]);
+  }
+  return plain_size;
+}
+
+bool LosslessDecoder::decode(const std::byte *input, std::size_t size, float *out, std::size_t frame_count) {
+  if (size < 2) {
+    return false;
+  }
+  const auto order = std::to_integer<std::uint8_t>(input[0]);
+  const auto k = std::to_integer<int>(input[1]);
+  if (order == kPlainOrder) {
+    if (size != 2 + frame_count * 3) {
+      return false;
+    }
+    for (std::size_t i = 0; i < frame_count; i++) {
+      out[i] = static_cast<float>(readInt24(&input[2 + i * 3])) / kScale;
+    }
+    return true;
+  }
+  const auto header_size = 2 + static_cast<std::size_t>(order) * 3;
+  if (order > kMaxOrder || order > frame_count || k >= kEscapeBits || size < header_size) {
+    return false;
+  }
+  samples_.resize(frame_count);
+  for (std::size_t i = 0; i < order; i++) {
+    samples_[i] = readInt24(&input[2 + i * 3]);
+  }
+  BitReader reader(&input[header_size], size - header_size);
+  for (std::size_t i = order; i < frame_count; i++) {
+    std::uint32_t value;
+    if (!reader.readRice(k, value)) {
+      return false;
+    }
+    // A corrupt packet may carry any residual, keep the samples at 24 bit so the predictor never overflows
+    const auto sample = static_cast<std::int64_t>(predict(samples_.data(), i, order)) + unzigzag(value);
+    samples_[i] = static_cast<std::int32_t>(std::clamp<std::int64_t>(sample, kMinSample, kMaxSample));
+  }
+  for (std::size_t i = 0; i < frame_count; i++) {
+    out[i] = static_cast<float>(samples_[i]) / kScale;
+  }
+  return true;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "AudioCodec.h"
+
+/**
+ * Lossless coder for mono blocks at 24 bit resolution.
+ *
+ * Each block is quantized to 24 bit (exactly like the int24 wire format), predicted with the best of the
+ * fixed polynomial predictors of order 0 to 3 and the residuals are stored as Rice codes.
+ * Blocks are independent of each other, so a lost packet never affects the following ones.
+ * Blocks that do not compress (e.g. white noise) are stored as plain int24.
+ *
+ * Layout: uint8 order (0xFF = plain int24), uint8 rice parameter, order warm-up samples as int24, residuals
+ */
+class LosslessEncoder : public AudioEncoder {
+ public:
+  [[nodiscard]] std::size_t getFrameSize() const override;
+  std::size_t encode(const float *input, std::size_t frame_count, std::byte *out, std::size_t capacity) override;
+
+ private:
+  std::vector<std::int32_t> samples_;
+};
+
+class LosslessDecoder : public AudioDecoder {
+ public:
+  bool decode(const std::byte *input, std::size_t size, float *out, std::size_t frame_count) override;
+
+ private:
+  std::vector<std::int32_t> samples_;
+};
@@ -3,10 +3,14 @@
 //
 
 #include "MiniAudioIO.h"
+#include "ChannelKernels.h"
 #include "../utils/miniaudio.h"
 #include <plog/Log.h>
+#include <algorithm>
 
-MiniAudioIO::MiniAudioIO(std::shared_ptr<DigitalStage::Api::Client> client) : AudioIO(std::move(client)) {
+MiniAudioIO::MiniAudioIO(std::shared_ptr<DigitalStage::Api::Client> client,
+                         std::shared_ptr<TrackInterner> track_interner)
+    : AudioIO(std::move(client), std::move(track_interner)) {
   PLOGD << "MiniAudioIO::MiniAudioIO";
 }
 
@@ -15,6 +19,9 @@ MiniAudioIO::~MiniAudioIO() {
   ma_device_uninit(&input_device_);
   ma_device_uninit(&output_device_);
   ma_context_uninit(&context_);
+  if (has_enumeration_context_) {
+    ma_context_uninit(&enumeration_context_);
+  }
 }
 
 void MiniAudioIO::setAudioDriver(const std::string &audio_driver) {
@@ -65,20 +72,38 @@ void MiniAudioIO::setInputSoundCard(const DigitalStage::Types::SoundCard &sound_
         [](ma_device *pDevice, void *pOutput, const void *pInput, ma_uint32 frame_count) {
           auto context = static_cast<MiniAudioIO *>(pDevice->pUserData);
           const ma_uint32 channel_count = pDevice->capture.channels;
+          const auto chunk_size = static_cast<ma_uint32>(context->capture_bus_size_);
+          const auto *input = static_cast<const float *>(pInput);
+          auto &targets = context->capture_targets_;
+          (void) pOutput;
+          if (chunk_size == 0 || targets.size() != channel_count) {
+            return;
+          }
+          // Deinterleave only the published channels into the planar capture bus
+          std::fill(targets.begin(), targets.end(), nullptr);
           for (const auto &item: context->input_channel_mapping_) {
-            float buf[frame_count];
-            for (int frame = 0; frame < frame_count; frame++) {
-              buf[frame] = ((float *) pInput)[frame * channel_count + item.first];
+            if (item.first < channel_count) {
+              targets[item.first] = &context->capture_bus_[item.first * chunk_size];
+            }
+          }
+          for (ma_uint32 offset = 0; offset < frame_count; offset += chunk_size) {
+            const auto chunk = std::min(chunk_size, frame_count - offset);
+            deinterleave(&input[static_cast<std::size_t>(offset) * channel_count], channel_count, targets.data(), chunk);
+            for (const auto &item: context->input_channel_mapping_) {
+              if (item.first < channel_count) {
+                context->onCapture(item.second, targets[item.first], chunk);
+              }
             }
-            context->onCapture(item.second, (float *) buf, frame_count);
-            //context->onCaptureCallback(item.second, buf, frame_count);
           }
-          (void) pOutput;
         };
     ma_result result = ma_device_init(nullptr, &input_device_config, &input_device_);
     if (result != MA_SUCCESS) {
       throw std::runtime_error("Failed to initialize capture device. Error code " + std::to_string(result));
     }
+    capture_bus_size_ = std::max<std::size_t>(input_device_.capture.internalPeriodSizeInFrames, sound_card.periodSize);
+    capture_bus_.assign(capture_bus_size_ * input_device_.capture.channels, 0.0f);
+    capture_targets_.assign(input_device_.capture.channels, nullptr);
+    onStreamConfigured(input_device_.sampleRate, capture_bus_size_, 0);
     if (start) {
       startSending();
     }
@@ -93,10 +118,12 @@ void MiniAudioIO::setOutputSoundCard(const DigitalStage::Types::SoundCard &sound
 
     // Map channels (enable/disable)
     output_channels_.fill(false);
+    output_channel_map_.fill(-1);
     num_output_channels_ = 0;
     for (auto i = 0; i < sound_card.channels.size(); i++) {
       if (sound_card.channels.at(i).active) {
         output_channels_[i] = true;
+        output_channel_map_[i] = static_cast<int>(num_output_channels_);
         num_output_channels_++;
       }
     }
@@ -122,30 +149,35 @@ void MiniAudioIO::setOutputSoundCard(const DigitalStage::Types::SoundCard &sound
           // We know the output channel mapping, so only read from the enabled channels
           auto context = static_cast<MiniAudioIO *>(pDevice->pUserData);
           const ma_uint32 channel_count = pDevice->playback.channels;
-
-          auto **buff = (float **) malloc(context->num_output_channels_ * sizeof(float *));
-          for (int output_channel = 0; output_channel < context->num_output_channels_; output_channel++) {
-            buff[output_channel] = (float *) malloc(frame_count * sizeof(float));
+          const auto chunk_size = static_cast<ma_uint32>(context->getOutputBusSize());
+          auto *output = static_cast<float *>(pOutput);
+          (void) pInput;
+          if (chunk_size == 0 || context->playback_sources_.size() != channel_count) {
+            std::fill_n(output, static_cast<std::size_t>(frame_count) * channel_count, 0.0f);
+            return;
           }
-          context->onPlayback(buff, context->num_output_channels_, frame_count);
-          //context->onPlaybackCallback(buff, context->num_output_channels_, frame_count);
-
-          unsigned int relative_channel = 0;
-          for (ma_uint32 channel = 0; channel < channel_count; channel++) {
-            if (context->output_channels_[channel]) {
-              for (int frame = 0; frame < frame_count; frame++) {
-                ((float *) pOutput)[frame * channel_count + channel] = buff[relative_channel][frame];
-              }
-              relative_channel++;
+          // The device is interleaved, so render into the planar output bus and interleave it in a single pass.
+          // Should the device ever ask for more frames than announced, render in chunks of the bus size.
+          for (ma_uint32 offset = 0; offset < frame_count; offset += chunk_size) {
+            const auto chunk = std::min(chunk_size, frame_count - offset);
+            float **bus = context->getOutputBus(chunk);
+            context->onPlayback(bus, context->num_output_channels_, chunk);
+            auto &sources = context->playback_sources_;
+            for (ma_uint32 channel = 0; channel < sources.size(); channel++) {
+              const auto bus_channel = context->output_channel_map_[channel];
+              sources[channel] = bus_channel < 0 ? nullptr : bus[bus_channel];
             }
+            interleave(sources.data(), channel_count, &output[static_cast<std::size_t>(offset) * channel_count], chunk);
           }
-          free(buff);
-          (void) pInput;
         };
     ma_result result = ma_device_init(&context_, &output_device_config, &output_device_);
     if (result != MA_SUCCESS) {
       throw std::runtime_error("Failed to initialize playback device. Error code " + std::to_string(result));
     }
+    playback_sources_.assign(std::min<std::size_t>(output_device_.playback.channels, output_channel_map_.size()), nullptr);
+    configureStream(output_device_.sampleRate,
+                    std::max<std::size_t>(output_device_.playback.internalPeriodSizeInFrames, sound_card.periodSize),
+                    num_output_channels_);
     if (start) {
       startReceiving();
     }
@@ -196,17 +228,21 @@ std::vector<nlohmann::json> MiniAudioIO::enumerateDevices(const DigitalStage::Ap
 
   // Here we enumerate using miniaudio
   ma_result result;
-  ma_context context;
   ma_device_info *p_playback_device_infos;
   ma_uint32 playback_device_count;
   ma_device_info *p_capture_device_infos;
   ma_uint32 capture_device_count;
   ma_uint32 i_device;
 
-  if (ma_context_init(nullptr, 0, nullptr, &context) != MA_SUCCESS) {
-    PLOGE << "Failed to initialize context.";
-    return sound_cards;
+  // Initializing a context loads and probes all backends, so this is done once and reused by every enumeration
+  if (!has_enumeration_context_) {
+    if (ma_context_init(nullptr, 0, nullptr, &enumeration_context_) != MA_SUCCESS) {
+      PLOGE << "Failed to initialize context.";
+      return sound_cards;
+    }
+    has_enumeration_context_ = true;
   }
+  auto &context = enumeration_context_;
 
   result = ma_context_get_devices(&context,
                                   &pPlaybackDeviceInfos,
@@ -215,7 +251,6 @@ std::vector<nlohmann::json> MiniAudioIO::enumerateDevices(const DigitalStage::Ap
                                   &captureDeviceCount);
   if (result != MA_SUCCESS) {
     PLOGE << "Failed to retrieve device information.";
-    ma_context_uninit(&context);
     return sound_cards;
   }
 
@@ -237,7 +272,6 @@ std::vector<nlohmann::json> MiniAudioIO::enumerateDevices(const DigitalStage::Ap
       }
     } else {
       PLOGE << "Failed to retrieve detailed device information.";
-      ma_context_uninit(&context);
       return sound_cards;
     }
   }
@@ -258,13 +292,10 @@ std::vector<nlohmann::json> MiniAudioIO::enumerateDevices(const DigitalStage::Ap
         sound_cards.push_back(sound_card);
     } else {
       PLOGE << "Failed to retrieve detailed device information.";
-      ma_context_uninit(&context);
       return sound_cards;
     }
   }
 
-  ma_context_uninit(&context);
-
   return sound_cards;
 }
 
@@ -293,34 +324,34 @@ nlohmann::json convert_device_to_sound_card(ma_device_info  /*device_info*/,
       {"isDefault", device_info.isDefault == 1},
   };
 
-  // We have to initialize the device to get more details
-  ma_device_config device_config;
-  ma_device device;
-  device_config = ma_device_config_init(is_input ? ma_device_type_capture : ma_device_type_playback);
-  device_config.performanceProfile = ma_performance_profile_low_latency;
-  if (is_input) { // NOLINT(bugprone-branch-clone)
-    device_config.capture.pDeviceID = &device_info.id;
-  } else {
-    device_config.playback.pDeviceID = &device_info.id;
+  // The formats reported by ma_context_get_device_info are enough, initializing the device just to read them
+  // glitches running streams on some backends
+  ma_uint32 num_channels = 0;
+  ma_uint32 sample_rate = 0;
+  for (ma_uint32 i_format = 0; i_format < device_info.nativeDataFormatCount; i_format++) {
+    const auto &format = device_info.nativeDataFormats[i_format];
+    num_channels = std::max(num_channels, format.channels);
+    if (sample_rate == 0 || format.sampleRate == 48000) {
+      sample_rate = format.sampleRate;
+    }
   }
-  if (ma_device_init(nullptr, &device_config, &device) != MA_SUCCESS) {
-    PLOGE << "Failed to initialize device.";
+  if (num_channels == 0) {
+    PLOGE << "No native data format reported for device " << device_info.name;
     return {nullptr};
   }
 
   if (!existing) {
     sound_card["frameSize"] = 256;
-    sound_card["sampleRate"] = device.sampleRate;
-    sound_card["periodSize"] =
-        is_input ? device.capture.internalPeriodSizeInFrames : device.playback.internalPeriodSizeInFrames;
-    sound_card["numPeriods"] = is_input ? device.capture.internalPeriods : device.playback.internalPeriods;
+    // 0 = any rate, then the device follows the engine's default
+    sound_card["sampleRate"] = sample_rate > 0 ? sample_rate : 48000;
+    sound_card["periodSize"] = 256;
+    sound_card["numPeriods"] = 2;
   }
   sound_card["sampleRates"] = get_sample_rates(device_info);
   sound_card["online"] = true;
 
   std::vector<DigitalStage::Types::Channel> channels;
-  const ma_uint32 num_channels = is_input ? device.capture.channels : device.playback.channels;
-  for (int i = 0; i < numChannels; i++) {
+  for (ma_uint32 i = 0; i < num_channels; i++) {
     std::string label = "Kanal " + std::to_string(i + 1);
     if (existing && existing->channels.size() >= i) {
       channels.push_back(existing->channels[i]);
@@ -333,7 +364,5 @@ nlohmann::json convert_device_to_sound_card(ma_device_info  /*device_info*/,
   }
   sound_card["channels"] = channels;
 
-  ma_device_uninit(&device);
-
   return sound_card;
 }
\ No newline at end of file
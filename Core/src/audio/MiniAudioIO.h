@@ -10,7 +10,7 @@
 
 class MiniAudioIO : public AudioIO {
  public:
-  explicit MiniAudioIO(std::shared_ptr<DigitalStage::Api::Client> client);
+  MiniAudioIO(std::shared_ptr<DigitalStage::Api::Client> client, std::shared_ptr<TrackInterner> track_interner);
   ~MiniAudioIO() override;
  protected:
   std::vector<json> enumerateDevices(const DigitalStage::Api::Store &store) override;
@@ -28,8 +28,18 @@ class MiniAudioIO : public AudioIO {
   std::atomic<bool> initialized_{};
   std::atomic<unsigned int> num_output_channels_{};
   std::array<bool, 64> output_channels_{};
+  // Index into the output bus for each device channel, -1 for disabled channels
+  std::array<int, 64> output_channel_map_{};
+  // Reused by every callback, only resized while the devices are uninitialized
+  std::vector<const float *> playback_sources_;
+  std::vector<float> capture_bus_;
+  std::vector<float *> capture_targets_;
+  std::size_t capture_bus_size_{};
   ma_backend backend_;
   ma_context context_{};
+  // All backends, kept for enumerating the devices
+  ma_context enumeration_context_{};
+  bool has_enumeration_context_{};
   ma_device input_device_{};
   ma_device output_device_{};
 };
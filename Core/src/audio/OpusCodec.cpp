@@ -0,0 +1,90 @@
+#include "OpusCodec.h"
+#include <opus/opus.h>
+#include <plog/Log.h>
+#include <algorithm>
+
+namespace {
+// Largest packet a single Opus frame may produce
+constexpr std::size_t kMaxPacketSize = 1275;
+}
+
+bool OpusAudioEncoder::isSupportedSampleRate(unsigned int sample_rate) {
+  return sample_rate == 8000 || sample_rate == 12000 || sample_rate == 16000 || sample_rate == 24000
+      || sample_rate == 48000;
+}
+
+std::unique_ptr<OpusAudioEncoder> OpusAudioEncoder::create(unsigned int sample_rate,
+                                                           int bitrate,
+                                                           double frame_duration_ms) {
+  if (!isSupportedSampleRate(sample_rate)) {
+    PLOGW << "Opus does not support a sample rate of " << sample_rate;
+    return nullptr;
+  }
+  int error;
+  auto *encoder = opus_encoder_create(static_cast<opus_int32>(sample_rate), 1,
+                                      OPUS_APPLICATION_RESTRICTED_LOWDELAY, &error);
+  if (error != OPUS_OK) {
+    PLOGE << "Could not create Opus encoder: " << opus_strerror(error);
+    return nullptr;
+  }
+  if (bitrate > 0) {
+    opus_encoder_ctl(encoder, OPUS_SET_BITRATE(bitrate));
+  }
+  // Opus only knows 2.5, 5, 10, 20, 40 and 60 ms frames, anything above 10 ms defeats the purpose
+  double duration = 2.5;
+  if (frame_duration_ms >= 10) {
+    duration = 10;
+  } else if (frame_duration_ms >= 5) {
+    duration = 5;
+  }
+  const auto frame_size = static_cast<std::size_t>(sample_rate * duration / 1000.0);
+  return std::unique_ptr<OpusAudioEncoder>(new OpusAudioEncoder(encoder, frame_size));
+}
+
+OpusAudioEncoder::OpusAudioEncoder(OpusEncoder *encoder, std::size_t frame_size)
+    : encoder_(encoder), frame_size_(frame_size) {}
+
+OpusAudioEncoder::~OpusAudioEncoder() {
+  opus_encoder_destroy(encoder_);
+}
+
+std::size_t OpusAudioEncoder::getFrameSize() const {
+  return frame_size_;
+}
+
+std::size_t OpusAudioEncoder::encode(const float *input, std::size_t frame_count, std::byte *out,
+                                     std::size_t capacity) {
+  if (frame_count != frame_size_) {
+    return 0;
+  }
+  const auto result = opus_encode_float(encoder_, input, static_cast<int>(frame_count),
+                                        reinterpret_cast<unsigned char *>(out),
+                                        static_cast<opus_int32>(std::min(capacity, kMaxPacketSize)));
+  return result > 0 ? static_cast<std::size_t>(result) : 0;
+}
+
+std::unique_ptr<OpusAudioDecoder> OpusAudioDecoder::create(unsigned int sample_rate) {
+  if (!OpusAudioEncoder::isSupportedSampleRate(sample_rate)) {
+    PLOGW << "Opus does not support a sample rate of " << sample_rate;
+    return nullptr;
+  }
+  int error;
+  auto *decoder = opus_decoder_create(static_cast<opus_int32>(sample_rate), 1, &error);
+  if (error != OPUS_OK) {
+    PLOGE << "Could not create Opus decoder: " << opus_strerror(error);
+    return nullptr;
+  }
+  return std::unique_ptr<OpusAudioDecoder>(new OpusAudioDecoder(decoder));
+}
+
+OpusAudioDecoder::OpusAudioDecoder(OpusDecoder *decoder) : decoder_(decoder) {}
+
+OpusAudioDecoder::~OpusAudioDecoder() {
+  opus_decoder_destroy(decoder_);
+}
+
+bool OpusAudioDecoder::decode(const std::byte *input, std::size_t size, float *out, std::size_t frame_count) {
+  const auto result = opus_decode_float(decoder_, reinterpret_cast<const unsigned char *>(input),
+                                        static_cast<opus_int32>(size), out, static_cast<int>(frame_count), 0);
+  return result == static_cast<int>(frame_count);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "AudioCodec.h"
+
+struct OpusEncoder;
+struct OpusDecoder;
+
+/**
+ * Low delay lossy coding with Opus in restricted low delay mode (CELT only, no lookahead beyond the frame).
+ * Frames are 2.5, 5 or 10 ms long, so the encoder must be fed blocks of exactly getFrameSize() frames.
+ */
+class OpusAudioEncoder : public AudioEncoder {
+ public:
+  /**
+   * @return the encoder or nullptr if Opus does not support the sample rate
+   */
+  static std::unique_ptr<OpusAudioEncoder> create(unsigned int sample_rate, int bitrate, double frame_duration_ms);
+  static bool isSupportedSampleRate(unsigned int sample_rate);
+  ~OpusAudioEncoder() override;
+
+  [[nodiscard]] std::size_t getFrameSize() const override;
+  std::size_t encode(const float *input, std::size_t frame_count, std::byte *out, std::size_t capacity) override;
+
+ private:
+  OpusAudioEncoder(OpusEncoder *encoder, std::size_t frame_size);
+
+  OpusEncoder *encoder_;
+  const std::size_t frame_size_;
+};
+
+class OpusAudioDecoder : public AudioDecoder {
+ public:
+  static std::unique_ptr<OpusAudioDecoder> create(unsigned int sample_rate);
+  ~OpusAudioDecoder() override;
+
+  bool decode(const std::byte *input, std::size_t size, float *out, std::size_t frame_count) override;
+
+ private:
+  explicit OpusAudioDecoder(OpusDecoder *decoder);
+
+  OpusDecoder *decoder_;
+};
@@ -0,0 +1,238 @@
+#include "PartitionedConvolver.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define PARTITIONED_CONVOLVER_SSE
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define PARTITIONED_CONVOLVER_NEON
+#include <arm_neon.h>
+#endif
+
+namespace {
+constexpr double kPi = 3.14159265358979323846;
+
+bool isPowerOfTwo(std::size_t value) {
+  return value != 0 && (value & (value - 1)) == 0;
+}
+}
+
+RealFft::RealFft(std::size_t size)
+    : size_(size), half_(size / 2) {
+  if (size < 4 || !isPowerOfTwo(size)) {
+    throw std::runtime_error("FFT size must be a power of two of at least 4");
+  }
+  std::size_t bits = 0;
+  while ((std::size_t(1) << bits) < half_) {
+    bits++;
+  }
+  bit_reversed_.resize(half_);
+  for (std::size_t index = 0; index < half_; index++) {
+    std::size_t reversed = 0;
+    for (std::size_t bit = 0; bit < bits; bit++) {
+      reversed |= ((index >> bit) & 1) << (bits - 1 - bit);
+    }
+    bit_reversed_[index] = reversed;
+  }
+  cos_.resize(half_ / 2);
+  sin_.resize(half_ / 2);
+  for (std::size_t index = 0; index < half_ / 2; index++) {
+    cos_[index] = static_cast<float>(std::cos(2.0 * kPi * static_cast<double>(index) / static_cast<double>(half_)));
+    sin_[index] = static_cast<float>(std::sin(2.0 * kPi * static_cast<double>(index) / static_cast<double>(half_)));
+  }
+  split_cos_.resize(half_ + 1);
+  split_sin_.resize(half_ + 1);
+  for (std::size_t index = 0; index <= half_; index++) {
+    split_cos_[index] = static_cast<float>(std::cos(2.0 * kPi * static_cast<double>(index) / static_cast<double>(size)));
+    split_sin_[index] = static_cast<float>(std::sin(2.0 * kPi * static_cast<double>(index) / static_cast<double>(size)));
+  }
+  work_real_.resize(half_);
+  work_imag_.resize(half_);
+}
+
+void RealFft::forward(const float *input, float *real, float *imag) const {
+  // Even samples as real and odd samples as imaginary part of a complex signal of half the size
+  for (std::size_t index = 0; index < half_; index++) {
+    work_real_[index] = input[2 * index];
+    work_imag_[index] = input[2 * index + 1];
+  }
+  transform(work_real_.data(), work_imag_.data(), false);
+  for (std::size_t bin = 0; bin <= half_; bin++) {
+    const auto k = bin % half_;
+    const auto mirrored = (half_ - bin) % half_;
+    // Spectra of the even and odd samples
+    const float even_real = 0.5f * (work_real_[k] + work_real_[mirrored]);
+    const float even_imag = 0.5f * (work_imag_[k] - work_imag_[mirrored]);
+    const float odd_real = 0.5f * (work_imag_[k] + work_imag_[mirrored]);
+    const float odd_imag = -0.5f * (work_real_[k] - work_real_[mirrored]);
+    const float twiddle_real = split_cos_[bin];
+    const float twiddle_imag = -split_sin_[bin];
+    real[bin] = even_real + twiddle_real * odd_real - twiddle_imag * odd_imag;
+    imag[bin] = even_imag + twiddle_real * odd_imag + twiddle_imag * odd_real;
+  }
+}
+
+void RealFft::inverse(float *real, float *imag, float *output) const {
+  for (std::size_t bin = 0; bin < half_; bin++) {
+    const auto mirrored = half_ - bin;
+    const float even_real = 0.5f * (real[bin] + real[mirrored]);
+    const float even_imag = 0.5f * (imag[bin] - imag[mirrored]);
+    const float difference_real = 0.5f * (real[bin] - real[mirrored]);
+    const float difference_imag = 0.5f * (imag[bin] + imag[mirrored]);
+    const float twiddle_real = split_cos_[bin];
+    const float twiddle_imag = split_sin_[bin];
+    const float odd_real = difference_real * twiddle_real - difference_imag * twiddle_imag;
+    const float odd_imag = difference_real * twiddle_imag + difference_imag * twiddle_real;
+    work_real_[bin] = even_real - odd_imag;
+    work_imag_[bin] = even_imag + odd_real;
+  }
+  transform(work_real_.data(), work_imag_.data(), true);
+  const float scale = 1.0f / static_cast<float>(half_);
+  for (std::size_t index = 0; index < half_; index++) {
+    output[2 * index] = work_real_[index] * scale;
+    output[2 * index + 1] = work_imag_[index] * scale;
+  }
+}
+
+void RealFft::transform(float *real, float *imag, bool inverse) const {
+  for (std::size_t index = 0; index < half_; index++) {
+    const auto reversed = bit_reversed_[index];
+    if (index < reversed) {
+      std::swap(real[index], real[reversed]);
+      std::swap(imag[index], imag[reversed]);
+    }
+  }
+  for (std::size_t length = 2; length <= half_; length <<= 1) {
+    const auto span = length / 2;
+    const auto step = half_ / length;
+    for (std::size_t start = 0; start < half_; start += length) {
+      for (std::size_t offset = 0; offset < span; offset++) {
+        const float twiddle_real = cos_[offset * step];
+        const float twiddle_imag = inverse ? sin_[offset * step] : -sin_[offset * step];
+        const auto top = start + offset;
+        const auto bottom = top + span;
+        const float product_real = real[bottom] * twiddle_real - imag[bottom] * twiddle_imag;
+        const float product_imag = real[bottom] * twiddle_imag + imag[bottom] * twiddle_real;
+        real[bottom] = real[top] - product_real;
+        imag[bottom] = imag[top] - product_imag;
+        real[top] += product_real;
+        imag[top] += product_imag;
+      }
+    }
+  }
+}
+
+PartitionedConvolver::PartitionedConvolver(std::size_t block_size, std::size_t num_inputs, std::size_t num_outputs)
+    : block_size_(block_size),
+      bins_(block_size + 1),
+      num_inputs_(num_inputs),
+      num_outputs_(num_outputs),
+      num_partitions_(0),
+      fft_(2 * block_size),
+      filters_(num_inputs * num_outputs),
+      delay_lines_(num_inputs),
+      head_(0),
+      windows_(num_inputs, std::vector<float>(2 * block_size, 0.0f)),
+      accumulator_{std::vector<float>(block_size + 1), std::vector<float>(block_size + 1)},
+      time_(2 * block_size) {
+}
+
+void PartitionedConvolver::setImpulseResponse(std::size_t input,
+                                              std::size_t output,
+                                              const float *impulse_response,
+                                              std::size_t length) {
+  if (input >= num_inputs_ || output >= num_outputs_) {
+    throw std::runtime_error("Invalid input or output of the convolver");
+  }
+  auto &filter = filters_[input * num_outputs_ + output];
+  const auto partitions = (length + block_size_ - 1) / block_size_;
+  filter.assign(partitions, Spectrum{std::vector<float>(bins_), std::vector<float>(bins_)});
+  std::vector<float> padded(2 * block_size_);
+  for (std::size_t partition = 0; partition < partitions; partition++) {
+    // Each partition is zero padded to the transform size, so the circular convolution of overlap-save is linear
+    const auto begin = partition * block_size_;
+    const auto count = std::min(block_size_, length - begin);
+    std::fill(padded.begin(), padded.end(), 0.0f);
+    std::copy(impulse_response + begin, impulse_response + begin + count, padded.begin());
+    fft_.forward(padded.data(), filter[partition].real.data(), filter[partition].imag.data());
+  }
+  if (partitions > num_partitions_) {
+    num_partitions_ = partitions;
+    for (auto &delay_line: delay_lines_) {
+      delay_line.assign(num_partitions_, Spectrum{std::vector<float>(bins_, 0.0f), std::vector<float>(bins_, 0.0f)});
+    }
+    head_ = 0;
+  }
+}
+
+void PartitionedConvolver::process(const float *const *inputs, float *const *outputs) {
+  if (num_partitions_ == 0) {
+    return;
+  }
+  head_ = (head_ + 1) % num_partitions_;
+  for (std::size_t input = 0; input < num_inputs_; input++) {
+    auto &window = windows_[input];
+    std::copy(window.begin() + static_cast<std::ptrdiff_t>(block_size_), window.end(), window.begin());
+    std::copy(inputs[input], inputs[input] + block_size_, window.begin() + static_cast<std::ptrdiff_t>(block_size_));
+    auto &spectrum = delay_lines_[input][head_];
+    fft_.forward(window.data(), spectrum.real.data(), spectrum.imag.data());
+  }
+  for (std::size_t output = 0; output < num_outputs_; output++) {
+    std::fill(accumulator_.real.begin(), accumulator_.real.end(), 0.0f);
+    std::fill(accumulator_.imag.begin(), accumulator_.imag.end(), 0.0f);
+    for (std::size_t input = 0; input < num_inputs_; input++) {
+      const auto &filter = filters_[input * num_outputs_ + output];
+      const auto &delay_line = delay_lines_[input];
+      for (std::size_t partition = 0; partition < filter.size(); partition++) {
+        // Partition p of the filter meets the input block from p blocks ago
+        const auto &spectrum = delay_line[(head_ + num_partitions_ - partition) % num_partitions_];
+        multiplyAccumulate(spectrum.real.data(), spectrum.imag.data(),
+                           filter[partition].real.data(), filter[partition].imag.data(),
+                           accumulator_.real.data(), accumulator_.imag.data(), bins_);
+      }
+    }
+    fft_.inverse(accumulator_.real.data(), accumulator_.imag.data(), time_.data());
+    // The first half is wrapped around by the circular convolution, only the second half is valid
+    for (std::size_t frame = 0; frame < block_size_; frame++) {
+      outputs[output][frame] += time_[block_size_ + frame];
+    }
+  }
+}
+
+void PartitionedConvolver::multiplyAccumulate(const float *x_real, const float *x_imag,
+                                              const float *h_real, const float *h_imag,
+                                              float *real, float *imag, std::size_t bins) {
+  std::size_t bin = 0;
+#if defined(PARTITIONED_CONVOLVER_SSE)
+  for (; bin + 4 <= bins; bin += 4) {
+    const __m128 xr = _mm_loadu_ps(x_real + bin);
+    const __m128 xi = _mm_loadu_ps(x_imag + bin);
+    const __m128 hr = _mm_loadu_ps(h_real + bin);
+    const __m128 hi = _mm_loadu_ps(h_imag + bin);
+    const __m128 product_real = _mm_sub_ps(_mm_mul_ps(xr, hr), _mm_mul_ps(xi, hi));
+    const __m128 product_imag = _mm_add_ps(_mm_mul_ps(xr, hi), _mm_mul_ps(xi, hr));
+    _mm_storeu_ps(real + bin, _mm_add_ps(_mm_loadu_ps(real + bin), product_real));
+    _mm_storeu_ps(imag + bin, _mm_add_ps(_mm_loadu_ps(imag + bin), product_imag));
+  }
+#elif defined(PARTITIONED_CONVOLVER_NEON)
+  for (; bin + 4 <= bins; bin += 4) {
+    const float32x4_t xr = vld1q_f32(x_real + bin);
+    const float32x4_t xi = vld1q_f32(x_imag + bin);
+    const float32x4_t hr = vld1q_f32(h_real + bin);
+    const float32x4_t hi = vld1q_f32(h_imag + bin);
+    float32x4_t accumulated_real = vld1q_f32(real + bin);
+    float32x4_t accumulated_imag = vld1q_f32(imag + bin);
+    accumulated_real = vmlsq_f32(vmlaq_f32(accumulated_real, xr, hr), xi, hi);
+    accumulated_imag = vmlaq_f32(vmlaq_f32(accumulated_imag, xr, hi), xi, hr);
+    vst1q_f32(real + bin, accumulated_real);
+    vst1q_f32(imag + bin, accumulated_imag);
+  }
+#endif
+  for (; bin < bins; bin++) {
+    real[bin] += x_real[bin] * h_real[bin] - x_imag[bin] * h_imag[bin];
+    imag[bin] += x_real[bin] * h_imag[bin] + x_imag[bin] * h_real[bin];
+  }
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * Real FFT of a power of two size, computed as complex FFT of half the size.
+ * Spectra are split into real and imaginary parts of size / 2 + 1 bins, so they can be multiplied with SIMD.
+ */
+class RealFft {
+ public:
+  explicit RealFft(std::size_t size);
+
+  [[nodiscard]] std::size_t getSize() const {
+    return size_;
+  }
+
+  void forward(const float *input, float *real, float *imag) const;
+  /**
+   * Inverse including the 1 / size scaling.
+   */
+  void inverse(float *real, float *imag, float *output) const;
+
+ private:
+  void transform(float *real, float *imag, bool inverse) const;
+
+  std::size_t size_;
+  std::size_t half_;
+  std::vector<std::size_t> bit_reversed_;
+  std::vector<float> cos_;  // twiddles of the half size complex FFT
+  std::vector<float> sin_;
+  std::vector<float> split_cos_;  // twiddles splitting the half size spectrum into the real spectrum
+  std::vector<float> split_sin_;
+  mutable std::vector<float> work_real_;
+  mutable std::vector<float> work_imag_;
+};
+
+/**
+ * Uniformly partitioned overlap-save convolution of several inputs with one impulse response per input and output.
+ *
+ * Every input is transformed once per block into a frequency domain delay line, each output multiplies and
+ * accumulates the delay lines of all inputs with its filter partitions in the frequency domain and needs a single
+ * inverse transform. The latency is one block, the cost grows with the impulse response length divided by the block
+ * size. Processing never allocates.
+ */
+class PartitionedConvolver {
+ public:
+  PartitionedConvolver(std::size_t block_size, std::size_t num_inputs, std::size_t num_outputs);
+
+  /**
+   * Sets the impulse response from the given input to the given output, only allowed before the first process().
+   */
+  void setImpulseResponse(std::size_t input, std::size_t output, const float *impulse_response, std::size_t length);
+
+  /**
+   * Convolves one block of every input and adds the result to every output.
+   */
+  void process(const float *const *inputs, float *const *outputs);
+
+  [[nodiscard]] std::size_t getBlockSize() const {
+    return block_size_;
+  }
+
+ private:
+  struct Spectrum {
+    std::vector<float> real;
+    std::vector<float> imag;
+  };
+  static void multiplyAccumulate(const float *x_real, const float *x_imag,
+                                 const float *h_real, const float *h_imag,
+                                 float *real, float *imag, std::size_t bins);
+
+  std::size_t block_size_;
+  std::size_t bins_;
+  std::size_t num_inputs_;
+  std::size_t num_outputs_;
+  std::size_t num_partitions_;
+  RealFft fft_;
+  std::vector<std::vector<Spectrum>> filters_;  // [input * num_outputs + output][partition]
+  std::vector<std::vector<Spectrum>> delay_lines_;  // [input][partition], ring buffer
+  std::size_t head_;  // partition of the delay lines holding the newest block
+  std::vector<std::vector<float>> windows_;  // [input], previous and current block
+  Spectrum accumulator_;
+  std::vector<float> time_;
+};
@@ -3,13 +3,21 @@
 //
 
 #include "RtAudioIO.h"
+#include "ChannelKernels.h"
 #include "../utils/cp1252_to_utf8.h"
+#include <algorithm>
+#include <chrono>
 #include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <future>
 #include <memory>
 #include <utility>
 #include <plog/Log.h>
 
-[[maybe_unused]] RtAudioIO::RtAudioIO(std::shared_ptr<DigitalStage::Api::Client> client) : AudioIO(std::move(client)), is_running_(true) {
+[[maybe_unused]] RtAudioIO::RtAudioIO(std::shared_ptr<DigitalStage::Api::Client> client,
+                                      std::shared_ptr<TrackInterner> track_interner)
+    : AudioIO(std::move(client), std::move(track_interner)), is_running_(true) {
 }
 
 RtAudioIO::~RtAudioIO() {
@@ -18,25 +26,122 @@ RtAudioIO::~RtAudioIO() {
   rt_audio_.reset();
 }
 
-std::vector<nlohmann::json> RtAudioIO::enumerateRtDevices(RtAudio::Api rt_api,
-                                                          const std::shared_ptr<DigitalStage::Api::Store>& store) {
-  PLOGD << "enumerateRtDevices";
-  auto sound_cards = std::vector<nlohmann::json>();
+std::vector<RtAudioIO::ProbedDevice> RtAudioIO::probeDevices(RtAudio::Api rt_api) {
+  PLOGD << "probeDevices";
+  std::vector<ProbedDevice> devices;
   auto rt_audio = std::make_unique<RtAudio>(rt_api);
   const std::string driver = RtAudio::getApiName(rt_api);
-  unsigned int devices = rt_audio->getDeviceCount();
-  RtAudio::DeviceInfo info;
-  for (int i = 0; i < devices; i++) {
-    info = rt_audio->getDeviceInfo(i);
-    if (info.inputChannels > 0) {
-      sound_cards.push_back(getDevice(std::to_string(i), driver, "input", info, store));
+  unsigned int num_devices = rt_audio->getDeviceCount();
+  for (unsigned int i = 0; i < num_devices; i++) {
+    auto info = rt_audio->getDeviceInfo(i);
+    if (info.inputChannels > 0 || info.outputChannels > 0) {
+      devices.push_back({driver, i, std::move(info)});
+    }
+  }
+  return devices;
+}
+std::string RtAudioIO::getDeviceKey(const ProbedDevice &device) {
+  return device.driver + "/" + std::to_string(device.index) + "/" + device.info.name;
+}
+nlohmann::json RtAudioIO::toJson(const ProbedDevice &device) {
+  return {
+      {"driver", device.driver},
+      {"index", device.index},
+      {"name", device.info.name},
+      {"inputChannels", device.info.inputChannels},
+      {"outputChannels", device.info.outputChannels},
+      {"isDefaultInput", device.info.isDefaultInput},
+      {"isDefaultOutput", device.info.isDefaultOutput},
+      {"sampleRates", device.info.sampleRates},
+      {"preferredSampleRate", device.info.preferredSampleRate}
+  };
+}
+RtAudioIO::ProbedDevice RtAudioIO::fromJson(const nlohmann::json &json) {
+  ProbedDevice device;
+  device.driver = json.at("driver").get<std::string>();
+  device.index = json.at("index").get<unsigned int>();
+  device.info.name = json.at("name").get<std::string>();
+  device.info.inputChannels = json.at("inputChannels").get<unsigned int>();
+  device.info.outputChannels = json.at("outputChannels").get<unsigned int>();
+  device.info.isDefaultInput = json.at("isDefaultInput").get<bool>();
+  device.info.isDefaultOutput = json.at("isDefaultOutput").get<bool>();
+  device.info.sampleRates = json.at("sampleRates").get<std::vector<unsigned int>>();
+  device.info.preferredSampleRate = json.at("preferredSampleRate").get<unsigned int>();
+  return device;
+}
+std::vector<nlohmann::json> RtAudioIO::toSoundCards(const std::map<std::string, ProbedDevice> &devices,
+                                                    const std::shared_ptr<DigitalStage::Api::Store> &store) {
+  auto sound_cards = std::vector<nlohmann::json>();
+  for (const auto &item: devices) {
+    const auto &device = item.second;
+    if (device.info.inputChannels > 0) {
+      sound_cards.push_back(getDevice(std::to_string(device.index), device.driver, "input", device.info, store));
     }
-    if (info.outputChannels > 0) {
-      sound_cards.push_back(getDevice(std::to_string(i), driver, "output", info, store));
+    if (device.info.outputChannels > 0) {
+      sound_cards.push_back(getDevice(std::to_string(device.index), device.driver, "output", device.info, store));
     }
   }
   return sound_cards;
 }
+std::filesystem::path RtAudioIO::getDeviceCachePath() {
+  std::filesystem::path directory;
+#if defined(_WIN32)
+  if (const char *local_app_data = std::getenv("LOCALAPPDATA")) {
+    directory = local_app_data;
+  }
+#elif defined(__APPLE__)
+  if (const char *home = std::getenv("HOME")) {
+    directory = std::filesystem::path(home) / "Library" / "Caches";
+  }
+#else
+  if (const char *cache_home = std::getenv("XDG_CACHE_HOME"); cache_home && *cache_home) {
+    directory = cache_home;
+  } else if (const char *home = std::getenv("HOME")) {
+    directory = std::filesystem::path(home) / ".cache";
+  }
+#endif
+  if (directory.empty()) {
+    return kDeviceCacheFile;
+  }
+  directory /= kCacheDirectory;
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  if (error) {
+    PLOGW << "Could not create cache directory " << directory.string() << ": " << error.message();
+    return kDeviceCacheFile;
+  }
+  return directory / kDeviceCacheFile;
+}
+void RtAudioIO::loadDevices() {
+  devices_loaded_ = true;
+  std::ifstream file(getDeviceCachePath());
+  if (!file.is_open()) {
+    return;
+  }
+  try {
+    const auto json = nlohmann::json::parse(file);
+    for (const auto &item: json) {
+      auto device = fromJson(item);
+      devices_[getDeviceKey(device)] = std::move(device);
+    }
+    PLOGD << "Loaded " << devices_.size() << " cached devices";
+  } catch (std::exception &err) {
+    PLOGW << "Ignoring unreadable device cache: " << err.what();
+    devices_.clear();
+  }
+}
+void RtAudioIO::saveDevices() {
+  auto json = nlohmann::json::array();
+  for (const auto &item: devices_) {
+    json.push_back(toJson(item.second));
+  }
+  const auto path = getDeviceCachePath();
+  std::ofstream file(path);
+  file << json.dump();
+  if (!file) {
+    PLOGW << "Could not write device cache " << path.string();
+  }
+}
 nlohmann::json RtAudioIO::getDevice(const std::string &uuid, // NOLINT(bugprone-easily-swappable-parameters)
                                     const std::string &driver,
                                     const std::string &type,
@@ -84,17 +189,49 @@ nlohmann::json RtAudioIO::getDevice(const std::string &uuid, // NOLINT(bugprone-
 
 std::vector<nlohmann::json> RtAudioIO::enumerateDevices(std::shared_ptr<DigitalStage::Api::Store> store) {
   PLOGD << "enumerateDevices";
-  auto sound_cards = std::vector<nlohmann::json>();
-  // Fetch existing
-
+  const auto start = std::chrono::steady_clock::now();
+  // Each API probes its hardware on its own, so a slow one (e.g. JACK timing out) does not hold up the others
   std::vector<RtAudio::Api> compiled_apis;
   RtAudio::getCompiledApi(compiled_apis);
+  std::vector<std::future<std::vector<ProbedDevice>>> probes;
+  probes.reserve(compiled_apis.size());
   for (const auto &item: compiled_apis) {
-    auto found_sound_cards = enumerateRtDevices(item, store);
-    sound_cards.insert(sound_cards.end(), found_sound_cards.begin(), found_sound_cards.end());
+    probes.push_back(std::async(std::launch::async, [item]() { return probeDevices(item); }));
+  }
+  std::map<std::string, ProbedDevice> devices;
+  for (auto &probe: probes) {
+    try {
+      for (auto &device: probe.get()) {
+        auto key = getDeviceKey(device);
+        devices[key] = std::move(device);
+      }
+    } catch (std::exception &err) {
+      PLOGE << "Could not probe devices: " << err.what();
+    }
   }
+  PLOGD << "Probed " << devices.size() << " devices of " << compiled_apis.size() << " APIs in "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+        << "ms";
 
-  return sound_cards;
+  std::lock_guard<std::mutex> lock(devices_mutex_);
+  const bool changed = devices.size() != devices_.size()
+      || !std::equal(devices.begin(), devices.end(), devices_.begin(), [](const auto &a, const auto &b) {
+        return a.first == b.first && toJson(a.second) == toJson(b.second);
+      });
+  devices_ = std::move(devices);
+  devices_loaded_ = true;
+  if (changed) {
+    saveDevices();
+  }
+  return toSoundCards(devices_, store);
+}
+
+std::vector<nlohmann::json> RtAudioIO::enumerateCachedDevices(const std::shared_ptr<DigitalStage::Api::Store> &store) {
+  std::lock_guard<std::mutex> lock(devices_mutex_);
+  if (!devices_loaded_) {
+    loadDevices();
+  }
+  return toSoundCards(devices_, store);
 }
 
 void RtAudioIO::initAudio() {
@@ -167,8 +304,12 @@ void RtAudioIO::initAudio() {
     }
 
     if (has_input || has_output) {
+      // ASIO and JACK are planar, so let RtAudio pass their buffers through.
+      // All other APIs are interleaved natively, there we convert with our own kernels instead of RtAudio's
+      RtAudio::Api api = RtAudio::getCompiledApiByName(*local_device->audioDriver);
+      interleaved_ = api != RtAudio::WINDOWS_ASIO && api != RtAudio::UNIX_JACK;
       RtAudio::StreamOptions options;
-      options.flags = RTAUDIO_NONINTERLEAVED | RTAUDIO_SCHEDULE_REALTIME;
+      options.flags = interleaved_ ? RTAUDIO_SCHEDULE_REALTIME : RTAUDIO_NONINTERLEAVED | RTAUDIO_SCHEDULE_REALTIME;
       options.priority = 1;
 
       auto callback = [](void *output, // NOLINT(bugprone-easily-swappable-parameters)
@@ -178,10 +319,9 @@ void RtAudioIO::initAudio() {
                          RtAudioStreamStatus status,
                          void *userData) {
         auto *context = static_cast<RtAudioIO *>(userData);
+        auto *output_buffer = static_cast<float *>(output);
+        auto *input_buffer = static_cast<float *>(input);
         if (context->mutex_.try_lock()) {
-          auto *output_buffer = static_cast<float *>(output);
-          auto *input_buffer = static_cast<float *>(input);
-
           if (status) {
             if (status & RTAUDIO_INPUT_OVERFLOW) {
               PLOGW << "Input data was discarded because of an overflow condition at the driver";
@@ -191,28 +331,44 @@ void RtAudioIO::initAudio() {
             }
           }
 
-          if (input_buffer && output_buffer) {
-            // Duplex
-            std::unordered_map<std::string, float *> input_channels;
+          if (input_buffer && context->interleaved_) {
+            // Deinterleave only the published channels into the planar input bus
+            auto &targets = context->input_targets_;
+            std::fill(targets.begin(), targets.end(), nullptr);
             for (const auto &item: context->input_channel_mapping_) {
-              input_channels[item.second] = &input_buffer[static_cast<size_t>(item.first) * bufferSize];
-            }
-
-            auto **out = static_cast<float **>(malloc(bufferSize * context->num_output_channels_ * sizeof(float *)));
-            for (int output_channel = 0; output_channel < context->num_output_channels_; output_channel++) {
-              out[output_channel] = static_cast<float *>(malloc(bufferSize * sizeof(float)));
+              if (item.first < targets.size()) {
+                targets[item.first] = &context->input_bus_[item.first * bufferSize];
+              }
             }
+            deinterleave(input_buffer, targets.size(), targets.data(), bufferSize);
+            input_buffer = context->input_bus_.data();
+          }
 
-            context->onDuplex(input_channels, out, context->num_output_channels_, bufferSize);
-
-            unsigned int relative_channel = 0;
+          float **out = nullptr;
+          if (output_buffer && context->interleaved_) {
+            out = context->getOutputBus(bufferSize);
+          } else if (output_buffer) {
+            // The stream is non-interleaved, so hand out the driver's channel buffers directly and silence the rest
+            std::size_t relative_channel = 0;
             for (std::size_t channel = 0; channel < context->num_total_output_channels_; channel++) {
               if (context->output_channels_[channel]) {
-                memcpy(&output_buffer[channel * bufferSize], out[relative_channel], bufferSize * sizeof(float));
-                relative_channel++;
+                context->output_pointers_[relative_channel++] = &output_buffer[channel * bufferSize];
+              } else {
+                std::fill_n(&output_buffer[channel * bufferSize], bufferSize, 0.0f);
               }
             }
-            free(out);
+            out = context->output_pointers_.data();
+          }
+
+          if (input_buffer && output_buffer) {
+            // Duplex
+            // Refill the reused list in place, its capacity covers all input channels of the stream
+            auto &input_channels = context->input_channels_;
+            input_channels.clear();
+            for (const auto &item: context->input_channel_mapping_) {
+              input_channels.emplace_back(item.second, &input_buffer[static_cast<size_t>(item.first) * bufferSize]);
+            }
+            context->onDuplex(input_channels, out, context->num_output_channels_, bufferSize);
           } else if (input_buffer) {
             // Capture only
             for (const auto &item: context->input_channel_mapping_) {
@@ -220,23 +376,22 @@ void RtAudioIO::initAudio() {
             }
           } else if (output_buffer) {
             // Playback only
-            auto **out = static_cast<float **>(malloc(bufferSize * context->num_output_channels_ * sizeof(float *)));
-            for (int output_channel = 0; output_channel < context->num_output_channels_; output_channel++) {
-              out[output_channel] = static_cast<float *>(malloc(bufferSize * sizeof(float)));
-            }
             context->onPlayback(out, context->num_output_channels_, bufferSize);
-            unsigned int relative_channel = 0;
-            for (std::size_t channel = 0; channel < context->num_total_output_channels_; channel++) {
-              if (context->output_channels_[channel]) {
-                memcpy(&output_buffer[channel * bufferSize], out[relative_channel], bufferSize * sizeof(float));
-                relative_channel++;
-              }
+          }
+
+          if (output_buffer && context->interleaved_) {
+            // Interleave the bus into the device buffer, disabled channels are silenced on the way
+            auto &sources = context->output_sources_;
+            std::size_t relative_channel = 0;
+            for (std::size_t channel = 0; channel < sources.size(); channel++) {
+              sources[channel] = context->output_channels_[channel] ? out[relative_channel++] : nullptr;
             }
-            free(out);
+            interleave(sources.data(), sources.size(), output_buffer, bufferSize);
           }
           context->mutex_.unlock();
-        } else {
-          PLOGW << "Not owning lock";
+        } else if (output_buffer) {
+          // Being reconfigured, so play silence
+          std::fill_n(output_buffer, static_cast<std::size_t>(bufferSize) * context->num_total_output_channels_, 0.0f);
         }
         return 0;
       };
@@ -246,9 +401,8 @@ void RtAudioIO::initAudio() {
           /**
            * Audio driver handling
            */
-          RtAudio::Api api = RtAudio::getCompiledApiByName(*local_device->audioDriver);
           PLOGD << "(Re)init with audio driver " << *local_device->audioDriver;
-          rt_audio_ = std::make_unique<RtAudio>(std::move(api));
+          rt_audio_ = std::make_unique<RtAudio>(api);
           rt_audio_->openStream(
               has_output ? &output_parameters_ : nullptr,
               has_input ? &input_parameters_ : nullptr,
@@ -260,6 +414,16 @@ void RtAudioIO::initAudio() {
               this,
               &options
           );
+          // openStream may have changed the buffer size, so announce the final configuration
+          output_pointers_.assign(num_output_channels_, nullptr);
+          output_sources_.assign(has_output ? num_total_output_channels_.load() : 0, nullptr);
+          input_bus_.assign(has_input ? static_cast<std::size_t>(input_parameters_.nChannels) * buffer_size_ : 0, 0.0f);
+          input_targets_.assign(has_input ? input_parameters_.nChannels : 0, nullptr);
+          input_channels_.clear();
+          input_channels_.reserve(has_input ? input_parameters_.nChannels : 0);
+          PLOGD << "Using " << (interleaved_ ? "interleaved" : "non-interleaved") << " stream with "
+                << getChannelKernelsName() << " channel kernels";
+          configureStream(sample_rate, buffer_size_, num_output_channels_);
           rt_audio_->startStream();
           PLOGD << "Started Audio IO";
         } catch (RtAudioError &e) {
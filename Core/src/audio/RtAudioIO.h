@@ -8,16 +8,24 @@
 #endif
 #include <RtAudio.h>
 #include "AudioIO.h"
+#include <filesystem>
+#include <map>
+#include <mutex>
 #include <optional>
 
 class [[maybe_unused]] RtAudioIO :
     public AudioIO {
 
  public:
-  [[maybe_unused]] explicit RtAudioIO(std::shared_ptr<DigitalStage::Api::Client> client);
+  [[maybe_unused]] RtAudioIO(std::shared_ptr<DigitalStage::Api::Client> client,
+                             std::shared_ptr<TrackInterner> track_interner);
   ~RtAudioIO() override;
  protected:
+  /**
+   * Probes the devices of all compiled APIs in parallel and caches them, also for the next start.
+   */
   std::vector<nlohmann::json> enumerateDevices(std::shared_ptr<DigitalStage::Api::Store> store) override;
+  std::vector<nlohmann::json> enumerateCachedDevices(const std::shared_ptr<DigitalStage::Api::Store> &store) override;
 
   void setAudioDriver(const std::string &audio_driver) override;
   void setInputSoundCard(const DigitalStage::Types::SoundCard &sound_card, bool start) override;
@@ -34,7 +42,29 @@ class [[maybe_unused]] RtAudioIO :
                                                     unsigned int sample_rate);
 
   void initAudio();
-  static std::vector<nlohmann::json> enumerateRtDevices(RtAudio::Api rt_api, const std::shared_ptr<DigitalStage::Api::Store>& store);
+
+  /**
+   * A device as reported by RtAudio, everything a sound card is built from.
+   */
+  struct ProbedDevice {
+    std::string driver;
+    unsigned int index;
+    RtAudio::DeviceInfo info;
+  };
+  static constexpr const char *kDeviceCacheFile = "rtaudio-devices.json";
+  static constexpr const char *kCacheDirectory = "digital-stage-connector";
+  /**
+   * @return path of the device cache inside the per-user cache directory, or in the working directory if there is none
+   */
+  static std::filesystem::path getDeviceCachePath();
+  static std::vector<ProbedDevice> probeDevices(RtAudio::Api rt_api);
+  static std::string getDeviceKey(const ProbedDevice &device);
+  static nlohmann::json toJson(const ProbedDevice &device);
+  static ProbedDevice fromJson(const nlohmann::json &json);
+  static std::vector<nlohmann::json> toSoundCards(const std::map<std::string, ProbedDevice> &devices,
+                                                  const std::shared_ptr<DigitalStage::Api::Store> &store);
+  void loadDevices();
+  void saveDevices();
   static nlohmann::json getDevice(const std::string &uuid,
                                   const std::string &driver,
                                   const std::string &type,
@@ -43,6 +73,11 @@ class [[maybe_unused]] RtAudioIO :
 
   std::atomic<bool> is_running_;
 
+  // Devices of the last enumeration by identity (driver, index and name)
+  std::map<std::string, ProbedDevice> devices_;
+  bool devices_loaded_ = false;
+  std::mutex devices_mutex_;
+
   RtAudio::StreamParameters input_parameters_;
   RtAudio::StreamParameters output_parameters_;
   unsigned int buffer_size_;
@@ -51,4 +86,11 @@ class [[maybe_unused]] RtAudioIO :
   std::atomic<std::size_t> num_output_channels_{};
   std::atomic<std::size_t> num_total_output_channels_{};
   std::array<bool, 64> output_channels_{};
+  // Reused by every callback, only resized while the stream is stopped
+  bool interleaved_{};
+  std::vector<float *> output_pointers_;
+  std::vector<const float *> output_sources_;
+  std::vector<float> input_bus_;
+  std::vector<float *> input_targets_;
+  InputTracks input_channels_;
 };
@@ -3,27 +3,45 @@
 //
 #pragma once
 #include <cmrc/cmrc.hpp>
+#include <streambuf>
 
+/**
+ * Read-only stream over an embedded resource or any other range of memory outliving it. The whole range is one get
+ * area, so bulk reads are plain copies and parsers may seek freely.
+ */
 class CMRCFileBuffer : public std::streambuf {
-  const char *current_;
-  cmrc::file file_;
  public:
-  explicit CMRCFileBuffer(cmrc::file file) : file_(file), current_(file.begin()) {
+  explicit CMRCFileBuffer(const cmrc::file &file) : CMRCFileBuffer(file.begin(), file.end()) {
   }
-  inline int_type underflow() override {
-    if (current_ == file_.end()) {
-      return traits_type::eof();
-    }
-    return traits_type::to_int_type(*current_);
+  CMRCFileBuffer(const char *begin, const char *end) {
+    // Never written to, the get area merely is not const
+    setg(const_cast<char *>(begin), const_cast<char *>(begin), const_cast<char *>(end));
+  }
+
+ protected:
+  inline std::streamsize showmanyc() override {
+    return egptr() - gptr();
   }
-  inline int_type uflow() override {
-    if (current_ == file_.end()) {
-      return traits_type::eof();
+
+  inline pos_type seekoff(off_type offset, std::ios_base::seekdir direction, std::ios_base::openmode which) override {
+    if (!(which & std::ios_base::in)) {
+      return pos_type(off_type(-1));
+    }
+    off_type base = 0;
+    if (direction == std::ios_base::cur) {
+      base = gptr() - eback();
+    } else if (direction == std::ios_base::end) {
+      base = egptr() - eback();
     }
-    return traits_type::to_int_type(*current_++);
+    const auto position = base + offset;
+    if (position < 0 || position > egptr() - eback()) {
+      return pos_type(off_type(-1));
+    }
+    setg(eback(), eback() + position, egptr());
+    return pos_type(position);
   }
 
-  inline std::streamsize showmanyc() override {
-    return file_.end() - file_.begin();
+  inline pos_type seekpos(pos_type position, std::ios_base::openmode which) override {
+    return seekoff(off_type(position), std::ios_base::beg, which);
   }
-};
\ No newline at end of file
+};
@@ -0,0 +1,131 @@
+#include "DeviceWatcher.h"
+#include <plog/Log.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+DeviceWatcher::DeviceWatcher(std::function<void()> on_change)
+    : on_change_(std::move(on_change)),
+      is_watching_(false),
+      wake_pipe_{-1, -1} {
+}
+
+DeviceWatcher::~DeviceWatcher() {
+  stop();
+}
+
+void DeviceWatcher::start(bool report_now) {
+  if (is_watching_) {
+    return;
+  }
+  is_watching_ = true;
+#ifdef __linux__
+  if (pipe2(wake_pipe_, O_CLOEXEC | O_NONBLOCK) != 0) {
+    wake_pipe_[0] = wake_pipe_[1] = -1;
+  }
+#endif
+  thread_ = std::thread(&DeviceWatcher::watch, this, report_now);
+}
+
+void DeviceWatcher::stop() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    is_watching_ = false;
+  }
+  stop_signal_.notify_all();
+#ifdef __linux__
+  if (wake_pipe_[1] >= 0) {
+    const char wake = 0;
+    (void) !write(wake_pipe_[1], &wake, 1);
+  }
+#endif
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+#ifdef __linux__
+  for (auto &fd: wake_pipe_) {
+    if (fd >= 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+#endif
+}
+
+void DeviceWatcher::watch(bool report_now) {
+  if (report_now) {
+    on_change_();
+  }
+  if (!watchNotifications()) {
+    PLOGI << "No device notifications available, polling for device changes every " << kPollInterval.count() << "s";
+    poll();
+  }
+  PLOGD << "Stopped watching devices";
+}
+
+void DeviceWatcher::poll() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (is_watching_) {
+    if (stop_signal_.wait_for(lock, kPollInterval, [this]() { return !is_watching_; })) {
+      return;
+    }
+    lock.unlock();
+    on_change_();
+    lock.lock();
+  }
+}
+
+bool DeviceWatcher::watchNotifications() {
+#ifdef __linux__
+  if (wake_pipe_[0] < 0) {
+    return false;
+  }
+  const int notifications = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (notifications < 0) {
+    return false;
+  }
+  if (inotify_add_watch(notifications, "/dev/snd", IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM) < 0) {
+    close(notifications);
+    return false;
+  }
+  PLOGI << "Watching /dev/snd for device changes";
+  std::array<pollfd, 2> fds{pollfd{notifications, POLLIN, 0}, pollfd{wake_pipe_[0], POLLIN, 0}};
+  alignas(inotify_event) char events[4096];
+  bool changed = false;
+  auto last_scan = std::chrono::steady_clock::now();
+  while (is_watching_) {
+    // Once something changed, wait until no further nodes appear before reporting it
+    const auto timeout = changed ? kSettleTime : std::chrono::duration_cast<std::chrono::milliseconds>(
+        kRescanInterval - (std::chrono::steady_clock::now() - last_scan));
+    const int ready = ::poll(fds.data(), fds.size(), static_cast<int>(std::max<long long>(timeout.count(), 0)));
+    if (ready < 0 && errno != EINTR) {
+      PLOGE << "Could not wait for device notifications";
+      break;
+    }
+    if (!is_watching_ || (fds[1].revents & POLLIN) != 0) {
+      break;
+    }
+    if ((fds[0].revents & POLLIN) != 0) {
+      while (read(notifications, events, sizeof(events)) > 0) {
+      }
+      changed = true;
+      continue;
+    }
+    if (ready == 0 && (changed || std::chrono::steady_clock::now() - last_scan >= kRescanInterval)) {
+      changed = false;
+      last_scan = std::chrono::steady_clock::now();
+      on_change_();
+    }
+  }
+  close(notifications);
+  return true;
+#else
+  return false;
+#endif
+}
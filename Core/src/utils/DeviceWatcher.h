@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+ * Reports that audio devices may have been added, removed or swapped, so they only get enumerated when needed.
+ *
+ * On Linux the ALSA device nodes in /dev/snd are watched with inotify, these are created and removed by udev for
+ * every card plugged in or out. Sound servers (PulseAudio, JACK) may change their devices without touching the nodes,
+ * so there is a slow rescan as well. Other platforms and systems without inotify fall back to polling.
+ * A burst of changes is reported once after it settled. Stopping never waits for a timeout.
+ */
+class DeviceWatcher {
+ public:
+  static constexpr std::chrono::seconds kPollInterval{10};
+  static constexpr std::chrono::seconds kRescanInterval{60};
+  static constexpr std::chrono::milliseconds kSettleTime{500};
+
+  /**
+   * @param on_change called on the watcher thread
+   */
+  explicit DeviceWatcher(std::function<void()> on_change);
+  ~DeviceWatcher();
+  DeviceWatcher(const DeviceWatcher &) = delete;
+  DeviceWatcher &operator=(const DeviceWatcher &) = delete;
+
+  /**
+   * @param report_now report a change right away, e.g. to refresh devices taken from a cache
+   */
+  void start(bool report_now = false);
+  void stop();
+
+ private:
+  void watch(bool report_now);
+  /**
+   * @return false if there is no notification source, so the caller has to poll instead
+   */
+  bool watchNotifications();
+  void poll();
+
+  std::function<void()> on_change_;
+  std::atomic<bool> is_watching_;
+  std::thread thread_;
+  std::mutex mutex_;
+  std::condition_variable stop_signal_;
+  int wake_pipe_[2];
+};
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/**
+ * Lock-free bounded multi-producer/multi-consumer queue of preallocated slots.
+ *
+ * Based on the bounded queue of Dmitry Vyukov: every slot carries a sequence number telling producers and consumers
+ * whether it is theirs, so both sides only ever CAS their own position. Values are written and read in place,
+ * so large slots (e.g. whole audio blocks) are never copied around and never allocated after construction.
+ * When the queue is full, push() drops the oldest value to make room, so producers never wait for consumers.
+ * If a consumer is still reading the oldest value, there is no room until it is done, so the new value is dropped
+ * instead: producers may run at a higher priority and would spin on a preempted consumer forever.
+ * The capacity is rounded up to the next power of two.
+ */
+template<class T>
+class DropOldestQueue {
+  static constexpr std::size_t kCacheLineSize = 64;
+
+ public:
+  explicit DropOldestQueue(std::size_t size)
+      : capacity_(roundUp(size)), mask_(capacity_ - 1), cells_(std::unique_ptr<Cell[]>(new Cell[capacity_])) {
+    for (std::size_t i = 0; i < capacity_; i++) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Appends a value written in place by fill(T &slot), dropping the oldest value if the queue is full.
+   * @return number of values dropped, including the new one if there was no room
+   */
+  template<class Fill>
+  std::size_t push(Fill &&fill) {
+    std::size_t dropped = 0;
+    bool made_room = false;
+    auto position = enqueue_position_.load(std::memory_order_relaxed);
+    while (true) {
+      auto &cell = cells_[position & mask_];
+      const auto sequence = cell.sequence.load(std::memory_order_acquire);
+      const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+      if (difference == 0) {
+        if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          fill(cell.value);
+          cell.sequence.store(position + 1, std::memory_order_release);
+          return dropped;
+        }
+      } else if (difference < 0) {
+        if (made_room) {
+          // Still full, so the slot is held by a consumer (or a producer) which has not released it yet
+          return dropped + 1;
+        }
+        // Full, make room by consuming the oldest value ourselves
+        if (pop([](T &) {})) {
+          dropped++;
+        }
+        made_room = true;
+        position = enqueue_position_.load(std::memory_order_relaxed);
+      } else {
+        position = enqueue_position_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * Removes the oldest value, handing it to consume(T &slot) before the slot is released.
+   * @return false if the queue was empty
+   */
+  template<class Consume>
+  bool pop(Consume &&consume) {
+    auto position = dequeue_position_.load(std::memory_order_relaxed);
+    while (true) {
+      auto &cell = cells_[position & mask_];
+      const auto sequence = cell.sequence.load(std::memory_order_acquire);
+      const auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+      if (difference == 0) {
+        if (dequeue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+          consume(cell.value);
+          cell.sequence.store(position + capacity_, std::memory_order_release);
+          return true;
+        }
+      } else if (difference < 0) {
+        return false;
+      } else {
+        position = dequeue_position_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /**
+   * Number of queued values, only a snapshot while other threads are pushing or popping.
+   */
+  [[nodiscard]] std::size_t size() const {
+    const auto enqueued = enqueue_position_.load(std::memory_order_acquire);
+    const auto dequeued = dequeue_position_.load(std::memory_order_acquire);
+    return enqueued > dequeued ? enqueued - dequeued : 0;
+  }
+
+  [[nodiscard]] std::size_t capacity() const {
+    return capacity_;
+  }
+
+ private:
+  struct Cell {
+    std::atomic<std::size_t> sequence;
+    T value;
+  };
+
+  static std::size_t roundUp(std::size_t size) {
+    std::size_t capacity = 1;
+    while (capacity < size) {
+      capacity <<= 1;
+    }
+    return capacity;
+  }
+
+  const std::size_t capacity_;
+  const std::size_t mask_;
+  std::unique_ptr<Cell[]> cells_;
+  alignas(kCacheLineSize) std::atomic<std::size_t> enqueue_position_{0};
+  alignas(kCacheLineSize) std::atomic<std::size_t> dequeue_position_{0};
+};
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+/**
+ * Wait-free single-producer/single-consumer ring buffer.
+ *
+ * Exactly one thread may call write()/put() and exactly one (other) thread may call read()/get()/skip().
+ * Head and tail live on separate cache lines, so producer and consumer never share a line they write to.
+ * The capacity is rounded up to the next power of two, so wrapping is a single mask.
+ * When the buffer is full, write() stores as much as fits and drops the rest (the consumer owns the tail).
+ */
+template<class T>
+class LockFreeRingBuffer {
+  static_assert(std::is_trivially_copyable<T>::value, "LockFreeRingBuffer requires trivially copyable values");
+  static constexpr std::size_t kCacheLineSize = 64;
+
+ public:
+  explicit LockFreeRingBuffer(std::size_t size)
+      : capacity_(roundUp(size)), mask_(capacity_ - 1), buf_(std::unique_ptr<T[]>(new T[capacity_]())) {
+  }
+
+  /**
+   * Appends up to num_items values using at most two memcpy's.
+   * @return number of values actually written
+   */
+  inline std::size_t write(const T *items, std::size_t num_items) {
+    const auto head = head_.load(std::memory_order_relaxed);
+    if (capacity_ - (head - cached_tail_) < num_items) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+    }
+    const auto writable = std::min(num_items, capacity_ - (head - cached_tail_));
+    if (writable == 0) {
+      return 0;
+    }
+    const auto offset = head & mask_;
+    const auto first = std::min(writable, capacity_ - offset);
+    std::memcpy(&buf_[offset], items, first * sizeof(T));
+    if (first < writable) {
+      std::memcpy(&buf_[0], items + first, (writable - first) * sizeof(T));
+    }
+    head_.store(head + writable, std::memory_order_release);
+    return writable;
+  }
+
+  /**
+   * Appends up to num_items values produced in place by fill(T *destination, std::size_t offset, std::size_t count),
+   * which is called once, or twice when wrapping around, so producers can decode straight into the ring.
+   * @return number of values actually written
+   */
+  template<class Fill>
+  inline std::size_t write(std::size_t num_items, Fill &&fill) {
+    const auto head = head_.load(std::memory_order_relaxed);
+    if (capacity_ - (head - cached_tail_) < num_items) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+    }
+    const auto writable = std::min(num_items, capacity_ - (head - cached_tail_));
+    if (writable == 0) {
+      return 0;
+    }
+    const auto offset = head & mask_;
+    const auto first = std::min(writable, capacity_ - offset);
+    fill(&buf_[offset], 0, first);
+    if (first < writable) {
+      fill(&buf_[0], first, writable - first);
+    }
+    head_.store(head + writable, std::memory_order_release);
+    return writable;
+  }
+
+  /**
+   * Removes up to num_items values using at most two memcpy's.
+   * @return number of values actually read, the remaining part of items is left untouched
+   */
+  inline std::size_t read(T *items, std::size_t num_items) {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    if (cached_head_ - tail < num_items) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+    }
+    const auto readable = std::min(num_items, cached_head_ - tail);
+    if (readable == 0) {
+      return 0;
+    }
+    const auto offset = tail & mask_;
+    const auto first = std::min(readable, capacity_ - offset);
+    std::memcpy(items, &buf_[offset], first * sizeof(T));
+    if (first < readable) {
+      std::memcpy(items + first, &buf_[0], (readable - first) * sizeof(T));
+    }
+    tail_.store(tail + readable, std::memory_order_release);
+    return readable;
+  }
+
+  /**
+   * Consumer only: discards up to num_items values without copying them.
+   * @return number of values skipped
+   */
+  inline std::size_t skip(std::size_t num_items) {
+    const auto tail = tail_.load(std::memory_order_relaxed);
+    cached_head_ = head_.load(std::memory_order_acquire);
+    const auto skippable = std::min(num_items, cached_head_ - tail);
+    tail_.store(tail + skippable, std::memory_order_release);
+    return skippable;
+  }
+
+  inline bool put(T item) {
+    return write(&item, 1) == 1;
+  }
+
+  inline T get() {
+    T item{};
+    read(&item, 1);
+    return item;
+  }
+
+  [[nodiscard]] inline bool empty() const {
+    return size() == 0;
+  }
+
+  [[nodiscard]] inline bool full() const {
+    return size() == capacity_;
+  }
+
+  [[nodiscard]] inline std::size_t capacity() const {
+    return capacity_;
+  }
+
+  /**
+   * Number of readable values. Exact from the consumer and producer side, a snapshot from everywhere else.
+   */
+  [[nodiscard]] inline std::size_t size() const {
+    const auto tail = tail_.load(std::memory_order_acquire);
+    const auto head = head_.load(std::memory_order_acquire);
+    return head - tail;
+  }
+
+ private:
+  static std::size_t roundUp(std::size_t size) {
+    std::size_t capacity = 1;
+    while (capacity < size) {
+      capacity <<= 1;
+    }
+    return capacity;
+  }
+
+  const std::size_t capacity_;
+  const std::size_t mask_;
+  std::unique_ptr<T[]> buf_;
+
+  // Producer side
+  alignas(kCacheLineSize) std::atomic<std::size_t> head_{0};
+  std::size_t cached_tail_{0};
+
+  // Consumer side
+  alignas(kCacheLineSize) std::atomic<std::size_t> tail_{0};
+  std::size_t cached_head_{0};
+};
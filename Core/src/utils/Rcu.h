@@ -0,0 +1,118 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+/**
+ * Read-copy-update cell for state the audio thread reads and control threads replace.
+ *
+ * Readers take a ReadGuard, which costs two atomic increments and one atomic load and never blocks or allocates.
+ * Writers publish a new immutable snapshot and free the previous one as soon as no reader can still see it.
+ * Grace periods are tracked with two reader counters and an epoch: the writer flips the epoch twice and waits
+ * for the counter of each parity to drain, so readers entering in the meantime never starve it.
+ * Writers are serialized and may block for as long as a reader holds its guard, so never publish while reading.
+ */
+template<class T>
+class Rcu {
+  static constexpr std::size_t kCacheLineSize = 64;
+
+ public:
+  explicit Rcu(std::unique_ptr<T> initial = std::make_unique<T>()) : current_(initial.release()) {}
+  ~Rcu() {
+    delete current_.load();
+  }
+  Rcu(const Rcu &) = delete;
+  Rcu &operator=(const Rcu &) = delete;
+
+  class ReadGuard {
+   public:
+    explicit ReadGuard(const Rcu &rcu) : counter_(&rcu.enter()), snapshot_(rcu.current_.load()) {}
+    ~ReadGuard() {
+      counter_->fetch_sub(1);
+    }
+    ReadGuard(const ReadGuard &) = delete;
+    ReadGuard &operator=(const ReadGuard &) = delete;
+
+    const T *get() const {
+      return snapshot_;
+    }
+    const T *operator->() const {
+      return snapshot_;
+    }
+    const T &operator*() const {
+      return *snapshot_;
+    }
+
+   private:
+    std::atomic<std::size_t> *counter_;
+    const T *snapshot_;
+  };
+
+  /**
+   * @return guard of the current snapshot, which stays valid until the guard is destroyed
+   */
+  ReadGuard read() const {
+    return ReadGuard(*this);
+  }
+
+  /**
+   * Replaces the snapshot, blocks until no reader holds the previous one and frees it.
+   */
+  void publish(std::unique_ptr<T> next) {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    swap(std::move(next));
+  }
+
+  /**
+   * Replaces the snapshot, blocks until no reader holds the previous one and hands it back to the caller.
+   */
+  std::unique_ptr<T> exchange(std::unique_ptr<T> next) {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    return swap(std::move(next));
+  }
+
+  /**
+   * Copies the current snapshot, lets update(T &copy) modify the copy and publishes it.
+   * Writers are serialized, so concurrent updates never get lost.
+   */
+  template<class Update>
+  void update(Update &&update) {
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+    auto next = std::make_unique<T>(*current_.load());
+    update(*next);
+    swap(std::move(next));
+  }
+
+ private:
+  std::atomic<std::size_t> &enter() const {
+    auto &counter = readers_[epoch_.load() & 1].value;
+    counter.fetch_add(1);
+    return counter;
+  }
+
+  std::unique_ptr<T> swap(std::unique_ptr<T> next) {
+    std::unique_ptr<T> previous(current_.exchange(next.release()));
+    // Any reader still seeing the previous snapshot registered before the exchange, under one of both parities
+    for (int phase = 0; phase < 2; phase++) {
+      const auto epoch = epoch_.fetch_add(1);
+      while (readers_[epoch & 1].value.load() != 0) {
+        std::this_thread::yield();
+      }
+    }
+    return previous;
+  }
+
+  struct alignas(kCacheLineSize) Counter {
+    std::atomic<std::size_t> value{0};
+  };
+
+  std::atomic<T *> current_;
+  mutable std::array<Counter, 2> readers_;
+  alignas(kCacheLineSize) std::atomic<std::size_t> epoch_{0};
+  std::mutex writer_mutex_;
+};
@@ -0,0 +1,72 @@
+#include "RealtimeAllocationTracker.h"
+
+#ifdef DS_TRACK_REALTIME_ALLOCATIONS
+#include <cassert>
+#include <cstdlib>
+#include <new>
+
+namespace {
+thread_local int realtime_depth = 0;
+thread_local int allow_depth = 0;
+
+void *allocate(std::size_t size) {
+  assert((realtime_depth == 0 || allow_depth > 0) && "Heap allocation inside a realtime audio callback");
+  if (size == 0) {
+    size = 1;
+  }
+  if (void *ptr = std::malloc(size)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+}
+
+RealtimeScope::RealtimeScope() {
+  realtime_depth++;
+}
+RealtimeScope::~RealtimeScope() {
+  realtime_depth--;
+}
+
+AllowAllocationScope::AllowAllocationScope() {
+  allow_depth++;
+}
+AllowAllocationScope::~AllowAllocationScope() {
+  allow_depth--;
+}
+
+// Replacements of the global allocation functions, they become active as soon as this object file is linked,
+// which happens whenever one of the scopes above is used.
+void *operator new(std::size_t size) {
+  return allocate(size);
+}
+void *operator new[](std::size_t size) {
+  return allocate(size);
+}
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return allocate(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+void operator delete[](void *ptr) noexcept {
+  std::free(ptr);
+}
+void operator delete(void *ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+void operator delete[](void *ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+#endif
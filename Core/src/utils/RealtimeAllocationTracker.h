@@ -0,0 +1,41 @@
+#pragma once
+
+/**
+ * Debug helper to find heap allocations on realtime threads.
+ *
+ * Place a RealtimeScope at the top of an audio callback. When compiled with DS_TRACK_REALTIME_ALLOCATIONS,
+ * every operator new inside that scope (on the same thread) triggers an assertion.
+ * Wrap known and accepted allocations in an AllowAllocationScope.
+ * Without DS_TRACK_REALTIME_ALLOCATIONS both scopes compile to nothing.
+ */
+#ifdef DS_TRACK_REALTIME_ALLOCATIONS
+class RealtimeScope {
+ public:
+  RealtimeScope();
+  ~RealtimeScope();
+  RealtimeScope(const RealtimeScope &) = delete;
+  RealtimeScope &operator=(const RealtimeScope &) = delete;
+};
+
+class AllowAllocationScope {
+ public:
+  AllowAllocationScope();
+  ~AllowAllocationScope();
+  AllowAllocationScope(const AllowAllocationScope &) = delete;
+  AllowAllocationScope &operator=(const AllowAllocationScope &) = delete;
+};
+#else
+class RealtimeScope {
+ public:
+  RealtimeScope() {}  // user-provided, so a scope variable does not warn as unused
+  RealtimeScope(const RealtimeScope &) = delete;
+  RealtimeScope &operator=(const RealtimeScope &) = delete;
+};
+
+class AllowAllocationScope {
+ public:
+  AllowAllocationScope() {}  // user-provided, so a scope variable does not warn as unused
+  AllowAllocationScope(const AllowAllocationScope &) = delete;
+  AllowAllocationScope &operator=(const AllowAllocationScope &) = delete;
+};
+#endif
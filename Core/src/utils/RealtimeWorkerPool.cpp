@@ -0,0 +1,185 @@
+#include "RealtimeWorkerPool.h"
+#include "RealtimeAllocationTracker.h"
+#include <plog/Log.h>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#endif
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+namespace {
+// Roughly a few microseconds, enough for the workers of a small block to finish without a syscall
+constexpr int kSpinCount = 4000;
+constexpr int kRealtimePriority = 70;
+
+inline void relax() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield");
+#endif
+}
+
+#if !defined(__linux__)
+// Without futexes all waiters share one condition variable, waking is rare enough for that
+std::mutex wait_mutex;
+std::condition_variable wait_signal;
+#endif
+}
+
+RealtimeWorkerPool::RealtimeWorkerPool(std::size_t num_workers)
+    : ranges_(std::make_unique<Range[]>(num_workers + 1)),
+      invoke_(nullptr),
+      context_(nullptr),
+      generation_(0),
+      sleeping_workers_(0),
+      pending_(0),
+      sleeping_callers_(0),
+      is_running_(true) {
+  workers_.reserve(num_workers);
+  for (std::size_t worker = 0; worker < num_workers; worker++) {
+    workers_.emplace_back(&RealtimeWorkerPool::loop, this, worker + 1);
+  }
+  PLOGD << "Rendering with " << getConcurrency() << " threads";
+}
+
+RealtimeWorkerPool::~RealtimeWorkerPool() {
+  is_running_ = false;
+  generation_++;
+  wake(generation_, sleeping_workers_);
+  for (auto &worker: workers_) {
+    if (worker.joinable())
+      worker.join();
+  }
+}
+
+void RealtimeWorkerPool::run(std::size_t count, Invoke invoke, void *context) {
+  const auto participants = getConcurrency();
+  if (participants == 1 || count < 2) {
+    for (std::size_t index = 0; index < count; index++) {
+      invoke(context, index, 0);
+    }
+    return;
+  }
+  for (std::size_t participant = 0; participant < participants; participant++) {
+    ranges_[participant].next.store(count * participant / participants, std::memory_order_relaxed);
+    ranges_[participant].end.store(count * (participant + 1) / participants, std::memory_order_relaxed);
+  }
+  invoke_ = invoke;
+  context_ = context;
+  pending_.store(static_cast<std::uint32_t>(workers_.size()), std::memory_order_relaxed);
+  // Publishes the ranges and the job to the workers, ordered before checking for sleeping workers
+  generation_.fetch_add(1, std::memory_order_seq_cst);
+  wake(generation_, sleeping_workers_);
+
+  work(0);
+
+  // Barrier
+  for (auto pending = pending_.load(std::memory_order_acquire); pending != 0;
+       pending = pending_.load(std::memory_order_acquire)) {
+    waitWhile(pending_, pending, sleeping_callers_);
+  }
+}
+
+void RealtimeWorkerPool::work(std::size_t participant) {
+  // Own range first, then help the others
+  const auto participants = getConcurrency();
+  for (std::size_t offset = 0; offset < participants; offset++) {
+    auto &range = ranges_[(participant + offset) % participants];
+    const auto end = range.end.load(std::memory_order_relaxed);
+    for (auto index = range.next.fetch_add(1, std::memory_order_relaxed); index < end;
+         index = range.next.fetch_add(1, std::memory_order_relaxed)) {
+      invoke_(context_, index, participant);
+    }
+  }
+}
+
+void RealtimeWorkerPool::loop(std::size_t participant) {
+  setRealtimePriority();
+  RealtimeScope realtime_scope;
+  // The generation the pool was constructed with, run() may have bumped it before this thread got started
+  std::uint32_t generation = 0;
+  while (true) {
+    waitWhile(generation_, generation, sleeping_workers_);
+    generation = generation_.load(std::memory_order_acquire);
+    if (!is_running_) {
+      return;
+    }
+    work(participant);
+    if (pending_.fetch_sub(1, std::memory_order_seq_cst) == 1) {
+      wake(pending_, sleeping_callers_);
+    }
+  }
+}
+
+void RealtimeWorkerPool::waitWhile(std::atomic<std::uint32_t> &word,
+                                   std::uint32_t value,
+                                   std::atomic<std::uint32_t> &sleepers) {
+  for (int spin = 0; spin < kSpinCount; spin++) {
+    if (word.load(std::memory_order_acquire) != value) {
+      return;
+    }
+    relax();
+  }
+  // Announce before checking the word once more, the waker changes the word before checking for sleepers,
+  // so (all of it sequentially consistent) either we see the change or the waker sees us
+  sleepers.fetch_add(1, std::memory_order_seq_cst);
+  while (word.load(std::memory_order_seq_cst) == value) {
+#if defined(__linux__)
+    // Returns at once if the word changed meanwhile, so no wakeup gets lost
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAIT_PRIVATE, value, nullptr, nullptr, 0);
+#else
+    std::unique_lock<std::mutex> lock(wait_mutex);
+    wait_signal.wait_for(lock, std::chrono::milliseconds(1), [&word, value]() {
+      return word.load(std::memory_order_acquire) != value;
+    });
+#endif
+  }
+  sleepers.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void RealtimeWorkerPool::wake(std::atomic<std::uint32_t> &word, const std::atomic<std::uint32_t> &sleepers) {
+  if (sleepers.load(std::memory_order_seq_cst) == 0) {
+    return;
+  }
+#if defined(__linux__)
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t *>(&word), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#else
+  (void) word;
+  {
+    std::lock_guard<std::mutex> lock(wait_mutex);
+  }
+  wait_signal.notify_all();
+#endif
+}
+
+void RealtimeWorkerPool::setRealtimePriority() {
+#ifdef _WIN32
+  if (!SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+    PLOGW << "Could not raise the priority of a render thread";
+  }
+#else
+  sched_param param{};
+  param.sched_priority = std::min(kRealtimePriority, sched_get_priority_max(SCHED_FIFO));
+  if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0) {
+    PLOGW << "Could not use realtime priority for a render thread, missing privileges?";
+  }
+#endif
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * Fixed set of realtime priority threads helping the audio callback with independent jobs of one block.
+ *
+ * run() splits the jobs into one contiguous range per participant (the calling thread is participant 0),
+ * participants done with their own range steal from the others. The caller works as well and then waits for the
+ * workers at a barrier, spinning briefly before it sleeps on a futex (Linux) so short blocks never enter the kernel.
+ * Idle workers wait the same way for the next block. Waiters announce that they sleep, so waking only costs a
+ * syscall if somebody actually sleeps. Neither run() nor the workers allocate.
+ */
+class RealtimeWorkerPool {
+  static constexpr std::size_t kCacheLineSize = 64;
+
+ public:
+  /**
+   * @param num_workers threads besides the caller of run(), 0 runs all jobs on the caller
+   */
+  explicit RealtimeWorkerPool(std::size_t num_workers);
+  ~RealtimeWorkerPool();
+  RealtimeWorkerPool(const RealtimeWorkerPool &) = delete;
+  RealtimeWorkerPool &operator=(const RealtimeWorkerPool &) = delete;
+
+  /**
+   * Number of threads taking part in run(), including the caller.
+   */
+  [[nodiscard]] std::size_t getConcurrency() const {
+    return workers_.size() + 1;
+  }
+
+  /**
+   * Calls job(index, participant) for every index below count and returns once all of them are done.
+   * Only one thread may run jobs at a time.
+   */
+  template<class Job>
+  void run(std::size_t count, Job &job) {
+    run(count, [](void *context, std::size_t index, std::size_t participant) {
+      (*static_cast<Job *>(context))(index, participant);
+    }, &job);
+  }
+
+ private:
+  using Invoke = void (*)(void *context, std::size_t index, std::size_t participant);
+  void run(std::size_t count, Invoke invoke, void *context);
+  void work(std::size_t participant);
+  void loop(std::size_t participant);
+
+  static void waitWhile(std::atomic<std::uint32_t> &word, std::uint32_t value, std::atomic<std::uint32_t> &sleepers);
+  static void wake(std::atomic<std::uint32_t> &word, const std::atomic<std::uint32_t> &sleepers);
+  static void setRealtimePriority();
+
+  struct alignas(kCacheLineSize) Range {
+    std::atomic<std::size_t> next{0};
+    std::atomic<std::size_t> end{0};
+  };
+
+  std::unique_ptr<Range[]> ranges_;  // one per participant
+  Invoke invoke_;
+  void *context_;
+  alignas(kCacheLineSize) std::atomic<std::uint32_t> generation_;  // bumped per run, workers wait on it
+  std::atomic<std::uint32_t> sleeping_workers_;  // workers in the kernel, waking is only needed for them
+  alignas(kCacheLineSize) std::atomic<std::uint32_t> pending_;  // workers not done yet, the caller waits on it
+  std::atomic<std::uint32_t> sleeping_callers_;
+  std::atomic<bool> is_running_;
+  std::vector<std::thread> workers_;
+};
@@ -0,0 +1,85 @@
+#include "ResourceBundle.h"
+#include <plog/Log.h>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#ifdef DS_COMPRESSED_RESOURCES
+#include <zlib.h>
+#endif
+
+ResourceBundle::ResourceBundle(cmrc::embedded_filesystem fs)
+    : fs_(fs) {
+}
+
+std::string ResourceBundle::getStoredName(const std::string &name) {
+#ifdef DS_COMPRESSED_RESOURCES
+  return name + ".gz";
+#else
+  return name;
+#endif
+}
+
+bool ResourceBundle::contains(const std::string &name) const {
+  return fs_.is_file(getStoredName(name));
+}
+
+ResourceBundle::Resource ResourceBundle::open(const std::string &name) {
+  const auto stored_name = getStoredName(name);
+  if (!fs_.is_file(stored_name)) {
+    throw std::runtime_error("Resource " + name + " is not part of this build");
+  }
+  auto file = fs_.open(stored_name);
+  Resource resource;
+#ifdef DS_COMPRESSED_RESOURCES
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto inflated = inflated_[name].lock();
+    if (!inflated) {
+      const auto start = std::chrono::steady_clock::now();
+      inflated = std::make_shared<const std::string>(decompress(file));
+      inflated_[name] = inflated;
+      PLOGD << "Inflated " << name << " in " << std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count() << "ms";
+    }
+    resource.inflated_ = std::move(inflated);
+  }
+  resource.begin_ = resource.inflated_->data();
+  resource.end_ = resource.inflated_->data() + resource.inflated_->size();
+#else
+  resource.begin_ = file.begin();
+  resource.end_ = file.end();
+#endif
+  return resource;
+}
+
+std::string ResourceBundle::decompress(const cmrc::file &file) {
+#ifdef DS_COMPRESSED_RESOURCES
+  const auto compressed_size = static_cast<std::size_t>(file.end() - file.begin());
+  if (compressed_size < 4) {
+    throw std::runtime_error("Compressed resource is truncated");
+  }
+  // The gzip trailer ends with the inflated size, modulo 2^32 which is plenty for a dataset
+  const auto *trailer = reinterpret_cast<const unsigned char *>(file.end() - 4);
+  const std::uint32_t size = trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (std::uint32_t(trailer[3]) << 24);
+  std::string inflated(size, '\0');
+
+  z_stream stream{};
+  // Accept the gzip header
+  if (inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK) {
+    throw std::runtime_error("Could not initialize zlib");
+  }
+  stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(file.begin()));
+  stream.avail_in = static_cast<uInt>(compressed_size);
+  stream.next_out = reinterpret_cast<Bytef *>(inflated.data());
+  stream.avail_out = static_cast<uInt>(inflated.size());
+  const auto result = inflate(&stream, Z_FINISH);
+  const auto total = stream.total_out;
+  inflateEnd(&stream);
+  if (result != Z_STREAM_END || total != size) {
+    throw std::runtime_error("Could not inflate resource");
+  }
+  return inflated;
+#else
+  return std::string(file.begin(), file.end());
+#endif
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cmrc/cmrc.hpp>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/**
+ * HRTF and BRIR datasets embedded into the binary. Built with DS_COMPRESSED_RESOURCES, every dataset is stored
+ * gzip compressed and inflated on first use, so only the ones matching the current sound card ever occupy memory.
+ * An inflated dataset is shared as long as anybody holds it.
+ */
+class ResourceBundle {
+ public:
+  /**
+   * Contents of a dataset, valid as long as the resource lives.
+   */
+  class Resource {
+   public:
+    [[nodiscard]] const char *begin() const {
+      return begin_;
+    }
+    [[nodiscard]] const char *end() const {
+      return end_;
+    }
+
+   private:
+    friend class ResourceBundle;
+    std::shared_ptr<const std::string> inflated_;
+    const char *begin_ = nullptr;
+    const char *end_ = nullptr;
+  };
+
+  explicit ResourceBundle(cmrc::embedded_filesystem fs);
+
+  [[nodiscard]] bool contains(const std::string &name) const;
+
+  /**
+   * @throws std::runtime_error if the dataset is not part of the build or cannot be inflated
+   */
+  Resource open(const std::string &name);
+
+ private:
+  static std::string getStoredName(const std::string &name);
+  static std::string decompress(const cmrc::file &file);
+
+  cmrc::embedded_filesystem fs_;
+  std::map<std::string, std::weak_ptr<const std::string>> inflated_;
+  std::mutex mutex_;
+};
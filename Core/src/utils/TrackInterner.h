@@ -0,0 +1,87 @@
+#pragma once
+
+#include "Rcu.h"
+#include <sigslot/signal.hpp>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Dense integer slot of an audio track, used to index per-track arrays on the realtime path.
+ */
+using TrackHandle = std::uint32_t;
+constexpr TrackHandle kInvalidTrackHandle = std::numeric_limits<TrackHandle>::max();
+
+/**
+ * Maps audio track ids to dense handles, once per track. Handles are never reused, so they stay valid
+ * for the lifetime of the interner and arrays indexed by them only ever grow.
+ * intern() may allocate and block, find() and getId() are realtime safe.
+ */
+class TrackInterner {
+ public:
+  /**
+   * Emitted on the interning thread once per new handle, before intern() returns it, so per-track state of the
+   * realtime path can be allocated there.
+   */
+  sigslot::signal<TrackHandle> interned;
+
+  TrackHandle intern(const std::string &audio_track_id) {
+    auto known = find(audio_track_id);
+    if (known != kInvalidTrackHandle) {
+      return known;
+    }
+    TrackHandle handle;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      // Check again, another thread may have been faster
+      known = find(audio_track_id);
+      if (known != kInvalidTrackHandle) {
+        return known;
+      }
+      // The ids live in a deque, so references handed out by getId() stay valid while it grows
+      const auto &id = ids_.emplace_back(audio_track_id);
+      handle = static_cast<TrackHandle>(ids_.size() - 1);
+      table_.update([&id, handle](Table &table) {
+        table.handles.emplace(id, handle);
+        table.ids.push_back(&id);
+      });
+    }
+    interned(handle);
+    return handle;
+  }
+
+  /**
+   * @return handle of the given track or kInvalidTrackHandle if it has never been interned
+   */
+  [[nodiscard]] TrackHandle find(const std::string &audio_track_id) const {
+    auto table = table_.read();
+    auto handle = table->handles.find(audio_track_id);
+    return handle != table->handles.end() ? handle->second : kInvalidTrackHandle;
+  }
+
+  /**
+   * @return id of an interned track, the reference stays valid for the lifetime of the interner
+   */
+  [[nodiscard]] const std::string &getId(TrackHandle handle) const {
+    auto table = table_.read();
+    return *table->ids.at(handle);
+  }
+
+  [[nodiscard]] std::size_t size() const {
+    return table_.read()->ids.size();
+  }
+
+ private:
+  struct Table {
+    std::unordered_map<std::string, TrackHandle> handles;
+    std::vector<const std::string *> ids;
+  };
+
+  Rcu<Table> table_;
+  std::deque<std::string> ids_;
+  std::mutex mutex_;
+};
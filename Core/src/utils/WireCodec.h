@@ -0,0 +1,191 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * Sample formats of audio sent over the wire. All of them are little endian.
+ * The smaller formats trade precision for bandwidth: float16 keeps about 11 bits of mantissa at any level,
+ * int16 and int24 are plain fixed point and clip outside of [-1, 1].
+ */
+enum class AudioSampleFormat : std::uint8_t {
+  kFloat32 = 0,
+  kFloat16 = 1,
+  kInt16 = 2,
+  kInt24 = 3
+};
+
+inline std::size_t getBytesPerSample(AudioSampleFormat format) {
+  switch (format) {
+    case AudioSampleFormat::kFloat32:return 4;
+    case AudioSampleFormat::kFloat16:return 2;
+    case AudioSampleFormat::kInt16:return 2;
+    case AudioSampleFormat::kInt24:return 3;
+    default:return 0;
+  }
+}
+
+namespace wire_codec_detail {
+inline std::uint32_t floatToBits(float value) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+inline float bitsToFloat(std::uint32_t bits) {
+  float value;
+  std::memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+inline std::uint32_t byteSwap(std::uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_bswap32(value);
+#else
+  return (value >> 24) | ((value >> 8) & 0x0000FF00) | ((value << 8) & 0x00FF0000) | (value << 24);
+#endif
+}
+
+/**
+ * Float to half precision with round to nearest even, without lookup tables so the loops can be vectorized.
+ */
+inline std::uint16_t floatToHalf(float value) {
+  std::uint32_t bits = floatToBits(value);
+  const auto sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000);
+  bits &= 0x7FFFFFFF;
+  std::uint16_t half;
+  if (bits >= 0x47800000) {
+    // Out of range, infinity or NaN
+    half = bits > 0x7F800000 ? 0x7E00 : 0x7C00;
+  } else if (bits < 0x38800000) {
+    // Subnormal or zero, let the FPU do the rounding
+    constexpr std::uint32_t kDenormMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+    half = static_cast<std::uint16_t>(floatToBits(bitsToFloat(bits) + bitsToFloat(kDenormMagic)) - kDenormMagic);
+  } else {
+    const std::uint32_t mantissa_odd = (bits >> 13) & 1;
+    bits += (static_cast<std::uint32_t>(15 - 127) << 23) + 0xFFF;
+    bits += mantissa_odd;
+    half = static_cast<std::uint16_t>(bits >> 13);
+  }
+  return static_cast<std::uint16_t>(half | sign);
+}
+
+inline float halfToFloat(std::uint16_t half) {
+  constexpr std::uint32_t kShiftedExponent = 0x7C00 << 13;
+  std::uint32_t bits = static_cast<std::uint32_t>(half & 0x7FFF) << 13;
+  const std::uint32_t exponent = bits & kShiftedExponent;
+  bits += static_cast<std::uint32_t>(127 - 15) << 23;
+  if (exponent == kShiftedExponent) {
+    // Infinity or NaN
+    bits += static_cast<std::uint32_t>(128 - 16) << 23;
+  } else if (exponent == 0) {
+    // Subnormal or zero, renormalize
+    bits += 1 << 23;
+    bits = floatToBits(bitsToFloat(bits) - bitsToFloat(113 << 23));
+  }
+  return bitsToFloat(bits | (static_cast<std::uint32_t>(half & 0x8000) << 16));
+}
+
+inline std::int32_t toFixedPoint(float value, float scale) {
+  const float scaled = std::min(std::max(value, -1.0f), 1.0f) * scale;
+  return static_cast<std::int32_t>(scaled + (scaled >= 0.0f ? 0.5f : -0.5f));
+}
+}
+
+/**
+ * Encodes num_samples samples into out, which must hold num_samples * getBytesPerSample(format) bytes.
+ * Never allocates, float32 is a single memcpy on little endian hosts.
+ * @return number of bytes written
+ */
+inline std::size_t encodeSamples(AudioSampleFormat format, const float *input, std::size_t num_samples,
+                                 std::byte *out) {
+  using namespace wire_codec_detail;
+  auto *bytes = reinterpret_cast<unsigned char *>(out);
+  switch (format) {
+    case AudioSampleFormat::kFloat32: {
+#if defined(DS_BIG_ENDIAN)
+      for (std::size_t i = 0; i < num_samples; i++) {
+        const auto swapped = byteSwap(floatToBits(input[i]));
+        std::memcpy(&bytes[i * 4], &swapped, 4);
+      }
+#else
+      std::memcpy(bytes, input, num_samples * 4);
+#endif
+      return num_samples * 4;
+    }
+    case AudioSampleFormat::kFloat16: {
+      for (std::size_t i = 0; i < num_samples; i++) {
+        const auto half = floatToHalf(input[i]);
+        bytes[i * 2] = static_cast<unsigned char>(half & 0xFF);
+        bytes[i * 2 + 1] = static_cast<unsigned char>(half >> 8);
+      }
+      return num_samples * 2;
+    }
+    case AudioSampleFormat::kInt16: {
+      for (std::size_t i = 0; i < num_samples; i++) {
+        const auto value = static_cast<std::uint32_t>(toFixedPoint(input[i], 32767.0f));
+        bytes[i * 2] = static_cast<unsigned char>(value & 0xFF);
+        bytes[i * 2 + 1] = static_cast<unsigned char>((value >> 8) & 0xFF);
+      }
+      return num_samples * 2;
+    }
+    case AudioSampleFormat::kInt24: {
+      for (std::size_t i = 0; i < num_samples; i++) {
+        const auto value = static_cast<std::uint32_t>(toFixedPoint(input[i], 8388607.0f));
+        bytes[i * 3] = static_cast<unsigned char>(value & 0xFF);
+        bytes[i * 3 + 1] = static_cast<unsigned char>((value >> 8) & 0xFF);
+        bytes[i * 3 + 2] = static_cast<unsigned char>((value >> 16) & 0xFF);
+      }
+      return num_samples * 3;
+    }
+    default:return 0;
+  }
+}
+
+/**
+ * Decodes num_samples samples from input into out.
+ * @return number of samples written, 0 for unknown formats
+ */
+inline std::size_t decodeSamples(AudioSampleFormat format, const std::byte *input, std::size_t num_samples,
+                                 float *out) {
+  using namespace wire_codec_detail;
+  const auto *bytes = reinterpret_cast<const unsigned char *>(input);
+  switch (format) {
+    case AudioSampleFormat::kFloat32: {
+#if defined(DS_BIG_ENDIAN)
+      for (std::size_t i = 0; i < num_samples; i++) {
+        std::uint32_t bits;
+        std::memcpy(&bits, &bytes[i * 4], 4);
+        out[i] = bitsToFloat(byteSwap(bits));
+      }
+#else
+      std::memcpy(out, bytes, num_samples * 4);
+#endif
+      return num_samples;
+    }
+    case AudioSampleFormat::kFloat16: {
+      for (std::size_t i = 0; i < num_samples; i++) {
+        out[i] = halfToFloat(static_cast<std::uint16_t>(bytes[i * 2] | (bytes[i * 2 + 1] << 8)));
+      }
+      return num_samples;
+    }
+    case AudioSampleFormat::kInt16: {
+      for (std::size_t i = 0; i < num_samples; i++) {
+        const auto value = static_cast<std::int16_t>(bytes[i * 2] | (bytes[i * 2 + 1] << 8));
+        out[i] = static_cast<float>(value) * (1.0f / 32767.0f);
+      }
+      return num_samples;
+    }
+    case AudioSampleFormat::kInt24: {
+      for (std::size_t i = 0; i < num_samples; i++) {
+        // Place the 24 bits at the top of an int32 and shift back to extend the sign
+        const auto value = static_cast<std::int32_t>(static_cast<std::uint32_t>(bytes[i * 3]) << 8
+            | static_cast<std::uint32_t>(bytes[i * 3 + 1]) << 16
+            | static_cast<std::uint32_t>(bytes[i * 3 + 2]) << 24) >> 8;
+        out[i] = static_cast<float>(value) * (1.0f / 8388607.0f);
+      }
+      return num_samples;
+    }
+    default:return 0;
+  }
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include "../utils/WireCodec.h"
+#include "../audio/AudioCodec.h"
+
+/**
+ * Framing of audio blocks sent over the data channels.
+ *
+ * Each packet starts with a fixed size header, all fields are little endian:
+ *
+ *   0  uint32  magic (a float NaN pattern, so it never collides with the first sample of a legacy packet)
+ *   4  uint8   version
+ *   5  uint8   sample format, see AudioSampleFormat
+ *   6  uint8   channel count
+ *   7  uint8   codec, see AudioCodecType (0 = plain samples in the sample format)
+ *   8  uint32  sequence number, incremented by one per packet of the same track
+ *  12  uint32  capture timestamp in samples, wrapping
+ *  16  uint32  sample rate
+ *  20  uint16  frame count
+ *  22  uint16  flags, see kAudioPacketSilence
+ *
+ * The payload of PCM packets holds frame count x channel count samples, encoded packets hold a single codec frame.
+ * Silence packets have no payload at all, they stand for frame count silent frames of an idle track.
+ * Peers not knowing the flag drop them as inconsistent and conceal the gap.
+ * Legacy peers send plain float32 samples without any header, use isLegacyAudioPacket to detect them.
+ * They also expect the same, so framed packets only go to peers announcing this version in their codecs message.
+ */
+struct AudioPacketHeader {
+  std::uint32_t sequence = 0;
+  std::uint32_t timestamp = 0;
+  std::uint32_t sample_rate = 0;
+  std::uint16_t frame_count = 0;
+  std::uint8_t channel_count = 1;
+  AudioSampleFormat sample_format = AudioSampleFormat::kFloat32;
+  AudioCodecType codec = AudioCodecType::kPcm;
+  bool silent = false;
+};
+
+constexpr std::size_t kAudioPacketHeaderSize = 24;
+constexpr std::uint32_t kAudioPacketMagic = 0x7FAA5344;
+constexpr std::uint8_t kAudioPacketVersion = 1;
+constexpr std::uint16_t kAudioPacketSilence = 0x0001;
+
+namespace audio_packet_detail {
+inline void writeUInt16(std::byte *out, std::uint16_t value) {
+  out[0] = static_cast<std::byte>(value & 0xFF);
+  out[1] = static_cast<std::byte>((value >> 8) & 0xFF);
+}
+inline void writeUInt32(std::byte *out, std::uint32_t value) {
+  out[0] = static_cast<std::byte>(value & 0xFF);
+  out[1] = static_cast<std::byte>((value >> 8) & 0xFF);
+  out[2] = static_cast<std::byte>((value >> 16) & 0xFF);
+  out[3] = static_cast<std::byte>((value >> 24) & 0xFF);
+}
+inline std::uint16_t readUInt16(const std::byte *in) {
+  return static_cast<std::uint16_t>(std::to_integer<std::uint16_t>(in[0])
+      | (std::to_integer<std::uint16_t>(in[1]) << 8));
+}
+inline std::uint32_t readUInt32(const std::byte *in) {
+  return std::to_integer<std::uint32_t>(in[0])
+      | (std::to_integer<std::uint32_t>(in[1]) << 8)
+      | (std::to_integer<std::uint32_t>(in[2]) << 16)
+      | (std::to_integer<std::uint32_t>(in[3]) << 24);
+}
+}
+
+/**
+ * Writes the header into the first kAudioPacketHeaderSize bytes of out.
+ * @return number of bytes written
+ */
+inline std::size_t encodeAudioPacketHeader(const AudioPacketHeader &header, std::byte *out) {
+  using namespace audio_packet_detail;
+  writeUInt32(&out[0], kAudioPacketMagic);
+  out[4] = static_cast<std::byte>(kAudioPacketVersion);
+  out[5] = static_cast<std::byte>(header.sample_format);
+  out[6] = static_cast<std::byte>(header.channel_count);
+  out[7] = static_cast<std::byte>(header.codec);
+  writeUInt32(&out[8], header.sequence);
+  writeUInt32(&out[12], header.timestamp);
+  writeUInt32(&out[16], header.sample_rate);
+  writeUInt16(&out[20], header.frame_count);
+  writeUInt16(&out[22], header.silent ? kAudioPacketSilence : 0);
+  return kAudioPacketHeaderSize;
+}
+
+/**
+ * Reads the header of the given packet without copying the payload.
+ * @return the header, or std::nullopt if this is not a (valid) framed packet
+ */
+inline std::optional<AudioPacketHeader> decodeAudioPacketHeader(const std::byte *data, std::size_t size) {
+  using namespace audio_packet_detail;
+  if (size < kAudioPacketHeaderSize || readUInt32(&data[0]) != kAudioPacketMagic
+      || std::to_integer<std::uint8_t>(data[4]) != kAudioPacketVersion) {
+    return std::nullopt;
+  }
+  AudioPacketHeader header;
+  header.sample_format = static_cast<AudioSampleFormat>(std::to_integer<std::uint8_t>(data[5]));
+  header.channel_count = std::to_integer<std::uint8_t>(data[6]);
+  header.codec = static_cast<AudioCodecType>(std::to_integer<std::uint8_t>(data[7]));
+  header.sequence = readUInt32(&data[8]);
+  header.timestamp = readUInt32(&data[12]);
+  header.sample_rate = readUInt32(&data[16]);
+  header.frame_count = readUInt16(&data[20]);
+  header.silent = (readUInt16(&data[22]) & kAudioPacketSilence) != 0;
+  if (header.silent) {
+    if (header.frame_count == 0 || size != kAudioPacketHeaderSize) {
+      return std::nullopt;
+    }
+    return header;
+  }
+  if (header.codec != AudioCodecType::kPcm) {
+    // The size of encoded frames varies, the decoder validates them
+    if (header.frame_count == 0 || size == kAudioPacketHeaderSize) {
+      return std::nullopt;
+    }
+    return header;
+  }
+  const auto payload_size = static_cast<std::size_t>(header.frame_count) * header.channel_count
+      * getBytesPerSample(header.sample_format);
+  if (payload_size == 0 || kAudioPacketHeaderSize + payload_size != size) {
+    return std::nullopt;
+  }
+  return header;
+}
+
+/**
+ * Legacy packets carry raw float32 samples only. Packets with our magic but an unknown version or
+ * an inconsistent size are NOT legacy packets, they should be dropped instead.
+ */
+inline bool isLegacyAudioPacket(const std::byte *data, std::size_t size) {
+  return size < 4 || audio_packet_detail::readUInt32(&data[0]) != kAudioPacketMagic;
+}
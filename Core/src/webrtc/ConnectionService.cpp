@@ -3,20 +3,41 @@
 //
 
 #include "ConnectionService.h"
-#include "../utils/conversion.h"
+#include <algorithm>
+#include <limits>
 #include <optional>
 #include <DigitalStage/Api/Events.h>          // for PeerConnection
 #include <plog/Log.h>
 
-ConnectionService::ConnectionService(std::shared_ptr<DigitalStage::Api::Client> client)
+ConnectionService::ConnectionService(std::shared_ptr<DigitalStage::Api::Client> client,
+                                     std::shared_ptr<TrackInterner> track_interner)
     : client_(std::move(client)),
+      track_interner_(std::move(track_interner)),
       configuration_(rtc::Configuration()),
       is_fetching_statistics_(true),
-      token_(std::make_shared<DigitalStage::Api::Client::Token>()) {
+      sample_rate_(48000),
+      wire_format_(AudioSampleFormat::kFloat32),
+      codec_capabilities_({getAvailableAudioCodecs(), 128000, 5, 48000}),
+      token_(std::make_shared<DigitalStage::Api::Client::Token>()),
+      is_send_thread_waiting_(false),
+      send_queue_dropped_(0),
+      send_queue_blocks_(0),
+      send_queue_latency_ns_(0),
+      send_queue_max_latency_ns_(0),
+      is_sending_(true) {
+  send_buffer_.resize(kAudioPacketHeaderSize + std::numeric_limits<std::uint16_t>::max() * sizeof(float));
   attachHandlers();
   statistics_thread_ = std::thread(&ConnectionService::fetchStatistics, this);
+  send_thread_ = std::thread(&ConnectionService::send, this);
 }
 ConnectionService::~ConnectionService() {
+  {
+    std::lock_guard<std::mutex> lock(send_queue_mutex_);
+    is_sending_ = false;
+  }
+  send_queue_signal_.notify_one();
+  if (send_thread_.joinable())
+    send_thread_.join();
   is_fetching_statistics_ = false;
   if (statistics_thread_.joinable())
     statistics_thread_.join();
@@ -61,6 +82,13 @@ void ConnectionService::attachHandlers() {
   client_->stageJoined.connect([this](const DigitalStage::Types::ID_TYPE &,
                                       const std::optional<DigitalStage::Types::ID_TYPE> &,
                                       const std::weak_ptr<DigitalStage::Api::Store> & /*store_ptr*/) {
+    auto audio_channel_mode = getCurrentAudioChannelMode();
+    {
+      std::shared_lock<std::shared_mutex> shared_lock(peer_connections_mutex_);
+      for (const auto &item: peer_connections_) {
+        item.second->setAudioChannelMode(audio_channel_mode);
+      }
+    }
     syncPeerConnections();
   }, token_);
   client_->stageLeft.connect([this](const std::weak_ptr<DigitalStage::Api::Store> & /*store_ptr*/) {
@@ -196,7 +224,13 @@ void ConnectionService::createPeerConnection(const std::string &stage_device_id,
     return;
   }
   bool polite = local_stage_device_id.compare(stage_device_id) > 0;
-  peer_connections_[stage_device_id] = std::make_shared<PeerConnection>(configuration_, polite);
+  AudioCodecCapabilities codec_capabilities;
+  {
+    std::lock_guard<std::mutex> lock(codec_capabilities_mutex_);
+    codec_capabilities = codec_capabilities_;
+  }
+  peer_connections_[stage_device_id] =
+      std::make_shared<PeerConnection>(configuration_, polite, getCurrentAudioChannelMode(), codec_capabilities);
   peer_connections_[stage_device_id]->onLocalIceCandidate = [this, local_stage_device_id, stage_device_id](
       const DigitalStage::Types::IceCandidateInit &ice_candidate_init) {
     DigitalStage::Types::IceCandidate ice_candidate;
@@ -223,38 +257,483 @@ void ConnectionService::createPeerConnection(const std::string &stage_device_id,
   };
   peer_connections_[stage_device_id]->onData = [this](const std::string &audio_track_id,
                                                       const std::vector<std::byte> &values) {
-    onData(audio_track_id, values);
+    onData(track_interner_->intern(audio_track_id), values);
   };
   PLOGI << "Connected to " << peer_connections_.size() << " peers";
 }
 void ConnectionService::closePeerConnection(const std::string &stage_device_id) {
+  auto peer = peer_connections_.find(stage_device_id);
+  if (peer != peer_connections_.end()) {
+    // Drop the cached handles, a new peer may be allocated at the same address
+    std::lock_guard<std::mutex> lock(send_tracks_mutex_);
+    for (auto &track: send_tracks_) {
+      track.second.senders.erase(peer->second.get());
+    }
+  }
   peer_connections_.erase(stage_device_id);
   assert(!peer_connections_.count(stage_device_id));
 }
-void ConnectionService::broadcastBytes(const std::string &audio_track_id,
-                                       const std::byte *data,
-                                       const std::size_t size) {
+void ConnectionService::open(TrackHandle audio_track) {
+  if (const auto queues = send_queues_.read(); audio_track < queues->size() && (*queues)[audio_track]) {
+    return;
+  }
+  auto queue = std::make_shared<SendQueue>(kSendQueueDepth);
+  send_queues_.update([audio_track, &queue](SendQueues &queues) {
+    if (audio_track >= queues.size()) {
+      queues.resize(audio_track + 1);
+    }
+    if (!queues[audio_track]) {
+      queues[audio_track] = std::move(queue);
+    }
+  });
+}
+
+template<class Fill>
+void ConnectionService::enqueue(TrackHandle audio_track, const std::size_t size, Fill &&fill) {
+  // Larger blocks than a slot holds are queued in pieces
+  const auto pieces = (size + OutboundBlock::kMaxFrameCount - 1) / OutboundBlock::kMaxFrameCount;
+  auto queues = send_queues_.read();
+  if (audio_track >= queues->size() || !(*queues)[audio_track]) {
+    send_queue_dropped_ += pieces;
+    return;
+  }
+  auto &queue = *(*queues)[audio_track];
+  const auto enqueued = std::chrono::steady_clock::now();
+  for (std::size_t offset = 0; offset < size; offset += OutboundBlock::kMaxFrameCount) {
+    const auto frame_count = std::min(size - offset, OutboundBlock::kMaxFrameCount);
+    send_queue_dropped_ += queue.push([&](OutboundBlock &block) {
+      block.audio_track = audio_track;
+      block.frame_count = frame_count;
+      block.enqueued = enqueued;
+      fill(block, offset);
+    });
+  }
+  // Either the network thread sees the block when it checks the queues before sleeping, or we see it sleeping
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (is_send_thread_waiting_.load(std::memory_order_relaxed) && is_send_thread_waiting_.exchange(false)) {
+    // The network thread holds the mutex from announcing until it sleeps, so the notification cannot fall in between
+    {
+      std::lock_guard<std::mutex> lock(send_queue_mutex_);
+    }
+    send_queue_signal_.notify_one();
+  }
+}
+
+void ConnectionService::broadcastFloats(TrackHandle audio_track, const float *data, const std::size_t size) {
+  enqueue(audio_track, size, [data](OutboundBlock &block, std::size_t offset) {
+    block.silent = false;
+    std::copy(&data[offset], &data[offset + block.frame_count], block.samples.begin());
+  });
+}
+
+void ConnectionService::broadcastSilence(TrackHandle audio_track, const std::size_t size) {
+  enqueue(audio_track, size, [](OutboundBlock &block, std::size_t) {
+    block.silent = true;
+  });
+}
+
+void ConnectionService::send() {
+  // Owned by the network thread, so the block is not allocated per block
+  auto block = std::make_unique<OutboundBlock>();
+  const auto take = [&block](OutboundBlock &queued) {
+    block->audio_track = queued.audio_track;
+    block->frame_count = queued.frame_count;
+    block->silent = queued.silent;
+    block->enqueued = queued.enqueued;
+    if (!queued.silent) {
+      std::copy(queued.samples.begin(), queued.samples.begin() + queued.frame_count, block->samples.begin());
+    }
+  };
+  std::size_t next_track = 0;
+  while (is_sending_) {
+    bool popped = false;
+    {
+      // One block per turn and track, so every track gets its share when the network falls behind
+      auto queues = send_queues_.read();
+      const auto track_count = queues->size();
+      for (std::size_t turn = 0; turn < track_count && !popped; turn++) {
+        const auto audio_track = (next_track + turn) % track_count;
+        if (const auto &queue = (*queues)[audio_track]) {
+          popped = queue->pop(take);
+          next_track = audio_track + 1;
+        }
+      }
+    }
+    if (!popped) {
+      // Sleep until a block is queued, the audio threads only wake us if we announced it
+      std::unique_lock<std::mutex> lock(send_queue_mutex_);
+      while (is_sending_) {
+        // Announced again after every wakeup, a waker of an earlier round may have cleared it meanwhile
+        is_send_thread_waiting_ = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (hasQueuedBlocks())
+          break;
+        send_queue_signal_.wait(lock);
+      }
+      is_send_thread_waiting_ = false;
+      continue;
+    }
+    const auto latency = static_cast<std::size_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - block->enqueued).count());
+    send_queue_blocks_++;
+    send_queue_latency_ns_ += latency;
+    if (latency > send_queue_max_latency_ns_) {
+      send_queue_max_latency_ns_ = latency;
+    }
+    if (block->silent) {
+      sendSilence(block->audio_track, block->frame_count);
+    } else {
+      sendFloats(block->audio_track, block->samples.data(), block->frame_count);
+    }
+  }
+}
+
+bool ConnectionService::hasQueuedBlocks() const {
+  auto queues = send_queues_.read();
+  return std::any_of(queues->begin(), queues->end(), [](const auto &queue) {
+    return queue && queue->size() > 0;
+  });
+}
+
+SendQueueStatistics ConnectionService::getSendQueueStatistics() const {
+  const std::size_t blocks = send_queue_blocks_;
+  std::size_t depth = 0;
+  std::size_t capacity = 0;
+  {
+    auto queues = send_queues_.read();
+    for (const auto &queue: *queues) {
+      if (queue) {
+        depth += queue->size();
+        capacity += queue->capacity();
+      }
+    }
+  }
+  return {
+      depth,
+      capacity,
+      send_queue_dropped_,
+      blocks,
+      blocks > 0 ? static_cast<double>(send_queue_latency_ns_) / 1000.0 / static_cast<double>(blocks) : 0.0,
+      static_cast<double>(send_queue_max_latency_ns_) / 1000.0
+  };
+}
+
+void ConnectionService::sendFloats(TrackHandle audio_track, const float *data, const std::size_t size) {
+  std::shared_lock<std::shared_mutex> shared_lock(peer_connections_mutex_);
+  std::lock_guard<std::mutex> lock(send_tracks_mutex_);
+  auto &track = getSendTrack(audio_track);
+  const auto timestamp = track.timestamp;
+  track.timestamp += static_cast<std::uint32_t>(size);
+
+  // Each codec encodes the block only once
+  collectSenders(track);
+  for (const auto &stream: track.streams) {
+    if (!stream->senders.empty()) {
+      sendBlock(*stream, data, size, timestamp);
+    }
+  }
+  sendLegacyBlock(track, data, size);
+}
+
+void ConnectionService::sendSilence(TrackHandle audio_track, const std::size_t size) {
   std::shared_lock<std::shared_mutex> shared_lock(peer_connections_mutex_);
+  std::lock_guard<std::mutex> lock(send_tracks_mutex_);
+  auto &track = getSendTrack(audio_track);
+  const auto timestamp = track.timestamp;
+  track.timestamp += static_cast<std::uint32_t>(size);
+
+  collectSenders(track);
+  for (const auto &stream: track.streams) {
+    if (!stream->senders.empty()) {
+      sendSilentBlock(*stream, size, timestamp);
+    }
+  }
+  sendLegacyBlock(track, nullptr, size);
+}
+
+void ConnectionService::collectSenders(SendTrack &track) {
+  for (const auto &stream: track.streams) {
+    stream->senders.clear();
+  }
+  track.legacy_senders.clear();
   for (const auto &item: peer_connections_) {
     if (item.second) {
-      item.second->send(audio_track_id, data, size);
+      if (auto *sender = getSender(track, *item.second)) {
+        if (item.second->isFramingSupported()) {
+          getSendStream(track, item.second->getSendCodec()).senders.push_back(sender);
+        } else {
+          // Would read our header as samples
+          track.legacy_senders.push_back(sender);
+        }
+      }
     }
   }
+  for (const auto &stream: track.streams) {
+    if (stream->senders.empty()) {
+      // Nobody listens anymore, so start with a fresh frame when somebody does again
+      stream->pending_count = 0;
+    }
+  }
+}
+
+ConnectionService::SendTrack &ConnectionService::getSendTrack(TrackHandle audio_track) {
+  auto track = send_tracks_.find(audio_track);
+  if (track == send_tracks_.end()) {
+    // Start the timeline at the current wall clock, so tracks of the same device line up
+    const auto now = std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    auto timestamp = static_cast<std::uint32_t>(static_cast<std::uint64_t>(now * sample_rate_));
+    track = send_tracks_.emplace(audio_track, SendTrack{&track_interner_->getId(audio_track), timestamp, {}, {}}).first;
+  }
+  return track->second;
 }
 
-void ConnectionService::broadcastFloats(const std::string &audio_track_id, const float *data, const std::size_t size) {
-  std::size_t buffer_size = size * 4;
-  auto *buffer = new std::byte[buffer_size];
-  serialize(data, size, buffer);
-  broadcastBytes(audio_track_id, buffer, buffer_size);
+AudioSender *ConnectionService::getSender(SendTrack &track, PeerConnection &peer) {
+  auto &sender = track.senders[&peer];
+  if (!sender || !sender->isValid()) {
+    sender = peer.getSender(*track.audio_track_id);
+  }
+  return sender.get();
 }
 
-void ConnectionService::close(const std::string &audio_track_id) {
+ConnectionService::SendStream &ConnectionService::getSendStream(SendTrack &track,
+                                                                const AudioCodecSettings &settings) {
+  for (const auto &stream: track.streams) {
+    if (stream->settings == settings) {
+      return *stream;
+    }
+  }
+  auto stream = std::make_unique<SendStream>();
+  stream->settings = settings;
+  if (settings.type != AudioCodecType::kPcm) {
+    stream->encoder = createAudioEncoder(settings, sample_rate_);
+    if (!stream->encoder) {
+      PLOGW << "Codec " << getAudioCodecName(settings.type) << " is not available, sending plain samples instead";
+    } else {
+      stream->pending.resize(stream->encoder->getFrameSize());
+    }
+  }
+  track.streams.push_back(std::move(stream));
+  return *track.streams.back();
+}
+
+void ConnectionService::sendBlock(SendStream &stream,
+                                  const float *data,
+                                  const std::size_t size,
+                                  const std::uint32_t timestamp) {
+  AudioPacketHeader header;
+  header.sample_rate = sample_rate_;
+  if (!stream.encoder) {
+    header.frame_count = static_cast<std::uint16_t>(size);
+    header.sample_format = wire_format_;
+    header.timestamp = timestamp;
+    const auto start = std::chrono::steady_clock::now();
+    const auto payload_size = encodeSamples(header.sample_format, data, size, &send_buffer_[kAudioPacketHeaderSize]);
+    stream.meter.add(size, payload_size, std::chrono::steady_clock::now() - start);
+    sendPacket(stream, header, payload_size);
+    return;
+  }
+  header.codec = stream.settings.type;
+  auto *payload = &send_buffer_[kAudioPacketHeaderSize];
+  const auto capacity = send_buffer_.size() - kAudioPacketHeaderSize;
+  const auto frame_size = stream.encoder->getFrameSize();
+  if (frame_size == 0) {
+    // Encoder takes the block as it is
+    header.frame_count = static_cast<std::uint16_t>(size);
+    header.timestamp = timestamp;
+    const auto start = std::chrono::steady_clock::now();
+    const auto payload_size = stream.encoder->encode(data, size, payload, capacity);
+    stream.meter.add(size, payload_size, std::chrono::steady_clock::now() - start);
+    if (payload_size > 0) {
+      sendPacket(stream, header, payload_size);
+    }
+    return;
+  }
+  // Collect complete codec frames, the remainder is sent with the next block
+  header.frame_count = static_cast<std::uint16_t>(frame_size);
+  std::size_t offset = 0;
+  while (offset < size) {
+    if (stream.pending_count == 0) {
+      stream.pending_timestamp = timestamp + static_cast<std::uint32_t>(offset);
+    }
+    const auto count = std::min(frame_size - stream.pending_count, size - offset);
+    std::copy(&data[offset], &data[offset + count], &stream.pending[stream.pending_count]);
+    stream.pending_count += count;
+    offset += count;
+    if (stream.pending_count == frame_size) {
+      header.timestamp = stream.pending_timestamp;
+      const auto start = std::chrono::steady_clock::now();
+      const auto payload_size = stream.encoder->encode(stream.pending.data(), frame_size, payload, capacity);
+      stream.meter.add(frame_size, payload_size, std::chrono::steady_clock::now() - start);
+      stream.pending_count = 0;
+      if (payload_size > 0) {
+        sendPacket(stream, header, payload_size);
+      }
+    }
+  }
+}
+
+void ConnectionService::sendSilentBlock(SendStream &stream, const std::size_t size, const std::uint32_t timestamp) {
+  // The track only turns idle after a while below the threshold, so the frames waiting for a codec frame are
+  // silent as well and go with this block instead of being padded and encoded
+  AudioPacketHeader header;
+  header.sample_rate = sample_rate_;
+  header.sample_format = wire_format_;
+  header.silent = true;
+  header.timestamp = stream.pending_count > 0 ? stream.pending_timestamp : timestamp;
+  auto remaining = stream.pending_count + size;
+  stream.pending_count = 0;
+  while (remaining > 0) {
+    // Receivers place at most one maximum block per packet
+    const auto frame_count = std::min(remaining, OutboundBlock::kMaxFrameCount);
+    header.frame_count = static_cast<std::uint16_t>(frame_count);
+    sendPacket(stream, header, 0);
+    header.timestamp += static_cast<std::uint32_t>(frame_count);
+    remaining -= frame_count;
+  }
+  const auto bytes_per_frame = stream.encoder ? stream.meter.getBytesPerFrame()
+                                              : static_cast<double>(getBytesPerSample(wire_format_));
+  stream.silent_frames += size;
+  stream.saved_bytes += static_cast<std::size_t>(bytes_per_frame * static_cast<double>(size));
+}
+
+void ConnectionService::sendPacket(SendStream &stream,
+                                   const AudioPacketHeader &header,
+                                   const std::size_t payload_size) {
+  AudioPacketHeader sequenced = header;
+  sequenced.sequence = stream.sequence++;
+  encodeAudioPacketHeader(sequenced, send_buffer_.data());
+  for (auto *sender: stream.senders) {
+    sender->send(send_buffer_.data(), kAudioPacketHeaderSize + payload_size);
+  }
+}
+
+void ConnectionService::sendLegacyBlock(const SendTrack &track, const float *data, const std::size_t size) {
+  if (track.legacy_senders.empty()) {
+    return;
+  }
+  if (data) {
+    encodeSamples(AudioSampleFormat::kFloat32, data, size, send_buffer_.data());
+  } else {
+    std::fill(send_buffer_.begin(), send_buffer_.begin() + size * sizeof(float), std::byte{0});
+  }
+  for (auto *sender: track.legacy_senders) {
+    sender->send(send_buffer_.data(), size * sizeof(float));
+  }
+}
+
+void ConnectionService::setSampleRate(unsigned int sample_rate) {
+  sample_rate_ = sample_rate;
+  {
+    // The encoders are bound to the sample rate
+    std::lock_guard<std::mutex> lock(send_tracks_mutex_);
+    send_tracks_.clear();
+  }
+  // and so are the codecs we are able to send with
+  AudioCodecCapabilities codec_capabilities;
+  {
+    std::lock_guard<std::mutex> lock(codec_capabilities_mutex_);
+    codec_capabilities_.sample_rate = sample_rate;
+    codec_capabilities = codec_capabilities_;
+  }
+  std::shared_lock<std::shared_mutex> shared_lock(peer_connections_mutex_);
+  for (const auto &item: peer_connections_) {
+    item.second->setCodecCapabilities(codec_capabilities);
+  }
+}
+
+void ConnectionService::setPreferredCodecs(const std::vector<AudioCodecType> &codecs,
+                                           int max_bitrate,
+                                           double frame_duration_ms) {
+  AudioCodecCapabilities codec_capabilities{codecs, max_bitrate, frame_duration_ms};
+  {
+    std::lock_guard<std::mutex> lock(codec_capabilities_mutex_);
+    codec_capabilities.sample_rate = codec_capabilities_.sample_rate;
+    codec_capabilities_ = codec_capabilities;
+  }
+  std::shared_lock<std::shared_mutex> shared_lock(peer_connections_mutex_);
+  for (const auto &item: peer_connections_) {
+    item.second->setCodecCapabilities(codec_capabilities);
+  }
+}
+
+std::map<std::string, SilenceStatistics> ConnectionService::getSilenceStatistics() {
+  std::map<std::string, SilenceStatistics> statistics;
+  std::lock_guard<std::mutex> lock(send_tracks_mutex_);
+  for (const auto &track: send_tracks_) {
+    auto &entry = statistics[*track.second.audio_track_id];
+    for (const auto &stream: track.second.streams) {
+      // Every stream sends the same frames
+      entry.silent_frames = std::max(entry.silent_frames, stream->silent_frames);
+      entry.saved_bytes += stream->saved_bytes;
+    }
+  }
+  return statistics;
+}
+
+std::vector<AudioCodecStatistics> ConnectionService::getCodecStatistics() {
+  std::vector<AudioCodecStatistics> statistics;
+  std::lock_guard<std::mutex> lock(send_tracks_mutex_);
+  for (const auto &track: send_tracks_) {
+    for (const auto &stream: track.second.streams) {
+      const auto type = stream->encoder ? stream->settings.type : AudioCodecType::kPcm;
+      statistics.push_back(stream->meter.getStatistics(*track.second.audio_track_id, type, true, sample_rate_));
+    }
+  }
+  return statistics;
+}
+
+void ConnectionService::setWireFormat(AudioSampleFormat wire_format) {
+  PLOGD << "setWireFormat " << static_cast<int>(wire_format);
+  wire_format_ = wire_format;
+}
+
+void ConnectionService::close(TrackHandle audio_track) {
+  // Freed as soon as neither the audio thread nor the network thread sees it anymore, queued blocks are dropped
+  send_queues_.update([audio_track](SendQueues &queues) {
+    if (audio_track < queues.size()) {
+      queues[audio_track].reset();
+    }
+  });
+  {
+    std::lock_guard<std::mutex> lock(send_tracks_mutex_);
+    send_tracks_.erase(audio_track);
+  }
+  const auto &audio_track_id = track_interner_->getId(audio_track);
   for (const auto &item: peer_connections_) {
     item.second->close(audio_track_id);
   }
 }
 
+void ConnectionService::setAudioChannelMode(const std::string &stage_id, const AudioChannelMode &audio_channel_mode) {
+  {
+    std::lock_guard<std::mutex> lock(audio_channel_modes_mutex_);
+    audio_channel_modes_[stage_id] = audio_channel_mode;
+  }
+  auto store_ptr = client_->getStore();
+  if (store_ptr.expired()) {
+    return;
+  }
+  auto current_stage_id = store_ptr.lock()->getStageId();
+  if (current_stage_id && *current_stage_id == stage_id) {
+    std::shared_lock<std::shared_mutex> shared_lock(peer_connections_mutex_);
+    for (const auto &item: peer_connections_) {
+      item.second->setAudioChannelMode(audio_channel_mode);
+    }
+  }
+}
+
+AudioChannelMode ConnectionService::getCurrentAudioChannelMode() {
+  auto store_ptr = client_->getStore();
+  if (!store_ptr.expired()) {
+    auto stage_id = store_ptr.lock()->getStageId();
+    std::lock_guard<std::mutex> lock(audio_channel_modes_mutex_);
+    if (stage_id && audio_channel_modes_.count(*stage_id)) {
+      return audio_channel_modes_[*stage_id];
+    }
+  }
+  return AudioChannelMode::Unreliable();
+}
+
 bool ConnectionService::IsSupported(const DigitalStage::Api::StageDevice& stage_device) {
   return stage_device.type == "native" || stage_device.type == "browser";
 }
@@ -262,6 +741,9 @@ bool ConnectionService::IsSupported(const DigitalStage::Api::StageDevice& stage_
 void ConnectionService::fetchStatistics() {
   while (is_fetching_statistics_) {
     std::this_thread::sleep_for(std::chrono::seconds(2));
+    auto queue = getSendQueueStatistics();
+    PLOGD << "Send queue: " << queue.depth << "/" << queue.capacity << " blocks, " << queue.dropped << " dropped, "
+          << queue.average_latency_us << "us average and " << queue.max_latency_us << "us maximum latency";
     for (const auto &item: peer_connections_) {
       auto time = item.second->getRoundTripTime();
       auto store_ptr = client_->getStore();
@@ -7,29 +7,114 @@
 
 #include "rtc/rtc.hpp"
 #include "PeerConnection.h"
+#include "AudioPacket.h"
+#include "../utils/DropOldestQueue.h"
+#include "../utils/Rcu.h"
+#include "../utils/TrackInterner.h"
 #include <DigitalStage/Api/Client.h>
 #include <DigitalStage/Api/Store.h>
 #include <DigitalStage/Types.h>
 #include <nlohmann/json.hpp>
+#include <map>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include <memory>
 #include <plog/Log.h>
 #include <sigslot/signal.hpp>
 #include <mutex>
 #include <shared_mutex>
+#include <condition_variable>
+#include <array>
+#include <chrono>
+
+/**
+ * State of the outbound queues between the audio callbacks and the network thread, summed over all tracks.
+ */
+struct SendQueueStatistics {
+  std::size_t depth;  // blocks currently waiting
+  std::size_t capacity;
+  std::size_t dropped;  // blocks dropped because the network thread fell behind
+  std::size_t blocks;  // blocks sent
+  double average_latency_us;  // from broadcastFloats until the network thread picked the block up
+  double max_latency_us;
+};
+
+/**
+ * Silence sent by a local track instead of full blocks while it was idle.
+ */
+struct SilenceStatistics {
+  std::size_t silent_frames;
+  std::size_t saved_bytes;  // payload not sent, estimated from the average payload of each codec
+};
 
 class ConnectionService {
  public:
-  explicit ConnectionService(std::shared_ptr<DigitalStage::Api::Client> client);
+  ConnectionService(std::shared_ptr<DigitalStage::Api::Client> client, std::shared_ptr<TrackInterner> track_interner);
   ~ConnectionService();
 
-  void broadcastBytes(const std::string &audio_track_id, const std::byte *data, size_t size);
-  void broadcastFloats(const std::string &audio_track_id, const float *data, size_t size);
+  /**
+   * Prepares the send queue of a local track, call it before the track is broadcast.
+   * Each track has a queue of its own, so a track the network thread cannot keep up with only drops its own blocks.
+   */
+  void open(TrackHandle audio_track);
+  /**
+   * Queues the given block to be sent as framed audio packet (see AudioPacket.h) to all peers,
+   * or as plain float32 samples to peers which never announced framing support.
+   * Allocation free and lock-free while the network thread is busy, so this is safe to call from the audio callbacks.
+   * Only if the network thread sleeps, its mutex is taken briefly to wake it.
+   * The network thread encodes and sends the block, if it falls behind the oldest queued blocks of the track are
+   * dropped.
+   * Blocks of a track which has not been opened are dropped as well.
+   */
+  void broadcastFloats(TrackHandle audio_track, const float *data, size_t size);
+  /**
+   * Same as above for a block of an idle track, which is sent as header-only silence packet instead.
+   * Legacy peers get zeros.
+   */
+  void broadcastSilence(TrackHandle audio_track, size_t size);
+
+  SendQueueStatistics getSendQueueStatistics() const;
+
+  /**
+   * @return silence sent per local track
+   */
+  std::map<std::string, SilenceStatistics> getSilenceStatistics();
+
+  /**
+   * Sample rate written into the header of all outgoing audio packets.
+   */
+  void setSampleRate(unsigned int sample_rate);
+
+  /**
+   * Sample format of all outgoing audio packets. Receivers decode whatever the header announces,
+   * so this only trades precision for bandwidth (float16 and int16 halve it, int24 saves a quarter).
+   */
+  void setWireFormat(AudioSampleFormat wire_format);
 
-  void close(const std::string &audio_track_id);
+  /**
+   * Codecs we are able and willing to receive, in order of preference, and the bitrate we ask peers to send with.
+   * The frame duration applies to the lossy codecs we send with.
+   */
+  void setPreferredCodecs(const std::vector<AudioCodecType> &codecs, int max_bitrate, double frame_duration_ms);
 
-  sigslot::signal<std::string, std::vector<std::byte>> onData;
+  /**
+   * @return encoding cost and bitrate of every stream sent, one entry per track and codec
+   */
+  std::vector<AudioCodecStatistics> getCodecStatistics();
+
+  void close(TrackHandle audio_track);
+
+  /**
+   * Sets the delivery mode of audio data channels for the given stage.
+   * Stages without an explicit mode use unordered channels without retransmits.
+   */
+  void setAudioChannelMode(const std::string &stage_id, const AudioChannelMode &audio_channel_mode);
+
+  /**
+   * Emitted by the network threads with every packet received, the track is interned on its first packet.
+   */
+  sigslot::signal<TrackHandle, std::vector<std::byte>> onData;
  private:
   static bool IsSupported(const DigitalStage::Api::StageDevice& stage_device);
   void attachHandlers();
@@ -38,17 +123,112 @@ class ConnectionService {
                             const std::string &local_stage_device_id);
   void closePeerConnection(const std::string &stage_device_id);
   void fetchStatistics();
+  AudioChannelMode getCurrentAudioChannelMode();
+
+  /**
+   * A track encoded with specific codec settings, shared by all peers negotiating the same settings.
+   */
+  struct SendStream {
+    AudioCodecSettings settings;
+    std::unique_ptr<AudioEncoder> encoder;  // nullptr = plain samples in the wire format
+    std::vector<float> pending;  // frames waiting for a complete codec frame
+    std::size_t pending_count = 0;
+    std::uint32_t pending_timestamp = 0;
+    std::uint32_t sequence = 0;
+    AudioCodecMeter meter;
+    std::size_t silent_frames = 0;
+    std::size_t saved_bytes = 0;
+    std::vector<AudioSender *> senders;  // receivers of the current block
+  };
+  struct SendTrack {
+    const std::string *audio_track_id;  // owned by the interner
+    std::uint32_t timestamp;
+    std::vector<std::unique_ptr<SendStream>> streams;
+    // Send handles of this track, resolved once per peer
+    std::unordered_map<const PeerConnection *, std::shared_ptr<AudioSender>> senders;
+    // Receivers of the current block not announcing framing support, they get plain float32 samples
+    std::vector<AudioSender *> legacy_senders;
+  };
+  /**
+   * A captured block waiting for the network thread, sized for the largest block so the audio thread never allocates.
+   */
+  struct OutboundBlock {
+    static constexpr std::size_t kMaxFrameCount = 4096;
+    TrackHandle audio_track;
+    std::size_t frame_count;
+    bool silent;  // samples are not set
+    std::chrono::steady_clock::time_point enqueued;
+    std::array<float, kMaxFrameCount> samples;
+  };
+  static constexpr std::size_t kSendQueueDepth = 16;  // blocks per track
+  using SendQueue = DropOldestQueue<OutboundBlock>;
+  using SendQueues = std::vector<std::shared_ptr<SendQueue>>;  // indexed by track handle
+  /**
+   * Queues the given block on the queue of its track, filled in place by fill(OutboundBlock &slot).
+   */
+  template<class Fill>
+  void enqueue(TrackHandle audio_track, std::size_t size, Fill &&fill);
+  [[nodiscard]] bool hasQueuedBlocks() const;
+  void send();
+  /**
+   * Encodes the given block once per negotiated codec and sends it to all peers, called by the network thread.
+   * Encoders with a fixed frame size (Opus) buffer up to one frame.
+   */
+  void sendFloats(TrackHandle audio_track, const float *data, size_t size);
+  void sendSilence(TrackHandle audio_track, size_t size);
+  /**
+   * Groups the peers listening to the given track by their codec, legacy peers apart.
+   */
+  void collectSenders(SendTrack &track);
+  SendTrack &getSendTrack(TrackHandle audio_track);
+  SendStream &getSendStream(SendTrack &track, const AudioCodecSettings &settings);
+  static AudioSender *getSender(SendTrack &track, PeerConnection &peer);
+  void sendBlock(SendStream &stream, const float *data, std::size_t size, std::uint32_t timestamp);
+  /**
+   * Sends the given number of silent frames, together with the frames still waiting for a codec frame.
+   */
+  void sendSilentBlock(SendStream &stream, std::size_t size, std::uint32_t timestamp);
+  void sendPacket(SendStream &stream, const AudioPacketHeader &header, std::size_t payload_size);
+  /**
+   * Sends the given block as plain float32 samples without any header, silence if data is nullptr.
+   */
+  void sendLegacyBlock(const SendTrack &track, const float *data, std::size_t size);
 
   std::shared_ptr<DigitalStage::Api::Client> client_;
+  std::shared_ptr<TrackInterner> track_interner_;
   std::unordered_map<std::string, std::shared_ptr<PeerConnection>> peer_connections_;
   std::shared_mutex peer_connections_mutex_;
 
   rtc::Configuration configuration_;
 
+  std::unordered_map<std::string, AudioChannelMode> audio_channel_modes_;
+  std::mutex audio_channel_modes_mutex_;
+
+  std::unordered_map<TrackHandle, SendTrack> send_tracks_;
+  std::mutex send_tracks_mutex_;
+  std::atomic<unsigned int> sample_rate_;
+  std::atomic<AudioSampleFormat> wire_format_;
+  // Sized for the largest possible packet and reused for every packet, guarded by send_tracks_mutex_
+  std::vector<std::byte> send_buffer_;
+
+  AudioCodecCapabilities codec_capabilities_;
+  std::mutex codec_capabilities_mutex_;
+
   std::shared_ptr<DigitalStage::Api::Client::Token> token_;
 
   std::thread statistics_thread_;
   std::atomic<bool> is_fetching_statistics_;
+
+  Rcu<SendQueues> send_queues_;
+  std::mutex send_queue_mutex_;
+  std::condition_variable send_queue_signal_;
+  std::atomic<bool> is_send_thread_waiting_;  // set by the network thread before it sleeps, cleared by its waker
+  std::atomic<std::size_t> send_queue_dropped_;
+  std::atomic<std::size_t> send_queue_blocks_;
+  std::atomic<std::size_t> send_queue_latency_ns_;
+  std::atomic<std::size_t> send_queue_max_latency_ns_;
+  std::atomic<bool> is_sending_;
+  std::thread send_thread_;
 };
 
 #endif //CLIENT_SRC_WEBRTC_CONNECTIONSERVICE_H_
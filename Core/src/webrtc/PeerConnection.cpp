@@ -3,9 +3,20 @@
 //
 
 #include "PeerConnection.h"
+#include <nlohmann/json.hpp>
 
-PeerConnection::PeerConnection(const rtc::Configuration &configuration, bool polite) :
+namespace {
+const char *const kControlChannelLabel = "ds-control";
+}
+
+PeerConnection::PeerConnection(const rtc::Configuration &configuration,
+                               bool polite,
+                               AudioChannelMode audio_channel_mode,
+                               AudioCodecCapabilities codec_capabilities) :
     peer_connection_(std::make_unique<rtc::PeerConnection>(configuration)),
+    audio_channel_mode_(audio_channel_mode),
+    codec_capabilities_(std::move(codec_capabilities)),
+    remote_framing_(false),
     polite_(polite),
     making_offer_(false),
     ignore_offer_(false),
@@ -44,6 +55,16 @@ PeerConnection::PeerConnection(const rtc::Configuration &configuration, bool pol
 
   peer_connection_->onDataChannel([this](const std::shared_ptr<rtc::DataChannel> &incoming) {
     auto label = incoming->label();
+    if (label == kControlChannelLabel) {
+      {
+        std::unique_lock<std::mutex> lock(receivers_mutex_);
+        receivers_[label] = incoming;
+      }
+      handleControlChannel(incoming);
+      // Incoming channels are already open
+      sendCodecCapabilities(incoming);
+      return;
+    }
     std::unique_lock<std::mutex> lock(receivers_mutex_);
     receivers_[label] = incoming;
     receivers_[label]->onMessage([this, label](const rtc::message_variant &message_variant) {
@@ -150,31 +171,196 @@ void PeerConnection::handleLocalSessionDescription(const rtc::Description &descr
     }
   }
 }
-void PeerConnection::send(const std::string &audio_track_id, const std::byte *data, const size_t size) {
-  std::unique_lock<std::mutex> lock(senders_mutex_);
+AudioSender::AudioSender(std::shared_ptr<rtc::DataChannel> channel) :
+    channel_(std::move(channel)),
+    valid_(true) {}
+
+void AudioSender::send(const std::byte *data, const size_t size) {
   try {
-    if (senders_.count(audio_track_id) == 0) {
-      PLOGD << "Creating send data channel";
-      senders_[audio_track_id] = peer_connection_->createDataChannel(audio_track_id);
-    }
-    // fire and forget
-    if (senders_[audio_track_id]->isOpen()) {
-      senders_[audio_track_id]->send(data, size);
+    if (channel_->isOpen()) {
+      channel_->send(data, size);
     }
   } catch (std::exception &err) {
     PLOGW << "Could not send: " << err.what();
   }
 }
+
+bool AudioSender::isValid() const {
+  return valid_;
+}
+
+void AudioSender::close() {
+  valid_ = false;
+  try {
+    if (channel_->isOpen()) {
+      channel_->close();
+    }
+  } catch (std::exception &err) {
+    PLOGW << "Could not close: " << err.what();
+  }
+}
+
+std::shared_ptr<AudioSender> PeerConnection::getSender(const std::string &audio_track_id) {
+  std::unique_lock<std::mutex> lock(senders_mutex_);
+  auto sender = senders_.find(audio_track_id);
+  if (sender != senders_.end()) {
+    return sender->second;
+  }
+  try {
+    PLOGD << "Creating send data channel";
+    if (!control_channel_) {
+      rtc::DataChannelInit init;
+      init.reliability.type = rtc::Reliability::Type::Reliable;
+      control_channel_ = peer_connection_->createDataChannel(kControlChannelLabel, init);
+      handleControlChannel(control_channel_);
+      control_channel_->onOpen([this]() {
+        std::shared_ptr<rtc::DataChannel> channel;
+        {
+          std::unique_lock<std::mutex> lock(senders_mutex_);
+          channel = control_channel_;
+        }
+        if (channel) {
+          sendCodecCapabilities(channel);
+        }
+      });
+    }
+    auto channel = peer_connection_->createDataChannel(audio_track_id, getDataChannelInit());
+    return senders_.emplace(audio_track_id, std::make_shared<AudioSender>(std::move(channel))).first->second;
+  } catch (std::exception &err) {
+    PLOGW << "Could not create send data channel: " << err.what();
+    return nullptr;
+  }
+}
+
+void PeerConnection::send(const std::string &audio_track_id, const std::byte *data, const size_t size) {
+  auto sender = getSender(audio_track_id);
+  if (sender) {
+    sender->send(data, size);
+  }
+}
 void PeerConnection::close(const std::string &audio_track_id) {
   std::unique_lock<std::mutex> lock(senders_mutex_);
-  if (senders_.count(audio_track_id) != 0 && senders_[audio_track_id]->isOpen()) {
-    try {
-      PLOGD << "Closing send data channel";
-      senders_[audio_track_id]->close();
-    } catch (std::exception &err) {
-      PLOGW << "Could not close: " << err.what();
+  auto sender = senders_.find(audio_track_id);
+  if (sender != senders_.end()) {
+    PLOGD << "Closing send data channel";
+    sender->second->close();
+    senders_.erase(sender);
+  }
+}
+
+void PeerConnection::setAudioChannelMode(const AudioChannelMode &audio_channel_mode) {
+  std::unique_lock<std::mutex> lock(senders_mutex_);
+  if (audio_channel_mode_ == audio_channel_mode) {
+    return;
+  }
+  audio_channel_mode_ = audio_channel_mode;
+  // Holders of the handles resolve new ones, which will be created with the new mode
+  for (const auto &item: senders_) {
+    item.second->close();
+  }
+  senders_.clear();
+}
+
+rtc::DataChannelInit PeerConnection::getDataChannelInit() const {
+  rtc::DataChannelInit init;
+  init.reliability.unordered = audio_channel_mode_.unordered;
+  switch (audio_channel_mode_.reliability) {
+    case AudioChannelMode::Reliability::kMaxRetransmits:init.reliability.type = rtc::Reliability::Type::Rexmit;
+      init.reliability.rexmit = audio_channel_mode_.max_retransmits;
+      break;
+    case AudioChannelMode::Reliability::kMaxPacketLifeTime:init.reliability.type = rtc::Reliability::Type::Timed;
+      init.reliability.rexmit = audio_channel_mode_.max_packet_life_time;
+      break;
+    default:init.reliability.type = rtc::Reliability::Type::Reliable;
+      break;
+  }
+  return init;
+}
+
+void PeerConnection::setCodecCapabilities(const AudioCodecCapabilities &codec_capabilities) {
+  {
+    std::unique_lock<std::mutex> lock(codec_mutex_);
+    codec_capabilities_ = codec_capabilities;
+    if (remote_codec_capabilities_) {
+      send_codec_ = negotiateAudioCodec(codec_capabilities_, *remote_codec_capabilities_);
     }
   }
+  std::shared_ptr<rtc::DataChannel> channel;
+  {
+    std::unique_lock<std::mutex> lock(senders_mutex_);
+    channel = control_channel_;
+  }
+  if (channel && channel->isOpen()) {
+    sendCodecCapabilities(channel);
+  }
+  std::unique_lock<std::mutex> lock(receivers_mutex_);
+  auto incoming = receivers_.find(kControlChannelLabel);
+  if (incoming != receivers_.end() && incoming->second->isOpen()) {
+    sendCodecCapabilities(incoming->second);
+  }
+}
+
+AudioCodecSettings PeerConnection::getSendCodec() {
+  std::unique_lock<std::mutex> lock(codec_mutex_);
+  return send_codec_;
+}
+
+bool PeerConnection::isFramingSupported() {
+  std::unique_lock<std::mutex> lock(codec_mutex_);
+  return remote_framing_;
+}
+
+void PeerConnection::handleControlChannel(const std::shared_ptr<rtc::DataChannel> &channel) {
+  channel->onMessage([this](const rtc::message_variant &message_variant) {
+    if (const auto *message = std::get_if<std::string>(&message_variant)) {
+      handleControlMessage(*message);
+    }
+  });
+}
+
+void PeerConnection::handleControlMessage(const std::string &message) {
+  try {
+    auto json = nlohmann::json::parse(message);
+    if (json.value("type", "") != "codecs") {
+      return;
+    }
+    AudioCodecCapabilities remote;
+    for (const auto &name: json.at("codecs")) {
+      auto type = getAudioCodecType(name.get<std::string>());
+      if (type) {
+        remote.codecs.push_back(*type);
+      }
+    }
+    remote.max_bitrate = json.value("maxBitrate", 0);
+    std::unique_lock<std::mutex> lock(codec_mutex_);
+    remote_framing_ = json.value("framing", 0) == kAudioPacketVersion;
+    remote_codec_capabilities_ = remote;
+    send_codec_ = negotiateAudioCodec(codec_capabilities_, remote);
+    PLOGI << "Sending " << getAudioCodecName(send_codec_.type) << " at " << send_codec_.bitrate << " bps";
+  } catch (const std::exception &err) {
+    PLOGW << "Invalid control message: " << err.what();
+  }
+}
+
+void PeerConnection::sendCodecCapabilities(const std::shared_ptr<rtc::DataChannel> &channel) {
+  nlohmann::json json;
+  {
+    std::unique_lock<std::mutex> lock(codec_mutex_);
+    std::vector<std::string> codecs;
+    for (const auto &type: codec_capabilities_.codecs) {
+      codecs.emplace_back(getAudioCodecName(type));
+    }
+    json["type"] = "codecs";
+    json["codecs"] = codecs;
+    json["maxBitrate"] = codec_capabilities_.max_bitrate;
+    // Version of the audio packets we are able to read, peers not announcing one get plain float32 samples
+    json["framing"] = kAudioPacketVersion;
+  }
+  try {
+    channel->send(json.dump());
+  } catch (std::exception &err) {
+    PLOGW << "Could not send codec capabilities: " << err.what();
+  }
 }
 
 std::optional<std::chrono::milliseconds> PeerConnection::getRoundTripTime() {
@@ -12,15 +12,107 @@
 #include <map>
 #include <plog/Log.h>
 #include <mutex>
+#include <atomic>
 #include <optional>
 #include <chrono>
+#include "../audio/AudioCodec.h"
+#include "AudioPacket.h"
+
+/**
+ * Delivery guarantees of the data channels used to send audio.
+ * Realtime audio should never wait for retransmissions, so the default is unordered without any retransmit.
+ */
+struct AudioChannelMode {
+  enum class Reliability {
+    kReliable,
+    kMaxRetransmits,
+    kMaxPacketLifeTime
+  };
+  bool unordered = true;
+  Reliability reliability = Reliability::kMaxRetransmits;
+  int max_retransmits = 0;
+  std::chrono::milliseconds max_packet_life_time{0};
+
+  static AudioChannelMode Reliable() {
+    return {false, Reliability::kReliable, 0, std::chrono::milliseconds(0)};
+  }
+  static AudioChannelMode Unreliable() {
+    return {true, Reliability::kMaxRetransmits, 0, std::chrono::milliseconds(0)};
+  }
+  static AudioChannelMode PartiallyReliable(std::chrono::milliseconds max_packet_life_time) {
+    return {true, Reliability::kMaxPacketLifeTime, 0, max_packet_life_time};
+  }
+
+  bool operator==(const AudioChannelMode &other) const {
+    return unordered == other.unordered && reliability == other.reliability
+        && max_retransmits == other.max_retransmits && max_packet_life_time == other.max_packet_life_time;
+  }
+  bool operator!=(const AudioChannelMode &other) const {
+    return !(*this == other);
+  }
+};
+
+/**
+ * Send handle of a single audio track. Resolve it once with PeerConnection::getSender and keep it,
+ * until isValid() turns false (the track has been closed or the channel mode changed).
+ */
+class AudioSender {
+ public:
+  explicit AudioSender(std::shared_ptr<rtc::DataChannel> channel);
+
+  /**
+   * Fire and forget, packets are dropped while the channel is not open yet.
+   */
+  void send(const std::byte *data, size_t size);
+
+  [[nodiscard]] bool isValid() const;
+
+ private:
+  friend class PeerConnection;
+  void close();
+
+  std::shared_ptr<rtc::DataChannel> channel_;
+  std::atomic<bool> valid_;
+};
 
 class PeerConnection {
  public:
-  PeerConnection(const rtc::Configuration &configuration, bool polite);
+  PeerConnection(const rtc::Configuration &configuration,
+                 bool polite,
+                 AudioChannelMode audio_channel_mode = AudioChannelMode::Unreliable(),
+                 AudioCodecCapabilities codec_capabilities = {getAvailableAudioCodecs()});
+
+  /**
+   * Changes the delivery mode of all audio data channels.
+   * Existing send channels are closed and will be recreated with the new mode on the next send.
+   */
+  void setAudioChannelMode(const AudioChannelMode &audio_channel_mode);
+
+  /**
+   * Changes what we announce to the remote peer, which in turn picks the codec it sends us.
+   * Also renegotiates the codec we send with.
+   */
+  void setCodecCapabilities(const AudioCodecCapabilities &codec_capabilities);
+
+  /**
+   * Codec to send audio to this peer with. PCM until the remote peer announced its capabilities.
+   */
+  AudioCodecSettings getSendCodec();
+
+  /**
+   * Whether the remote peer announced to understand framed audio packets (see AudioPacket.h).
+   * Until then, and forever for legacy peers, audio is sent as plain float32 samples.
+   */
+  bool isFramingSupported();
 
   //void makeOffer();
 
+  /**
+   * Returns the send handle of the given track, creating its data channel on first use.
+   * @return the handle or nullptr if the channel could not be created
+   */
+  std::shared_ptr<AudioSender> getSender(const std::string &audio_track_id);
+
   void send(const std::string &audio_track_id, const std::byte *data, size_t size);
 
   void close(const std::string &audio_track_id);
@@ -35,12 +127,25 @@ class PeerConnection {
   std::function<void(std::string, std::vector<std::byte>)> onData;
  private:
   void handleLocalSessionDescription(const rtc::Description &description);
+  [[nodiscard]] rtc::DataChannelInit getDataChannelInit() const;
+  void handleControlChannel(const std::shared_ptr<rtc::DataChannel> &channel);
+  void handleControlMessage(const std::string &message);
+  void sendCodecCapabilities(const std::shared_ptr<rtc::DataChannel> &channel);
 
   std::unique_ptr<rtc::PeerConnection> peer_connection_;
-  std::map<std::string, std::shared_ptr<rtc::DataChannel>> senders_;
+  std::map<std::string, std::shared_ptr<AudioSender>> senders_;
   std::mutex senders_mutex_;
+  AudioChannelMode audio_channel_mode_;
   std::map<std::string, std::shared_ptr<rtc::DataChannel>> receivers_;
   std::mutex receivers_mutex_;
+  // Reliable channel to exchange codec capabilities, created along with our first send channel
+  std::shared_ptr<rtc::DataChannel> control_channel_;
+
+  AudioCodecCapabilities codec_capabilities_;
+  std::optional<AudioCodecCapabilities> remote_codec_capabilities_;
+  AudioCodecSettings send_codec_;
+  bool remote_framing_;
+  std::mutex codec_mutex_;
 
   bool polite_;
   bool making_offer_;
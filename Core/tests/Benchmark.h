@@ -0,0 +1,42 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+
+/**
+ * Minimal timing for the benchmarks, which are plain executables printing one line per case.
+ * Each case runs a few rounds and the fastest one counts, it is the one least disturbed by the rest of the system.
+ */
+template<class Function>
+double measureNanoseconds(Function &&function, std::size_t iterations, std::size_t rounds = 5) {
+  double best = std::numeric_limits<double>::max();
+  for (std::size_t round = 0; round < rounds; round++) {
+    const auto start = std::chrono::steady_clock::now();
+    for (std::size_t iteration = 0; iteration < iterations; iteration++) {
+      function();
+    }
+    const auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    best = std::min(best, elapsed / static_cast<double>(iterations));
+  }
+  return best;
+}
+
+inline void report(const std::string &name, double nanoseconds, const std::string &unit) {
+  std::cout << std::left << std::setw(56) << name << std::right << std::setw(12) << std::fixed
+            << std::setprecision(2) << nanoseconds << " ns/" << unit << std::endl;
+}
+
+inline volatile double benchmark_sink;
+
+/**
+ * Keeps the compiler from dropping a computation whose result is never used.
+ */
+template<class T>
+void consume(const T &value) {
+  benchmark_sink = static_cast<double>(value);
+}
@@ -0,0 +1,67 @@
+#include "Benchmark.h"
+#include "audio/ChannelKernels.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * Compares the selected interleave kernels with the per-sample loops the audio backends used before,
+ * for the channel counts of a stereo interface up to a large multichannel one.
+ */
+namespace {
+constexpr std::size_t kFrameCount = 256;
+constexpr std::size_t kIterations = 20000;
+
+std::string name(const std::string &kernel, std::size_t channel_count) {
+  return kernel + " (" + std::to_string(channel_count) + " channels)";
+}
+
+void benchmark(std::size_t channel_count) {
+  std::vector<float> interleaved(channel_count * kFrameCount, 0.5f);
+  std::vector<std::vector<float>> planar(channel_count, std::vector<float>(kFrameCount));
+  std::vector<float *> outputs(channel_count);
+  std::vector<const float *> inputs(channel_count);
+  for (std::size_t channel = 0; channel < channel_count; channel++) {
+    outputs[channel] = planar[channel].data();
+    inputs[channel] = planar[channel].data();
+  }
+  const auto per_sample = [channel_count](double nanoseconds) {
+    return nanoseconds / static_cast<double>(channel_count * kFrameCount);
+  };
+
+  report(name("per-sample deinterleave", channel_count), per_sample(measureNanoseconds([&]() {
+    for (std::size_t frame = 0; frame < kFrameCount; frame++) {
+      for (std::size_t channel = 0; channel < channel_count; channel++) {
+        outputs[channel][frame] = interleaved[frame * channel_count + channel];
+      }
+    }
+    consume(outputs[0][0]);
+  }, kIterations)), "sample");
+  report(name(std::string(getChannelKernelsName()) + " deinterleave", channel_count),
+         per_sample(measureNanoseconds([&]() {
+           deinterleave(interleaved.data(), channel_count, outputs.data(), kFrameCount);
+           consume(outputs[0][0]);
+         }, kIterations)), "sample");
+
+  report(name("per-sample interleave", channel_count), per_sample(measureNanoseconds([&]() {
+    for (std::size_t frame = 0; frame < kFrameCount; frame++) {
+      for (std::size_t channel = 0; channel < channel_count; channel++) {
+        interleaved[frame * channel_count + channel] = inputs[channel][frame];
+      }
+    }
+    consume(interleaved[0]);
+  }, kIterations)), "sample");
+  report(name(std::string(getChannelKernelsName()) + " interleave", channel_count),
+         per_sample(measureNanoseconds([&]() {
+           interleave(inputs.data(), channel_count, interleaved.data(), kFrameCount);
+           consume(interleaved[0]);
+         }, kIterations)), "sample");
+}
+}
+
+int main() {
+  for (std::size_t channel_count: {2, 8, 32, 64}) {
+    benchmark(channel_count);
+  }
+  return 0;
+}
@@ -0,0 +1,82 @@
+#include "Check.h"
+#include "audio/ChannelKernels.h"
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace {
+constexpr float kUntouched = -42.0f;
+
+float sampleOf(std::size_t frame, std::size_t channel) {
+  return static_cast<float>(frame) * 0.001f - static_cast<float>(channel);
+}
+
+// Odd channel counts and frame counts that are no multiple of any vector width exercise the remainders
+void testDeinterleave(std::size_t channel_count, std::size_t frame_count) {
+  std::vector<float> input(channel_count * frame_count);
+  for (std::size_t frame = 0; frame < frame_count; frame++) {
+    for (std::size_t channel = 0; channel < channel_count; channel++) {
+      input[frame * channel_count + channel] = sampleOf(frame, channel);
+    }
+  }
+  std::vector<std::vector<float>> planar(channel_count, std::vector<float>(frame_count, kUntouched));
+  std::vector<float *> outputs(channel_count);
+  for (std::size_t channel = 0; channel < channel_count; channel++) {
+    // Skip every third channel
+    outputs[channel] = channel % 3 == 1 ? nullptr : planar[channel].data();
+  }
+  deinterleave(input.data(), channel_count, outputs.data(), frame_count);
+  for (std::size_t channel = 0; channel < channel_count; channel++) {
+    for (std::size_t frame = 0; frame < frame_count; frame++) {
+      CHECK(planar[channel][frame] == (outputs[channel] ? sampleOf(frame, channel) : kUntouched));
+    }
+  }
+}
+
+void testInterleave(std::size_t channel_count, std::size_t frame_count) {
+  std::vector<std::vector<float>> planar(channel_count, std::vector<float>(frame_count));
+  std::vector<const float *> inputs(channel_count);
+  for (std::size_t channel = 0; channel < channel_count; channel++) {
+    for (std::size_t frame = 0; frame < frame_count; frame++) {
+      planar[channel][frame] = sampleOf(frame, channel);
+    }
+    // Every third channel is silent
+    inputs[channel] = channel % 3 == 1 ? nullptr : planar[channel].data();
+  }
+  std::vector<float> output(channel_count * frame_count, kUntouched);
+  interleave(inputs.data(), channel_count, output.data(), frame_count);
+  for (std::size_t frame = 0; frame < frame_count; frame++) {
+    for (std::size_t channel = 0; channel < channel_count; channel++) {
+      CHECK(output[frame * channel_count + channel] == (inputs[channel] ? sampleOf(frame, channel) : 0.0f));
+    }
+  }
+}
+
+void testMeasureLevel(std::size_t frame_count) {
+  std::vector<float> input(frame_count);
+  float peak = 0;
+  double sum = 0;
+  for (std::size_t frame = 0; frame < frame_count; frame++) {
+    input[frame] = std::sin(static_cast<float>(frame) * 0.1f) * (frame % 2 ? -0.5f : 0.25f);
+    peak = std::max(peak, std::abs(input[frame]));
+    sum += static_cast<double>(input[frame]) * input[frame];
+  }
+  const auto level = measureLevel(input.data(), frame_count);
+  CHECK(level.peak == peak);
+  CHECK_NEAR(level.rms, frame_count > 0 ? std::sqrt(sum / static_cast<double>(frame_count)) : 0.0, 1e-5);
+}
+}
+
+int main() {
+  std::cout << "Testing " << getChannelKernelsName() << " kernels" << std::endl;
+  for (std::size_t channel_count: {1, 2, 3, 5, 7, 8, 9, 17}) {
+    for (std::size_t frame_count: {0, 1, 3, 7, 8, 15, 33, 1027}) {
+      testDeinterleave(channel_count, frame_count);
+      testInterleave(channel_count, frame_count);
+    }
+  }
+  for (std::size_t frame_count: {0, 1, 3, 7, 8, 15, 33, 1027}) {
+    testMeasureLevel(frame_count);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+/**
+ * Minimal assertions for the tests, which are plain executables run by CTest: a failed check ends the test.
+ */
+#define CHECK(condition) \
+  do { \
+    if (!(condition)) { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #condition ") failed" << std::endl; \
+      std::exit(EXIT_FAILURE); \
+    } \
+  } while (false)
+
+#define CHECK_NEAR(actual, expected, tolerance) \
+  do { \
+    const double check_actual = (actual); \
+    const double check_expected = (expected); \
+    if (!(std::abs(check_actual - check_expected) <= (tolerance))) { \
+      std::cerr << __FILE__ << ":" << __LINE__ << ": " #actual " is " << check_actual << ", expected " \
+                << check_expected << " +- " << (tolerance) << std::endl; \
+      std::exit(EXIT_FAILURE); \
+    } \
+  } while (false)
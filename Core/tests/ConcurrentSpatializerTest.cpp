@@ -0,0 +1,112 @@
+#include "Check.h"
+#include "utils/RealtimeWorkerPool.h"
+#include <HRTF/HRTFCereal.h>
+#include <BinauralSpatializer/3DTI_BinauralSpatializer.h>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <vector>
+
+/**
+ * Checks the guarantee the render jobs of AudioRenderer rely on: the spatializers of different sources may process a
+ * block at the same time, although they share the core, listener and HRTF of 3D Tune-In, as long as only the thread
+ * starting the jobs moves them in between. The sources are rendered on a worker pool and must sound exactly like
+ * the same sources rendered one after another.
+ */
+namespace {
+constexpr int kSampleRate = 48000;
+constexpr std::size_t kFrameSize = 256;
+constexpr std::size_t kSources = 16;
+constexpr std::size_t kBlocks = 200;
+constexpr std::size_t kWorkers = 3;
+constexpr float kTwoPi = 6.2831853f;
+
+struct Scene {
+  std::unique_ptr<Binaural::CCore> core;
+  std::shared_ptr<Binaural::CListener> listener;
+  std::vector<std::shared_ptr<Binaural::CSingleSourceDSP>> sources;
+  std::vector<Common::CEarPair<CMonoBuffer<float>>> outputs;
+};
+
+Scene createScene() {
+  Scene scene;
+  scene.core = std::make_unique<Binaural::CCore>(Common::TAudioStateStruct{kSampleRate, static_cast<int>(kFrameSize)});
+  scene.listener = scene.core->CreateListener();
+  scene.listener->DisableCustomizedITD();
+  std::ifstream stream(DS_TEST_RESOURCES_DIR "/3DTI_HRTF_" DS_HRTF_SUBJECT "_" + std::to_string(kFrameSize) + "s_"
+                           + std::to_string(kSampleRate) + "Hz.3dti-hrtf", std::ios::binary);
+  CHECK(stream.good());
+  CHECK(HRTF::CreateFrom3dtiStream(stream, scene.listener));
+  CHECK(scene.listener->GetHRTF()->IsHRTFLoaded());
+  for (std::size_t index = 0; index < kSources; index++) {
+    // The same settings as AudioRenderer::createSource
+    auto source = scene.core->CreateSingleSourceDSP();
+    source->SetSpatializationMode(Binaural::TSpatializationMode::HighQuality);
+    source->DisableNearFieldEffect();
+    source->EnableAnechoicProcess();
+    source->EnableDistanceAttenuationAnechoic();
+    source->DisableReverbProcess();
+    scene.sources.push_back(source);
+  }
+  scene.outputs.resize(kSources);
+  return scene;
+}
+
+/**
+ * Moves all sources and the listener of the given block, the sources circle around the listener at their own pace.
+ */
+void move(Scene &scene, std::size_t block) {
+  Common::CTransform listener;
+  listener.SetOrientation(Common::CQuaternion::FromYawPitchRoll(0.01f * static_cast<float>(block), 0, 0));
+  scene.listener->SetListenerTransform(listener);
+  for (std::size_t index = 0; index < kSources; index++) {
+    const float angle = kTwoPi * static_cast<float>(index) / kSources + 0.02f * static_cast<float>(block * (index + 1));
+    const float distance = 1.0f + static_cast<float>(index % 4);
+    Common::CTransform transform;
+    transform.SetPosition(Common::CVector3(distance * std::cos(angle), distance * std::sin(angle), 0));
+    scene.sources[index]->SetSourceTransform(transform);
+  }
+}
+
+void render(Scene &scene, std::size_t index, const CMonoBuffer<float> &input) {
+  auto &output = scene.outputs[index];
+  scene.sources[index]->SetBuffer(input);
+  scene.sources[index]->ProcessAnechoic(output.left, output.right);
+  CHECK(output.left.size() >= kFrameSize && output.right.size() >= kFrameSize);
+}
+}
+
+int main() {
+  auto serial = createScene();
+  auto concurrent = createScene();
+  RealtimeWorkerPool pool(kWorkers);
+
+  std::mt19937 random(2021);
+  std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+  std::vector<CMonoBuffer<float>> inputs(kSources, CMonoBuffer<float>(kFrameSize, 0.0f));
+  auto job = [&concurrent, &inputs](std::size_t index, std::size_t) {
+    render(concurrent, index, inputs[index]);
+  };
+  for (std::size_t block = 0; block < kBlocks; block++) {
+    for (auto &input: inputs) {
+      for (auto &sample: input) {
+        sample = noise(random);
+      }
+    }
+    move(serial, block);
+    move(concurrent, block);
+    for (std::size_t index = 0; index < kSources; index++) {
+      render(serial, index, inputs[index]);
+    }
+    pool.run(kSources, job);
+    for (std::size_t index = 0; index < kSources; index++) {
+      for (std::size_t frame = 0; frame < kFrameSize; frame++) {
+        CHECK(concurrent.outputs[index].left[frame] == serial.outputs[index].left[frame]);
+        CHECK(concurrent.outputs[index].right[frame] == serial.outputs[index].right[frame]);
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include "Benchmark.h"
+#include <RtAudio.h>
+#include <nlohmann/json.hpp>
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * Times what RtAudioIO waits for before it can publish the sound cards: probing every compiled API one after
+ * another as it did before, probing them in parallel as a cold start does now, and reading the device cache as a
+ * warm start does. The timings depend on the audio hardware and servers of the machine running the benchmark.
+ */
+namespace {
+constexpr std::size_t kIterations = 1;
+constexpr std::size_t kRounds = 3;
+
+struct Device {
+  std::string driver;
+  unsigned int index;
+  RtAudio::DeviceInfo info;
+};
+
+/**
+ * The same as RtAudioIO::probeDevices
+ */
+std::vector<Device> probe(RtAudio::Api rt_api) {
+  std::vector<Device> devices;
+  RtAudio rt_audio(rt_api);
+  const std::string driver = RtAudio::getApiName(rt_api);
+  const unsigned int num_devices = rt_audio.getDeviceCount();
+  for (unsigned int i = 0; i < num_devices; i++) {
+    auto info = rt_audio.getDeviceInfo(i);
+    if (info.inputChannels > 0 || info.outputChannels > 0) {
+      devices.push_back({driver, i, std::move(info)});
+    }
+  }
+  return devices;
+}
+
+nlohmann::json toJson(const Device &device) {
+  return {
+      {"driver", device.driver},
+      {"index", device.index},
+      {"name", device.info.name},
+      {"inputChannels", device.info.inputChannels},
+      {"outputChannels", device.info.outputChannels},
+      {"isDefaultInput", device.info.isDefaultInput},
+      {"isDefaultOutput", device.info.isDefaultOutput},
+      {"sampleRates", device.info.sampleRates},
+      {"preferredSampleRate", device.info.preferredSampleRate}
+  };
+}
+}
+
+int main() {
+  std::vector<RtAudio::Api> compiled_apis;
+  RtAudio::getCompiledApi(compiled_apis);
+
+  std::vector<Device> devices;
+  report("serial probe (" + std::to_string(compiled_apis.size()) + " APIs)", measureNanoseconds([&]() {
+    devices.clear();
+    for (const auto api: compiled_apis) {
+      for (auto &device: probe(api)) {
+        devices.push_back(std::move(device));
+      }
+    }
+    consume(devices.size());
+  }, kIterations, kRounds), "enumeration");
+
+  report("parallel probe (" + std::to_string(compiled_apis.size()) + " APIs)", measureNanoseconds([&]() {
+    std::vector<std::future<std::vector<Device>>> probes;
+    for (const auto api: compiled_apis) {
+      probes.push_back(std::async(std::launch::async, [api]() { return probe(api); }));
+    }
+    std::size_t count = 0;
+    for (auto &result: probes) {
+      count += result.get().size();
+    }
+    consume(count);
+  }, kIterations, kRounds), "enumeration");
+
+  const auto path = std::filesystem::temp_directory_path() / "rtaudio-devices-benchmark.json";
+  {
+    auto json = nlohmann::json::array();
+    for (const auto &device: devices) {
+      json.push_back(toJson(device));
+    }
+    std::ofstream(path) << json.dump();
+  }
+  report("cached devices (" + std::to_string(devices.size()) + " devices)", measureNanoseconds([&]() {
+    std::ifstream file(path);
+    const auto json = nlohmann::json::parse(file);
+    consume(json.size());
+  }, kIterations, kRounds), "enumeration");
+  std::filesystem::remove(path);
+  return 0;
+}
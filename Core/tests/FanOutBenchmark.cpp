@@ -0,0 +1,93 @@
+#include "Benchmark.h"
+#include "webrtc/AudioPacket.h"
+#include "webrtc/PeerConnection.h"
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Fans one block of every track out to every peer, once by track id the way ConnectionService sent before it
+ * resolved the send handles, and once through the handles it keeps per track and peer now.
+ * The peers never connect, so their channels drop the packets and only the fan-out itself is measured.
+ */
+namespace {
+constexpr std::size_t kFrameCount = 256;
+constexpr std::size_t kIterations = 200;
+
+std::string name(const std::string &fan_out, std::size_t peer_count, std::size_t track_count) {
+  return fan_out + " (" + std::to_string(peer_count) + " peers x " + std::to_string(track_count) + " tracks)";
+}
+
+void benchmark(std::size_t peer_count, std::size_t track_count) {
+  std::vector<std::unique_ptr<PeerConnection>> peers;
+  for (std::size_t peer = 0; peer < peer_count; peer++) {
+    peers.push_back(std::make_unique<PeerConnection>(rtc::Configuration(), false));
+    peers.back()->onLocalIceCandidate = [](const DigitalStage::Types::IceCandidateInit &) {};
+    peers.back()->onLocalSessionDescription = [](const DigitalStage::Types::SessionDescriptionInit &) {};
+  }
+  std::vector<std::string> tracks;
+  for (std::size_t track = 0; track < track_count; track++) {
+    tracks.push_back("track-" + std::to_string(track));
+  }
+  // Creates the data channels up front, both ways reuse them
+  using Senders = std::unordered_map<const PeerConnection *, std::shared_ptr<AudioSender>>;
+  std::vector<Senders> senders(track_count);
+  for (std::size_t track = 0; track < track_count; track++) {
+    for (const auto &peer: peers) {
+      senders[track][peer.get()] = peer->getSender(tracks[track]);
+    }
+  }
+
+  const std::vector<float> block(kFrameCount, 0.5f);
+  std::vector<std::byte> packet(kAudioPacketHeaderSize + kFrameCount * sizeof(float));
+  AudioPacketHeader header;
+  header.sample_rate = 48000;
+  header.frame_count = static_cast<std::uint16_t>(kFrameCount);
+  const auto size = packet.size();
+  const auto encode = [&]() {
+    header.sequence++;
+    encodeAudioPacketHeader(header, packet.data());
+    encodeSamples(AudioSampleFormat::kFloat32, block.data(), kFrameCount, &packet[kAudioPacketHeaderSize]);
+  };
+  const auto per_send = [peer_count, track_count](double nanoseconds) {
+    return nanoseconds / static_cast<double>(peer_count * track_count);
+  };
+
+  report(name("by track id", peer_count, track_count), per_send(measureNanoseconds([&]() {
+    for (const auto &track: tracks) {
+      encode();
+      for (const auto &peer: peers) {
+        peer->send(track, packet.data(), size);
+      }
+    }
+    consume(header.sequence);
+  }, kIterations)), "send");
+
+  report(name("resolved handles", peer_count, track_count), per_send(measureNanoseconds([&]() {
+    for (std::size_t track = 0; track < track_count; track++) {
+      encode();
+      for (const auto &peer: peers) {
+        auto &sender = senders[track][peer.get()];
+        if (!sender || !sender->isValid()) {
+          sender = peer->getSender(tracks[track]);
+        }
+        if (sender) {
+          sender->send(packet.data(), size);
+        }
+      }
+    }
+    consume(header.sequence);
+  }, kIterations)), "send");
+}
+}
+
+int main() {
+  for (std::size_t peer_count: {1, 4, 16, 32}) {
+    for (std::size_t track_count: {1, 8, 32}) {
+      benchmark(peer_count, track_count);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,144 @@
+#include "Check.h"
+#include "audio/JitterBuffer.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+namespace {
+constexpr std::size_t kCapacity = 4096;
+constexpr unsigned int kSampleRate = 48000;
+constexpr std::size_t kFrameCount = 128;
+
+void push(JitterBuffer &buffer, std::initializer_list<std::uint32_t> sequences, std::uint32_t offset = 0) {
+  const std::vector<float> data(kFrameCount, 0.5f);
+  for (const auto sequence: sequences) {
+    buffer.push(sequence + offset, (sequence + offset) * kFrameCount, data.data(), kFrameCount);
+  }
+}
+
+void testInOrder() {
+  JitterBuffer buffer(kCapacity, kSampleRate);
+  push(buffer, {0, 1, 2, 3, 4, 5, 6, 7});
+  const auto statistics = buffer.getStatistics();
+  CHECK(statistics.lost_packets == 0);
+  CHECK(statistics.late_packets == 0);
+  CHECK(statistics.reordered_packets == 0);
+}
+
+void testLoss() {
+  JitterBuffer buffer(kCapacity, kSampleRate);
+  push(buffer, {0, 1, 2, 4, 5, 6, 7, 8, 9, 10});
+  const auto statistics = buffer.getStatistics();
+  CHECK(statistics.lost_packets == 1);
+  CHECK(statistics.late_packets == 0);
+}
+
+void testReorder() {
+  JitterBuffer buffer(kCapacity, kSampleRate);
+  push(buffer, {0, 1, 3, 2, 4, 5});
+  const auto statistics = buffer.getStatistics();
+  CHECK(statistics.lost_packets == 0);
+  CHECK(statistics.late_packets == 0);
+  CHECK(statistics.reordered_packets == 1);
+}
+
+void testDuplicate() {
+  JitterBuffer buffer(kCapacity, kSampleRate);
+  push(buffer, {0, 1, 1, 2, 4, 4});
+  const auto statistics = buffer.getStatistics();
+  CHECK(statistics.late_packets == 2);
+}
+
+void testRestart() {
+  // A sender starting over, both forwards and backwards, is followed instead of counted as late or lost
+  JitterBuffer buffer(kCapacity, kSampleRate);
+  push(buffer, {0, 1, 2, 3, 4, 5, 6, 7});
+  push(buffer, {0, 1, 2, 3}, 100000);
+  push(buffer, {0, 1, 2, 3});
+  const auto statistics = buffer.getStatistics();
+  CHECK(statistics.lost_packets == 0);
+  CHECK(statistics.late_packets == 0);
+}
+
+void testFramedPlayback() {
+  JitterBuffer buffer(kCapacity, kSampleRate);
+  std::vector<float> out(kFrameCount);
+  for (std::uint32_t sequence = 0; sequence < 500; sequence++) {
+    push(buffer, {sequence});
+    buffer.pop(out.data(), kFrameCount);
+  }
+  for (const auto sample: out) {
+    CHECK_NEAR(sample, 0.5f, 1e-6);
+  }
+  CHECK(buffer.getStatistics().underruns == 0);
+}
+
+void testSilence() {
+  // Silence packets take their place in the timeline like any other packet
+  JitterBuffer buffer(kCapacity, kSampleRate);
+  std::vector<float> out(kFrameCount, 1.0f);
+  for (std::uint32_t sequence = 0; sequence < 100; sequence++) {
+    buffer.pushSilence(sequence, sequence * kFrameCount, kFrameCount);
+    buffer.pop(out.data(), kFrameCount);
+  }
+  for (const auto sample: out) {
+    CHECK(sample == 0.0f);
+  }
+  CHECK(buffer.getStatistics().lost_packets == 0);
+}
+
+void testPlayback() {
+  // Steady packets of a constant signal come out unchanged once the buffer is primed
+  JitterBuffer buffer(kCapacity, kSampleRate);
+  const std::vector<float> data(kFrameCount, 0.5f);
+  std::vector<float> out(kFrameCount);
+  for (std::uint32_t block = 0; block < 500; block++) {
+    buffer.push(data.data(), kFrameCount);
+    buffer.pop(out.data(), kFrameCount);
+  }
+  for (const auto sample: out) {
+    CHECK_NEAR(sample, 0.5f, 1e-6);
+  }
+  CHECK(buffer.getStatistics().underruns == 0);
+}
+
+void testConcealment() {
+  // Missing packets are concealed by a fading repetition, never by a hard cut
+  JitterBuffer buffer(kCapacity, kSampleRate);
+  const std::vector<float> data(kFrameCount, 0.5f);
+  std::vector<float> out(kFrameCount);
+  for (std::uint32_t block = 0; block < 100; block++) {
+    buffer.push(data.data(), kFrameCount);
+    buffer.pop(out.data(), kFrameCount);
+  }
+  float previous_peak = 0.5f;
+  for (std::uint32_t block = 0; block < 100; block++) {
+    buffer.pop(out.data(), kFrameCount);
+    float peak = 0;
+    for (const auto sample: out) {
+      peak = std::max(peak, std::abs(sample));
+    }
+    CHECK(peak <= previous_peak + 1e-6f);
+    previous_peak = peak;
+  }
+  CHECK(previous_peak < 0.01f);
+  const auto statistics = buffer.getStatistics();
+  CHECK(statistics.underruns > 0);
+  CHECK(statistics.concealed_frames > 0);
+}
+}
+
+int main() {
+  testPlayback();
+  testConcealment();
+  testInOrder();
+  testLoss();
+  testReorder();
+  testDuplicate();
+  testRestart();
+  testFramedPlayback();
+  testSilence();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,68 @@
+#include "Check.h"
+#include "audio/LosslessCodec.h"
+#include "utils/WireCodec.h"
+#include <cstddef>
+#include <random>
+#include <vector>
+
+namespace {
+/**
+ * The lossless coder must reproduce exactly what the int24 wire format would have transmitted.
+ */
+void testRoundTrip(const std::vector<float> &input, bool compresses) {
+  LosslessEncoder encoder;
+  LosslessDecoder decoder;
+  const auto frame_count = input.size();
+  std::vector<std::byte> encoded(2 + frame_count * 3);
+  const auto size = encoder.encode(input.data(), frame_count, encoded.data(), encoded.size());
+  CHECK(size > 0);
+  if (compresses) {
+    CHECK(size < encoded.size());
+  }
+  std::vector<float> output(frame_count);
+  CHECK(decoder.decode(encoded.data(), size, output.data(), frame_count));
+
+  std::vector<std::byte> wire(frame_count * 3);
+  std::vector<float> expected(frame_count);
+  encodeSamples(AudioSampleFormat::kInt24, input.data(), frame_count, wire.data());
+  decodeSamples(AudioSampleFormat::kInt24, wire.data(), frame_count, expected.data());
+  for (std::size_t frame = 0; frame < frame_count; frame++) {
+    CHECK(output[frame] == expected[frame]);
+  }
+}
+
+void testCorruptPackets() {
+  LosslessDecoder decoder;
+  std::vector<float> output(64);
+  const std::byte too_short[] = {std::byte{1}};
+  CHECK(!decoder.decode(too_short, sizeof(too_short), output.data(), output.size()));
+  // Order 3 with residuals of nothing but ones decodes into huge values, which must neither overflow nor leave 24 bit
+  std::vector<std::byte> garbage(200, std::byte{0xFF});
+  garbage[0] = std::byte{3};
+  garbage[1] = std::byte{20};
+  if (decoder.decode(garbage.data(), garbage.size(), output.data(), output.size())) {
+    for (const auto sample: output) {
+      CHECK(sample >= -1.0f - 1e-6f && sample <= 1.0f);
+    }
+  }
+}
+}
+
+int main() {
+  std::mt19937 random(4711);
+  std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+  for (std::size_t frame_count: {1, 2, 3, 4, 5, 64, 127, 128, 480, 1024}) {
+    std::vector<float> sine(frame_count), white(frame_count), silence(frame_count, 0.0f), clipped(frame_count);
+    for (std::size_t frame = 0; frame < frame_count; frame++) {
+      sine[frame] = 0.5f * std::sin(static_cast<float>(frame) * 0.05f);
+      white[frame] = noise(random);
+      clipped[frame] = frame % 2 ? 1.5f : -1.5f;
+    }
+    testRoundTrip(sine, frame_count >= 64);
+    testRoundTrip(white, false);
+    testRoundTrip(silence, frame_count >= 64);
+    testRoundTrip(clipped, false);
+  }
+  testCorruptPackets();
+  return EXIT_SUCCESS;
+}
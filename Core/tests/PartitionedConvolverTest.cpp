@@ -0,0 +1,99 @@
+#include "Check.h"
+#include "audio/PartitionedConvolver.h"
+#include <cstddef>
+#include <random>
+#include <vector>
+
+namespace {
+void testRealFft(std::size_t size) {
+  std::mt19937 random(17);
+  std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+  RealFft fft(size);
+  std::vector<float> input(size), real(size / 2 + 1), imag(size / 2 + 1), output(size);
+  for (auto &sample: input) {
+    sample = noise(random);
+  }
+  fft.forward(input.data(), real.data(), imag.data());
+  // Bin 0 is the sum of all samples
+  double sum = 0;
+  for (const auto sample: input) {
+    sum += sample;
+  }
+  CHECK_NEAR(real[0], sum, 1e-3);
+  CHECK_NEAR(imag[0], 0.0, 1e-4);
+  fft.inverse(real.data(), imag.data(), output.data());
+  for (std::size_t i = 0; i < size; i++) {
+    CHECK_NEAR(output[i], input[i], 1e-5);
+  }
+}
+
+/**
+ * Compares the convolution of several inputs and outputs with direct convolution, block by block.
+ */
+void testConvolution(std::size_t block_size, std::size_t num_inputs, std::size_t num_outputs, std::size_t length) {
+  constexpr std::size_t kBlocks = 12;
+  std::mt19937 random(static_cast<std::mt19937::result_type>(block_size * 31 + length));
+  std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+
+  PartitionedConvolver convolver(block_size, num_inputs, num_outputs);
+  std::vector<std::vector<std::vector<float>>> responses(num_inputs, std::vector<std::vector<float>>(num_outputs));
+  for (std::size_t input = 0; input < num_inputs; input++) {
+    for (std::size_t output = 0; output < num_outputs; output++) {
+      auto &response = responses[input][output];
+      response.resize(length);
+      for (auto &sample: response) {
+        sample = noise(random) * 0.5f;
+      }
+      convolver.setImpulseResponse(input, output, response.data(), response.size());
+    }
+  }
+  std::vector<std::vector<float>> signals(num_inputs, std::vector<float>(kBlocks * block_size));
+  for (auto &signal: signals) {
+    for (auto &sample: signal) {
+      sample = noise(random);
+    }
+  }
+
+  // The convolver adds to the outputs
+  constexpr float kOffset = 0.25f;
+  std::vector<std::vector<float>> results(num_outputs, std::vector<float>(kBlocks * block_size, kOffset));
+  std::vector<const float *> inputs(num_inputs);
+  std::vector<float *> outputs(num_outputs);
+  for (std::size_t block = 0; block < kBlocks; block++) {
+    for (std::size_t input = 0; input < num_inputs; input++) {
+      inputs[input] = &signals[input][block * block_size];
+    }
+    for (std::size_t output = 0; output < num_outputs; output++) {
+      outputs[output] = &results[output][block * block_size];
+    }
+    convolver.process(inputs.data(), outputs.data());
+  }
+
+  for (std::size_t output = 0; output < num_outputs; output++) {
+    for (std::size_t frame = 0; frame < kBlocks * block_size; frame++) {
+      double expected = kOffset;
+      for (std::size_t input = 0; input < num_inputs; input++) {
+        const auto &response = responses[input][output];
+        for (std::size_t tap = 0; tap < response.size() && tap <= frame; tap++) {
+          expected += static_cast<double>(response[tap]) * signals[input][frame - tap];
+        }
+      }
+      CHECK_NEAR(results[output][frame], expected, 1e-3);
+    }
+  }
+}
+}
+
+int main() {
+  for (std::size_t size: {4, 8, 64, 512, 4096}) {
+    testRealFft(size);
+  }
+  for (std::size_t block_size: {16, 64, 256}) {
+    // Shorter than, exactly and not a multiple of the block size, and spanning many partitions
+    for (std::size_t length: {std::size_t{1}, block_size / 2, block_size, block_size * 3 + 5, block_size * 10}) {
+      testConvolution(block_size, 1, 1, length);
+      testConvolution(block_size, 3, 2, length);
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,55 @@
+#include "Benchmark.h"
+#include "utils/ResourceBundle.h"
+#include <cmrc/cmrc.hpp>
+#include <cstddef>
+#include <iostream>
+#include <string>
+
+CMRC_DECLARE(clientres);
+
+/**
+ * Opens every dataset embedded into this build the way AudioRenderer does when it starts: cold, when the dataset
+ * has to be inflated first, and warm, while another renderer still holds it. Also prints how much of the binary
+ * the datasets take compared to their inflated size, which is what a build without COMPRESS_RESOURCES embeds.
+ */
+namespace {
+constexpr std::size_t kIterations = 5;
+
+std::string getName(const std::string &stored_name) {
+#ifdef DS_COMPRESSED_RESOURCES
+  // Stored with the suffix .gz
+  return stored_name.substr(0, stored_name.size() - 3);
+#else
+  return stored_name;
+#endif
+}
+}
+
+int main() {
+  const auto fs = cmrc::clientres::get_filesystem();
+  ResourceBundle bundle(fs);
+  std::size_t embedded = 0;
+  std::size_t inflated = 0;
+  for (const auto &entry: fs.iterate_directory("")) {
+    if (!entry.is_file()) {
+      continue;
+    }
+    const auto stored = fs.open(entry.filename());
+    embedded += static_cast<std::size_t>(stored.end() - stored.begin());
+    const auto name = getName(entry.filename());
+
+    report(name + " (cold)", measureNanoseconds([&]() {
+      // Dropped right away, so the next open inflates again
+      const auto resource = bundle.open(name);
+      consume(*resource.begin());
+    }, kIterations), "open");
+    const auto held = bundle.open(name);
+    inflated += static_cast<std::size_t>(held.end() - held.begin());
+    report(name + " (warm)", measureNanoseconds([&]() {
+      const auto resource = bundle.open(name);
+      consume(*resource.begin());
+    }, kIterations), "open");
+  }
+  std::cout << "embedded " << embedded / 1024 << " KiB, inflated " << inflated / 1024 << " KiB" << std::endl;
+  return 0;
+}
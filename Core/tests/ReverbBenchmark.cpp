@@ -0,0 +1,134 @@
+#include "Benchmark.h"
+#include "audio/PartitionedConvolver.h"
+#include <BRIR/BRIRCereal.h>
+#include <BinauralSpatializer/3DTI_BinauralSpatializer.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * Compares the reverb of 3D Tune-In with the convolution of the impulse responses measured from it, the way
+ * AudioRenderer renders each room, at the block sizes of the sound cards.
+ */
+namespace {
+constexpr int kSampleRate = 48000;
+constexpr std::size_t kProbes = 3;
+constexpr double kMaxDuration = 10.0;  // s
+constexpr float kReverbSilence = 1e-6f;  // the same as AudioRenderer
+constexpr std::size_t kIterations = 200;
+
+struct Room {
+  Binaural::CCore core;
+  std::shared_ptr<Binaural::CListener> listener;
+  std::shared_ptr<Binaural::CEnvironment> environment;
+
+  Room(const std::string &room_size, std::size_t frame_size)
+      : core(Common::TAudioStateStruct{kSampleRate, static_cast<int>(frame_size)}),
+        listener(core.CreateListener()),
+        environment(core.CreateEnvironment()) {
+    std::ifstream stream(DS_TEST_RESOURCES_DIR "/3DTI_BRIR_" + room_size + "_" + std::to_string(kSampleRate)
+                             + "Hz.3dti-brir", std::ios::binary);
+    environment->SetReverberationOrder(TReverberationOrder::BIDIMENSIONAL);
+    if (!stream.good() || !BRIR::CreateFrom3dtiStream(stream, environment)) {
+      throw std::runtime_error("Could not load the BRIR of the " + room_size + " room");
+    }
+  }
+
+  std::shared_ptr<Binaural::CSingleSourceDSP> createSource(const Common::CVector3 &position) {
+    auto source = core.CreateSingleSourceDSP();
+    source->DisableNearFieldEffect();
+    source->DisableDistanceAttenuationReverb();
+    Common::CTransform transform;
+    transform.SetPosition(position);
+    source->SetSourceTransform(transform);
+    return source;
+  }
+};
+
+/**
+ * Impulse responses of the room from the three probed directions, ending like the ones of AudioRenderer.
+ */
+std::array<Common::CEarPair<std::vector<float>>, kProbes> measure(const std::string &room_size) {
+  constexpr std::size_t kFrameSize = 512;  // the responses do not depend on the block size
+  const std::array<Common::CVector3, kProbes>
+      probes{Common::CVector3(1, 0, 0), Common::CVector3(0, 1, 0), Common::CVector3(-1, 0, 0)};
+  std::array<Common::CEarPair<std::vector<float>>, kProbes> responses;
+  for (std::size_t probe = 0; probe < kProbes; probe++) {
+    Room room(room_size, kFrameSize);
+    auto source = room.createSource(probes[probe]);
+    CMonoBuffer<float> impulse(kFrameSize, 0.0f);
+    Common::CEarPair<CMonoBuffer<float>> output;
+    float peak = 0;
+    for (std::size_t block = 0; block < static_cast<std::size_t>(kMaxDuration * kSampleRate / kFrameSize); block++) {
+      impulse[0] = block == 0 ? 1.0f : 0.0f;
+      source->SetBuffer(impulse);
+      room.environment->ProcessVirtualAmbisonicReverb(output.left, output.right);
+      float block_peak = 0;
+      for (std::size_t frame = 0; frame < kFrameSize; frame++) {
+        block_peak = std::max({block_peak, std::abs(output.left[frame]), std::abs(output.right[frame])});
+      }
+      auto &response = responses[probe];
+      response.left.insert(response.left.end(), output.left.begin(), output.left.begin() + kFrameSize);
+      response.right.insert(response.right.end(), output.right.begin(), output.right.begin() + kFrameSize);
+      peak = std::max(peak, block_peak);
+      if (peak > 0 && block_peak < peak * kReverbSilence) {
+        break;
+      }
+    }
+  }
+  return responses;
+}
+
+void benchmark(const std::string &room_size,
+               const std::array<Common::CEarPair<std::vector<float>>, kProbes> &responses,
+               std::size_t frame_size) {
+  std::mt19937 random(2021);
+  std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+  CMonoBuffer<float> input(frame_size);
+  for (auto &sample: input) {
+    sample = noise(random);
+  }
+  const auto name = [&room_size, frame_size](const std::string &reverb) {
+    return room_size + " room, " + reverb + " (" + std::to_string(frame_size) + " frames)";
+  };
+
+  Room room(room_size, frame_size);
+  auto source = room.createSource(Common::CVector3(1, 1, 0));
+  Common::CEarPair<CMonoBuffer<float>> output;
+  report(name("3D Tune-In"), measureNanoseconds([&]() {
+    source->SetBuffer(input);
+    room.environment->ProcessVirtualAmbisonicReverb(output.left, output.right);
+    consume(output.left[0]);
+  }, kIterations), "block");
+
+  PartitionedConvolver convolver(frame_size, kProbes, 2);
+  for (std::size_t probe = 0; probe < kProbes; probe++) {
+    convolver.setImpulseResponse(probe, 0, responses[probe].left.data(), responses[probe].left.size());
+    convolver.setImpulseResponse(probe, 1, responses[probe].right.data(), responses[probe].right.size());
+  }
+  const std::array<const float *, kProbes> buses{input.data(), input.data(), input.data()};
+  std::vector<float> left(frame_size), right(frame_size);
+  const std::array<float *, 2> outputs{left.data(), right.data()};
+  report(name("convolver"), measureNanoseconds([&]() {
+    convolver.process(buses.data(), outputs.data());
+    consume(left[0]);
+  }, kIterations), "block");
+}
+}
+
+int main() {
+  for (const std::string room_size: {"small", "medium", "large"}) {
+    const auto responses = measure(room_size);
+    for (std::size_t frame_size: {128, 256, 512}) {
+      benchmark(room_size, responses, frame_size);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,177 @@
+#include "Check.h"
+#include "audio/PartitionedConvolver.h"
+#include <BRIR/BRIRCereal.h>
+#include <BinauralSpatializer/3DTI_BinauralSpatializer.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <vector>
+
+/**
+ * Checks that the reverb of a room, measured from three directions and convolved the way AudioRenderer does it,
+ * sounds like the reverb of 3D Tune-In. The measured impulse responses end once they fall below kReverbSilence,
+ * so both are close, but not identical.
+ */
+namespace {
+constexpr int kSampleRate = 48000;
+constexpr std::size_t kFrameSize = 256;
+constexpr std::size_t kProbes = 3;
+constexpr double kMaxDuration = 10.0;  // s
+constexpr float kReverbSilence = 1e-6f;  // the same as AudioRenderer
+constexpr std::size_t kSignalBlocks = 100;
+constexpr std::size_t kBlocks = 400;
+// Error relative to the RMS of the reverb of 3D Tune-In
+constexpr double kTolerance = 1e-3;
+
+using Direction = std::array<float, kProbes>;
+
+std::shared_ptr<Binaural::CEnvironment> createEnvironment(Binaural::CCore &core) {
+  std::ifstream stream(DS_TEST_RESOURCES_DIR "/3DTI_BRIR_medium_48000Hz.3dti-brir", std::ios::binary);
+  CHECK(stream.good());
+  auto environment = core.CreateEnvironment();
+  environment->SetReverberationOrder(TReverberationOrder::BIDIMENSIONAL);
+  CHECK(BRIR::CreateFrom3dtiStream(stream, environment));
+  CHECK(environment->GetBRIR()->IsBRIRready());
+  return environment;
+}
+
+std::shared_ptr<Binaural::CSingleSourceDSP> createSource(Binaural::CCore &core, const Common::CVector3 &position) {
+  auto source = core.CreateSingleSourceDSP();
+  source->DisableNearFieldEffect();
+  source->DisableDistanceAttenuationReverb();
+  Common::CTransform transform;
+  transform.SetPosition(position);
+  source->SetSourceTransform(transform);
+  return source;
+}
+
+Direction getDirection(const Common::CVector3 &position) {
+  Common::CTransform listener, source;
+  source.SetPosition(position);
+  const auto vector = listener.GetVectorTo(source);
+  const float azimuth = vector.GetAzimuthRadians();
+  const float elevation = vector.GetElevationRadians();
+  return {1.0f, std::cos(elevation) * std::cos(azimuth), std::cos(elevation) * std::sin(azimuth)};
+}
+
+/**
+ * Impulse response of the room for a source at the given position, ending like the ones of AudioRenderer.
+ */
+Common::CEarPair<std::vector<float>> measure(const Common::CVector3 &position) {
+  Binaural::CCore core(Common::TAudioStateStruct{kSampleRate, static_cast<int>(kFrameSize)});
+  auto listener = core.CreateListener();
+  auto environment = createEnvironment(core);
+  auto source = createSource(core, position);
+  Common::CEarPair<std::vector<float>> response;
+  CMonoBuffer<float> impulse(kFrameSize, 0.0f);
+  Common::CEarPair<CMonoBuffer<float>> output;
+  float peak = 0;
+  for (std::size_t block = 0; block < static_cast<std::size_t>(kMaxDuration * kSampleRate / kFrameSize); block++) {
+    impulse[0] = block == 0 ? 1.0f : 0.0f;
+    source->SetBuffer(impulse);
+    environment->ProcessVirtualAmbisonicReverb(output.left, output.right);
+    CHECK(output.left.size() >= kFrameSize && output.right.size() >= kFrameSize);
+    float block_peak = 0;
+    for (std::size_t frame = 0; frame < kFrameSize; frame++) {
+      block_peak = std::max({block_peak, std::abs(output.left[frame]), std::abs(output.right[frame])});
+    }
+    response.left.insert(response.left.end(), output.left.begin(), output.left.begin() + kFrameSize);
+    response.right.insert(response.right.end(), output.right.begin(), output.right.begin() + kFrameSize);
+    peak = std::max(peak, block_peak);
+    if (peak > 0 && block_peak < peak * kReverbSilence) {
+      break;
+    }
+  }
+  CHECK(peak > 0);
+  return response;
+}
+
+/**
+ * @return weights of the probes mixing into the given direction, by Cramer's rule
+ */
+Direction getWeights(const std::array<Direction, kProbes> &probes, const Direction &direction) {
+  const auto determinant = [](const std::array<Direction, kProbes> &m) {
+    return m[0][0] * (m[1][1] * m[2][2] - m[2][1] * m[1][2])
+        - m[1][0] * (m[0][1] * m[2][2] - m[2][1] * m[0][2])
+        + m[2][0] * (m[0][1] * m[1][2] - m[1][1] * m[0][2]);
+  };
+  const auto total = determinant(probes);
+  CHECK(std::abs(total) > 1e-3f);
+  Direction weights{};
+  for (std::size_t probe = 0; probe < kProbes; probe++) {
+    auto replaced = probes;
+    replaced[probe] = direction;
+    weights[probe] = determinant(replaced) / total;
+  }
+  return weights;
+}
+
+void testReverb(const Common::CVector3 &position) {
+  const std::array<Common::CVector3, kProbes>
+      probes{Common::CVector3(1, 0, 0), Common::CVector3(0, 1, 0), Common::CVector3(-1, 0, 0)};
+  PartitionedConvolver convolver(kFrameSize, kProbes, 2);
+  std::array<Direction, kProbes> directions{};
+  for (std::size_t probe = 0; probe < kProbes; probe++) {
+    directions[probe] = getDirection(probes[probe]);
+    const auto response = measure(probes[probe]);
+    convolver.setImpulseResponse(probe, 0, response.left.data(), response.left.size());
+    convolver.setImpulseResponse(probe, 1, response.right.data(), response.right.size());
+  }
+  const auto weights = getWeights(directions, getDirection(position));
+
+  Binaural::CCore core(Common::TAudioStateStruct{kSampleRate, static_cast<int>(kFrameSize)});
+  auto listener = core.CreateListener();
+  auto environment = createEnvironment(core);
+  auto source = createSource(core, position);
+
+  std::mt19937 random(2021);
+  std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+  CMonoBuffer<float> input(kFrameSize, 0.0f);
+  std::array<std::vector<float>, kProbes> buses;
+  for (auto &bus: buses) {
+    bus.resize(kFrameSize);
+  }
+  Common::CEarPair<CMonoBuffer<float>> expected;
+  std::vector<float> left(kFrameSize), right(kFrameSize);
+  double error = 0;
+  double energy = 0;
+  for (std::size_t block = 0; block < kBlocks; block++) {
+    for (auto &sample: input) {
+      sample = block < kSignalBlocks ? noise(random) : 0.0f;
+    }
+    source->SetBuffer(input);
+    environment->ProcessVirtualAmbisonicReverb(expected.left, expected.right);
+    CHECK(expected.left.size() >= kFrameSize && expected.right.size() >= kFrameSize);
+
+    for (std::size_t probe = 0; probe < kProbes; probe++) {
+      for (std::size_t frame = 0; frame < kFrameSize; frame++) {
+        buses[probe][frame] = weights[probe] * input[frame];
+      }
+    }
+    std::fill(left.begin(), left.end(), 0.0f);
+    std::fill(right.begin(), right.end(), 0.0f);
+    const std::array<const float *, kProbes> inputs{buses[0].data(), buses[1].data(), buses[2].data()};
+    const std::array<float *, 2> outputs{left.data(), right.data()};
+    convolver.process(inputs.data(), outputs.data());
+
+    for (std::size_t frame = 0; frame < kFrameSize; frame++) {
+      error += std::pow(left[frame] - expected.left[frame], 2) + std::pow(right[frame] - expected.right[frame], 2);
+      energy += std::pow(expected.left[frame], 2) + std::pow(expected.right[frame], 2);
+    }
+  }
+  CHECK(energy > 0);
+  CHECK_NEAR(std::sqrt(error / energy), 0.0, kTolerance);
+}
+}
+
+int main() {
+  // A probed direction, and directions mixed from the probes
+  testReverb(Common::CVector3(2, 0, 0));
+  testReverb(Common::CVector3(1, 1, 0));
+  testReverb(Common::CVector3(-1, -2, 0));
+  return EXIT_SUCCESS;
+}
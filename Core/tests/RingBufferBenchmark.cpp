@@ -0,0 +1,162 @@
+#include "Benchmark.h"
+#include "utils/LockFreeRingBuffer.h"
+#include "utils/RingBuffer.h"
+#ifdef DS_BENCHMARK_TBB
+#include <tbb/cache_aligned_allocator.h>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "utils/CircularQueue.h"
+// Declares another class RingBuffer, its own includes are already there
+namespace tbb_ring {
+#include "utils/TBBRingBuffer.h"
+}
+#endif
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Compares the lock-free SPSC ring of the Client with the mutex RingBuffer it replaced and, if TBB is available,
+ * with the TBB based RingBuffer and CircularQueue: one block is written and read again, sample by sample like the
+ * Client used to, and in bulk.
+ */
+namespace {
+constexpr std::size_t kCapacity = 8192;
+constexpr std::size_t kIterations = 2000;
+constexpr std::size_t kStreamedBlocks = 20000;
+
+std::string name(const std::string &buffer, std::size_t block_size) {
+  return buffer + " (" + std::to_string(block_size) + " frames)";
+}
+
+void benchmarkSingleThread(std::size_t block_size) {
+  std::vector<float> block(block_size, 0.5f);
+  std::vector<float> out(block_size);
+  const auto per_sample = [block_size](double nanoseconds) {
+    return nanoseconds / static_cast<double>(block_size);
+  };
+
+  RingBuffer<float> mutex_ring(kCapacity);
+  report(name("RingBuffer put/get", block_size), per_sample(measureNanoseconds([&]() {
+    for (const auto sample: block) {
+      mutex_ring.put(sample);
+    }
+    for (auto &sample: out) {
+      sample = mutex_ring.get();
+    }
+    consume(out[0]);
+  }, kIterations)), "sample");
+
+  LockFreeRingBuffer<float> lock_free_ring(kCapacity);
+  report(name("LockFreeRingBuffer put/get", block_size), per_sample(measureNanoseconds([&]() {
+    for (const auto sample: block) {
+      lock_free_ring.put(sample);
+    }
+    for (auto &sample: out) {
+      sample = lock_free_ring.get();
+    }
+    consume(out[0]);
+  }, kIterations)), "sample");
+  report(name("LockFreeRingBuffer write/read", block_size), per_sample(measureNanoseconds([&]() {
+    lock_free_ring.write(block.data(), block_size);
+    lock_free_ring.read(out.data(), block_size);
+    consume(out[0]);
+  }, kIterations)), "sample");
+
+#ifdef DS_BENCHMARK_TBB
+  tbb_ring::RingBuffer<float> tbb_ring(kCapacity);
+  report(name("TBBRingBuffer put/get", block_size), per_sample(measureNanoseconds([&]() {
+    for (const auto sample: block) {
+      tbb_ring.put(sample);
+    }
+    for (auto &sample: out) {
+      sample = tbb_ring.get();
+    }
+    consume(out[0]);
+  }, kIterations)), "sample");
+
+  CircularQueue<float> circular_queue(kCapacity);
+  report(name("CircularQueue enqueue_many/dequeue", block_size), per_sample(measureNanoseconds([&]() {
+    circular_queue.enqueue_many(block.data(), 0, static_cast<int>(block_size));
+    for (auto &sample: out) {
+      sample = circular_queue.dequeue();
+    }
+    consume(out[0]);
+  }, kIterations)), "sample");
+#endif
+}
+
+/**
+ * Streams blocks from a producer to a consumer thread, the way capture and playback callbacks share a ring.
+ * Only the thread safe buffers take part.
+ */
+void benchmarkStreaming(std::size_t block_size) {
+  const auto total = kStreamedBlocks * block_size;
+  std::vector<float> block(block_size, 0.5f);
+
+  RingBuffer<float> mutex_ring(kCapacity);
+  const auto mutex_time = measureNanoseconds([&]() {
+    std::thread producer([&]() {
+      for (std::size_t written = 0; written < total; written += block_size) {
+        while (mutex_ring.size() + block_size > kCapacity) {
+          std::this_thread::yield();
+        }
+        for (const auto sample: block) {
+          mutex_ring.put(sample);
+        }
+      }
+    });
+    float sum = 0;
+    for (std::size_t received = 0; received < total;) {
+      if (mutex_ring.empty()) {
+        std::this_thread::yield();
+        continue;
+      }
+      sum += mutex_ring.get();
+      received++;
+    }
+    producer.join();
+    consume(sum);
+  }, 1, 3);
+  report(name("RingBuffer streamed put/get", block_size), mutex_time / static_cast<double>(total), "sample");
+
+  LockFreeRingBuffer<float> lock_free_ring(kCapacity);
+  const auto lock_free_time = measureNanoseconds([&]() {
+    std::thread producer([&]() {
+      for (std::size_t written = 0; written < total;) {
+        const auto count = lock_free_ring.write(block.data(), block_size);
+        if (count == 0) {
+          std::this_thread::yield();
+        }
+        written += count;
+      }
+    });
+    std::vector<float> out(block_size);
+    float sum = 0;
+    for (std::size_t received = 0; received < total;) {
+      const auto count = lock_free_ring.read(out.data(), block_size);
+      if (count == 0) {
+        std::this_thread::yield();
+      }
+      sum += count > 0 ? out[0] : 0.0f;
+      received += count;
+    }
+    producer.join();
+    consume(sum);
+  }, 1, 3);
+  report(name("LockFreeRingBuffer streamed write/read", block_size),
+         lock_free_time / static_cast<double>(total), "sample");
+}
+}
+
+int main() {
+  for (std::size_t block_size: {64, 256, 1024}) {
+    benchmarkSingleThread(block_size);
+  }
+  for (std::size_t block_size: {64, 256, 1024}) {
+    benchmarkStreaming(block_size);
+  }
+  return 0;
+}
@@ -0,0 +1,76 @@
+#include "Benchmark.h"
+#include "utils/RealtimeWorkerPool.h"
+#include <HRTF/HRTFCereal.h>
+#include <BinauralSpatializer/3DTI_BinauralSpatializer.h>
+#include <cmath>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * Spatializes tracks in high quality the way the render jobs of Client do, on 1, 2, 4 and 8 threads of a
+ * RealtimeWorkerPool, and derives how many tracks fit into the deadline of one block at 128, 256 and 512 frames.
+ * The pool only helps as far as the machine has cores to spare.
+ */
+namespace {
+constexpr int kSampleRate = 48000;
+constexpr std::size_t kTracks = 64;
+constexpr std::size_t kIterations = 50;
+constexpr float kTwoPi = 6.2831853f;
+
+void benchmark(std::size_t frame_size, std::size_t threads) {
+  Binaural::CCore core(Common::TAudioStateStruct{kSampleRate, static_cast<int>(frame_size)});
+  auto listener = core.CreateListener();
+  listener->DisableCustomizedITD();
+  std::ifstream stream(DS_TEST_RESOURCES_DIR "/3DTI_HRTF_" DS_HRTF_SUBJECT "_" + std::to_string(frame_size) + "s_"
+                           + std::to_string(kSampleRate) + "Hz.3dti-hrtf", std::ios::binary);
+  if (!stream.good() || !HRTF::CreateFrom3dtiStream(stream, listener)) {
+    throw std::runtime_error("Could not load the HRTF for " + std::to_string(frame_size) + " frames");
+  }
+  std::vector<std::shared_ptr<Binaural::CSingleSourceDSP>> sources;
+  for (std::size_t track = 0; track < kTracks; track++) {
+    auto source = core.CreateSingleSourceDSP();
+    source->SetSpatializationMode(Binaural::TSpatializationMode::HighQuality);
+    source->DisableNearFieldEffect();
+    source->EnableAnechoicProcess();
+    source->EnableDistanceAttenuationAnechoic();
+    source->DisableReverbProcess();
+    const float angle = kTwoPi * static_cast<float>(track) / kTracks;
+    Common::CTransform transform;
+    transform.SetPosition(Common::CVector3(2 * std::cos(angle), 2 * std::sin(angle), 0));
+    source->SetSourceTransform(transform);
+    sources.push_back(source);
+  }
+  const CMonoBuffer<float> input(frame_size, 0.5f);
+  std::vector<Common::CEarPair<CMonoBuffer<float>>> outputs(kTracks);
+
+  RealtimeWorkerPool pool(threads - 1);
+  auto job = [&sources, &input, &outputs](std::size_t track, std::size_t) {
+    sources[track]->SetBuffer(input);
+    sources[track]->ProcessAnechoic(outputs[track].left, outputs[track].right);
+  };
+  const auto per_track = measureNanoseconds([&]() {
+    pool.run(kTracks, job);
+    consume(outputs[0].left[0]);
+  }, kIterations) / static_cast<double>(kTracks);
+
+  const std::string name = std::to_string(frame_size) + " frames, " + std::to_string(threads) + " threads";
+  report(name, per_track, "track");
+  const double deadline = 1e9 * static_cast<double>(frame_size) / kSampleRate;
+  std::cout << std::left << std::setw(56) << "  tracks within the deadline" << std::right << std::setw(12)
+            << static_cast<std::size_t>(deadline / per_track) << std::endl;
+}
+}
+
+int main() {
+  for (std::size_t frame_size: {128, 256, 512}) {
+    for (std::size_t threads: {1, 2, 4, 8}) {
+      benchmark(frame_size, threads);
+    }
+  }
+  return 0;
+}
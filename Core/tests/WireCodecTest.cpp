@@ -0,0 +1,55 @@
+#include "Check.h"
+#include "utils/WireCodec.h"
+#include <cstddef>
+#include <vector>
+
+namespace {
+void testRoundTrip(AudioSampleFormat format, double tolerance) {
+  constexpr std::size_t kSampleCount = 1001;
+  std::vector<float> input(kSampleCount);
+  for (std::size_t i = 0; i < kSampleCount; i++) {
+    input[i] = -1.0f + 2.0f * static_cast<float>(i) / static_cast<float>(kSampleCount - 1);
+  }
+  std::vector<std::byte> encoded(kSampleCount * getBytesPerSample(format));
+  CHECK(encodeSamples(format, input.data(), kSampleCount, encoded.data()) == encoded.size());
+  std::vector<float> output(kSampleCount);
+  CHECK(decodeSamples(format, encoded.data(), kSampleCount, output.data()) == kSampleCount);
+  for (std::size_t i = 0; i < kSampleCount; i++) {
+    // Relative to the magnitude for half floats, absolute for fixed point
+    const auto error = format == AudioSampleFormat::kFloat16 ? tolerance * std::max(std::abs(input[i]), 1e-4f)
+                                                             : tolerance;
+    CHECK_NEAR(output[i], input[i], error);
+  }
+}
+
+void testClipping(AudioSampleFormat format) {
+  const float input[] = {2.0f, -2.0f};
+  std::byte encoded[2 * 4];
+  float output[2];
+  encodeSamples(format, input, 2, encoded);
+  decodeSamples(format, encoded, 2, output);
+  CHECK(output[0] == 1.0f);
+  CHECK(output[1] == -1.0f);
+}
+
+void testHalfSpecialValues() {
+  using namespace wire_codec_detail;
+  CHECK(halfToFloat(floatToHalf(0.0f)) == 0.0f);
+  CHECK(std::isinf(halfToFloat(floatToHalf(1e6f))));
+  CHECK(std::isnan(halfToFloat(floatToHalf(std::nanf("")))));
+  // Subnormal halves
+  CHECK_NEAR(halfToFloat(floatToHalf(1e-6f)), 1e-6f, 1e-7f);
+}
+}
+
+int main() {
+  testRoundTrip(AudioSampleFormat::kFloat32, 0.0);
+  testRoundTrip(AudioSampleFormat::kFloat16, 1.0 / 1024);
+  testRoundTrip(AudioSampleFormat::kInt16, 0.5 / 32767 + 1e-7);
+  testRoundTrip(AudioSampleFormat::kInt24, 0.5 / 8388607 + 1e-7);
+  testClipping(AudioSampleFormat::kInt16);
+  testClipping(AudioSampleFormat::kInt24);
+  testHalfSpecialValues();
+  CHECK(decodeSamples(static_cast<AudioSampleFormat>(0xFF), nullptr, 1, nullptr) == 0);
+  return EXIT_SUCCESS;
+}